@@ -0,0 +1,375 @@
+/* bench.c - Microbenchmarks for the follow code
+ *
+ *   bench [-c cpu] [-r repetitions] [-w warmup_seconds] [name ...]
+ *
+ * Runs each benchmark (all of them by default) pinned to one CPU, after
+ * a warm-up that lasts until the time per call settles. The results are
+ * printed as JSON on stdout, after the extrapolation kernel they ran
+ * (extrap_kernel, see extrap.c):
+ *
+ *   ns_per_call      median over the repetitions (min_ns_per_call too)
+ *   cycles_per_call  median, in time stamp counter ticks (0 when the
+ *                    TSC is not available)
+ *   allocs_per_call  calls to malloc/calloc/realloc made by the follow
+ *                    code. Counted by linking with --wrap (see Makefile)
+ *
+ * The Python side of the binding is measured by bench.py.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#else
+#define HAVE_TSC 0
+#endif
+
+#include "follow.h"
+#include "extrap.h"
+
+#define DT              0.005   /* time step between calls, in seconds */
+#define BATCH_SECONDS   0.01    /* target duration of one repetition   */
+#define MAX_REPS        1000
+
+/* Allocation counting
+ */
+static unsigned long num_allocs;
+
+void *__real_malloc (size_t);
+void *__real_calloc (size_t, size_t);
+void *__real_realloc (void *, size_t);
+
+void *__wrap_malloc (size_t size)
+{
+    num_allocs++;
+    return __real_malloc (size);
+}
+
+void *__wrap_calloc (size_t n, size_t size)
+{
+    num_allocs++;
+    return __real_calloc (n, size);
+}
+
+void *__wrap_realloc (void *p, size_t size)
+{
+    num_allocs++;
+    return __real_realloc (p, size);
+}
+
+/* Results are stored here so the calls can't be optimized away */
+static volatile double sink;
+
+static mcs_parameters params;
+
+/* Position of a slowly accelerating target at time t */
+static double target (double t)
+{
+    return 10.0 + 0.4 * t + 0.001 * t * t;
+}
+
+/* The inputs of the calls, made before timing anything: the target at
+ * k*DT (stepTimes, stepPositions) and at 1.0 + k*DT (stepTimes1,
+ * stepPositions1), for k = 0 .. STEPS + 1. Call i uses the entries
+ * i % STEPS to i % STEPS + 2 */
+#define STEPS   1024
+
+static double stepTimes[STEPS + 2], stepPositions[STEPS + 2];
+static double stepTimes1[STEPS + 2], stepPositions1[STEPS + 2];
+
+static void make_inputs (void)
+{
+    int k;
+
+    for (k = 0; k < STEPS + 2; k++)
+    {
+        stepTimes[k]      = k * DT;
+        stepPositions[k]  = target (stepTimes[k]);
+        stepTimes1[k]     = 1.0 + k * DT;
+        stepPositions1[k] = target (stepTimes1[k]);
+    }
+}
+
+static void bench_calc_quadratic (long n)
+{
+    const double *t, *p;
+    double c0, c1, c2;
+    long   i;
+
+    for (i = 0; i < n; i++)
+    {
+        t = &stepTimes[i & (STEPS - 1)];
+        p = &stepPositions[i & (STEPS - 1)];
+        calc_quadratic (AZ_JUMP, t[0], p[0], t[1], p[1], t[2], p[2], &c0, &c1, &c2);
+        sink = c0 + c1 + c2;
+    }
+}
+
+static void bench_calc_linear (long n)
+{
+    const double *t, *p;
+    double c0, c1, c2;
+    long   i;
+
+    for (i = 0; i < n; i++)
+    {
+        t = &stepTimes[i & (STEPS - 1)];
+        p = &stepPositions[i & (STEPS - 1)];
+        calc_linear (AZ_JUMP, t[0], p[0], t[1], p[1], t[2], p[2], &c0, &c1, &c2);
+        sink = c0 + c1 + c2;
+    }
+}
+
+static void bench_calc_coeffs (long n)
+{
+    const double *t, *p;
+    double aa[2], bb[2], cc[2], A, B, C;
+    long   i;
+
+    for (i = 0; i < n; i++)
+    {
+        t = &stepTimes[i & (STEPS - 1)];
+        p = &stepPositions[i & (STEPS - 1)];
+        aa[0] = t[0]; aa[1] = p[0];
+        bb[0] = t[1]; bb[1] = p[1];
+        cc[0] = t[2]; cc[1] = p[2];
+        calc_coeffs (aa, bb, cc, &A, &B, &C);
+        sink = A + B + C;
+    }
+}
+
+static void bench_fillBuffer (long n)
+{
+    const double *t, *p;
+    double AA[2], BB[2], CC[2], pos[MAX_EXTRAP], vel[MAX_EXTRAP];
+    double last;
+    long   i;
+
+    for (i = 0; i < n; i++)
+    {
+        t = &stepTimes1[i & (STEPS - 1)];
+        p = &stepPositions1[i & (STEPS - 1)];
+        AA[0] = t[0]; AA[1] = p[0];
+        BB[0] = t[1]; BB[1] = p[1];
+        CC[0] = t[2]; CC[1] = p[2];
+        fillBuffer (AA, BB, CC, pos, vel, t[2], 1, &last, AZ_JUMP,
+                    2.0, 0.5, BB[1], 0.4, 0, 0, &params);
+        sink = pos[params.numExtrap - 1] + last;
+    }
+}
+
+static void bench_fit_new_AZ_demand (long n)
+{
+    const double *t, *p;
+    double pa, pb, pc;
+    long   i;
+
+    for (i = 0; i < n; i++)
+    {
+        t = &stepTimes1[i & (STEPS - 1)];
+        p = &stepPositions1[i & (STEPS - 1)];
+        pa = p[0];
+        pb = p[1];
+        pc = p[2];
+        fit_new_AZ_demand (t[0], &pa, t[1], &pb, t[2], &pc,
+                           2.0, 0.5, pb, 0, 0, &params);
+        sink = pa + pb + pc;
+    }
+}
+
+static void bench_fit_new_EL_demand (long n)
+{
+    const double *t, *p;
+    double pa, pb, pc;
+    long   i;
+
+    for (i = 0; i < n; i++)
+    {
+        t = &stepTimes1[i & (STEPS - 1)];
+        p = &stepPositions1[i & (STEPS - 1)];
+        pa = p[0];
+        pb = p[1];
+        pc = p[2];
+        fit_new_EL_demand (t[0], &pa, t[1], &pb, t[2], &pc,
+                           2.0, 0.5, pb, 0, 0, &params);
+        sink = pa + pb + pc;
+    }
+}
+
+static const struct {
+    const char *name;
+    void      (*run) (long);
+} benchmarks[] = {
+    { "calc_quadratic",    bench_calc_quadratic    },
+    { "calc_linear",       bench_calc_linear       },
+    { "calc_coeffs",       bench_calc_coeffs       },
+    { "fillBuffer",        bench_fillBuffer        },
+    { "fit_new_AZ_demand", bench_fit_new_AZ_demand },
+    { "fit_new_EL_demand", bench_fit_new_EL_demand },
+};
+
+#define NUM_BENCHMARKS (sizeof (benchmarks) / sizeof (benchmarks[0]))
+
+static double now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static unsigned long long ticks (void)
+{
+#if HAVE_TSC
+    return __rdtsc ();
+#else
+    return 0;
+#endif
+}
+
+static int compare_doubles (const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* run_one - Warm up, calibrate the batch size and time one benchmark
+ */
+static void run_one (FILE *out, int index, int reps, double warmup, int first)
+{
+    static double ns[MAX_REPS], cycles[MAX_REPS];
+    void   (*run) (long) = benchmarks[index].run;
+    double   t0, elapsed, prev = 0.0, per_call;
+    unsigned long long c0;
+    unsigned long allocs;
+    long     batch = 1;
+    int      r;
+
+    /* Every benchmark starts from the same state. The first fit takes a
+     * different path, so it is done here, out of the measurements */
+    mcs_init_parameters (&params);
+    run (2);
+
+    /* Grow the batch until it takes BATCH_SECONDS */
+    for (;;)
+    {
+        t0 = now ();
+        run (batch);
+        elapsed = now () - t0;
+        if (elapsed >= BATCH_SECONDS)
+            break;
+        batch *= 2;
+    }
+
+    /* Warm up until two consecutive batches agree within 2% */
+    t0 = now ();
+    while (now () - t0 < warmup)
+    {
+        double start = now ();
+
+        run (batch);
+        per_call = (now () - start) / batch;
+        if ((prev > 0.0) && (per_call > 0.98 * prev) && (per_call < 1.02 * prev))
+            break;
+        prev = per_call;
+    }
+
+    allocs = num_allocs;
+    for (r = 0; r < reps; r++)
+    {
+        t0 = now ();
+        c0 = ticks ();
+        run (batch);
+        cycles[r] = (double)(ticks () - c0) / batch;
+        ns[r] = (now () - t0) * 1e9 / batch;
+    }
+    allocs = num_allocs - allocs;
+
+    qsort (ns, reps, sizeof (double), compare_doubles);
+    qsort (cycles, reps, sizeof (double), compare_doubles);
+
+    fprintf (out, "%s    {\"name\": \"%s\", \"ns_per_call\": %.3f, \"min_ns_per_call\": %.3f, "
+            "\"cycles_per_call\": %.1f, \"allocs_per_call\": %.3f, \"calls\": %ld}",
+            first ? "" : ",\n", benchmarks[index].name, ns[reps / 2], ns[0],
+            cycles[reps / 2], (double)allocs / ((double)batch * reps),
+            batch * reps);
+}
+
+static void usage (const char *prog)
+{
+    fprintf (stderr, "Usage: %s [-c cpu] [-r repetitions] [-w warmup_seconds] [name ...]\n", prog);
+    exit (2);
+}
+
+int main (int argc, char **argv)
+{
+    cpu_set_t set;
+    FILE     *out = stdout;
+    int       cpu = -1, reps = 50, opt, i, j, first = 1;
+    double    warmup = 1.0;
+
+    while ((opt = getopt (argc, argv, "c:r:w:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'c':
+                cpu = atoi (optarg);
+                break;
+            case 'r':
+                reps = atoi (optarg);
+                break;
+            case 'w':
+                warmup = atof (optarg);
+                break;
+            default:
+                usage (argv[0]);
+        }
+    }
+    if ((reps < 1) || (reps > MAX_REPS))
+    {
+        fprintf (stderr, "The number of repetitions must be between 1 and %d\n", MAX_REPS);
+        return 2;
+    }
+
+    /* Pin to the given CPU, or to the one we're running on */
+    if (cpu < 0)
+        cpu = sched_getcpu ();
+    CPU_ZERO (&set);
+    CPU_SET (cpu, &set);
+    if (sched_setaffinity (0, sizeof (set), &set) == -1)
+    {
+        perror ("sched_setaffinity");
+        return 1;
+    }
+
+    /* The best kernel, as the module init picks for _mcs */
+    extrapolate_set_level (-1);
+    make_inputs ();
+
+    fprintf (out, "{\n  \"cpu\": %d,\n  \"repetitions\": %d,\n  \"num_extrap\": %d,\n"
+            "  \"extrap_kernel\": \"%s\",\n  \"benchmarks\": [\n",
+            cpu, reps, NUM_EXTRAP, extrapolate_level_name (extrapolate_level ()));
+    for (i = 0; i < (int)NUM_BENCHMARKS; i++)
+    {
+        if (optind < argc)
+        {
+            for (j = optind; j < argc; j++)
+                if (strcmp (argv[j], benchmarks[i].name) == 0)
+                    break;
+            if (j == argc)
+                continue;
+        }
+        run_one (out, i, reps, warmup, first);
+        first = 0;
+    }
+    fprintf (out, "\n  ]\n}\n");
+
+    return 0;
+}
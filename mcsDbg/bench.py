@@ -0,0 +1,194 @@
+# vim: ai:sw=4:sts=4:expandtab
+#
+# Microbenchmarks for the Python side of the binding (the C follow code
+# itself is measured by the "bench" make target, see bench.c)
+#
+#   python bench.py [-c CPU] [-r REPETITIONS] [-w WARMUP] [--ghz GHZ] [name ...]
+#
+# Prints JSON on stdout, with the same fields as bench.c:
+#
+#   ns_per_call      median over the repetitions (min_ns_per_call too)
+#   cycles_per_call  ns_per_call times the clock rate (--ghz, or the one
+#                    reported by /proc/cpuinfo); null if unknown
+#   allocs_per_call  memory blocks still allocated after the call, result
+#                    included. Needs sys.getallocatedblocks (Python 3.4+),
+#                    null otherwise
+
+import gc
+import os
+import sys
+import json
+import time
+import argparse
+import _mcs
+
+try:
+    xrange
+except NameError:
+    xrange = range
+
+DT = 0.005
+BATCH_SECONDS = 0.01
+STEPS = 1024        # distinct inputs the calls cycle through, as in bench.c
+
+# fillBuffer wants an old style class for "storage"
+class Point:
+    def __init__(self, pos, vel):
+        self.pos = pos
+        self.vel = vel
+
+def target(t):
+    return 10.0 + 0.4 * t + 0.001 * t * t
+
+def demands(i):
+    t = 1.0 + i * DT
+    return [(t, target(t)), (t + DT, target(t + DT)), (t + 2 * DT, target(t + 2 * DT))]
+
+# Made once, so that the timed loops only index them
+DEMANDS = [demands(i) for i in xrange(STEPS)]
+
+class Case(object):
+    """
+    One benchmark: setup() returns the state (and does the first fit,
+    which takes a different path); call(state, i) is the measured call
+    """
+    def __init__(self, name, call):
+        self.name = name
+        self.call = call
+
+    def setup(self):
+        params = _mcs.McsParams()
+        # Any numExtrap long buffers will do for out=
+        state = (params,) + tuple(_mcs.extrapolate(params, 0.0))
+        self.call(state, 0)
+        return state
+
+# Each variant calls fillBuffer itself: a wrapper forwarding **kwargs
+# would cost more than the differences being measured
+def fill_buffer(state, i):
+    dem = DEMANDS[i % STEPS]
+    return _mcs.fillBuffer(state[0], dem, 1, dem[2][0], 0.1, 2.0, 0.5, dem[1][1], 0.4, 0)
+
+def fill_buffer_storage(state, i):
+    dem = DEMANDS[i % STEPS]
+    return _mcs.fillBuffer(state[0], dem, 1, dem[2][0], 0.1, 2.0, 0.5, dem[1][1], 0.4, 0,
+                           storage=Point)
+
+def fill_buffer_out(state, i):
+    dem = DEMANDS[i % STEPS]
+    return _mcs.fillBuffer(state[0], dem, 1, dem[2][0], 0.1, 2.0, 0.5, dem[1][1], 0.4, 0,
+                           out=state[1:3])
+
+# The *_call cases pass the same arguments every time and write to out=,
+# which leaves the cost of the call itself (argument parsing included)
+FIXED = DEMANDS[0]
+
+def fill_buffer_call(state, i):
+    return _mcs.fillBuffer(state[0], FIXED, 1, FIXED[2][0], 0.1, 2.0, 0.5, FIXED[1][1], 0.4, 0, None, state[1:3])
+
+def step_call(state, i):
+    return state[0].step((FIXED[2][0], FIXED[2][1], 40.0), 0.01, FIXED[1][1], 0.4, 2.0, 0.5,
+                         40.0, 0.0, 1.0, 0.3, out=state[1:])
+
+CASES = [
+    Case('fillBuffer', fill_buffer),
+    Case('fillBuffer_storage', fill_buffer_storage),
+    Case('fillBuffer_out', fill_buffer_out),
+    Case('fillBuffer_call', fill_buffer_call),
+    Case('step_call', step_call),
+]
+
+def cpu_ghz():
+    try:
+        with open('/proc/cpuinfo') as f:
+            for line in f:
+                if line.startswith('cpu MHz'):
+                    return float(line.split(':')[1]) / 1000
+    except (IOError, OSError, ValueError):
+        pass
+    return None
+
+def run_batch(case, state, n):
+    call = case.call
+    start = time.time()
+    for i in xrange(n):
+        call(state, i)
+    return time.time() - start
+
+def blocks_kept(call, state, n):
+    # Memory blocks still allocated after n calls, keeping the results
+    blocks = sys.getallocatedblocks
+    results = [None] * n
+    before = blocks()
+    for i in xrange(n):
+        results[i] = call(state, i)
+    return blocks() - before
+
+def allocs_per_call(case, state, n):
+    if not hasattr(sys, 'getallocatedblocks'):
+        return None
+    # The loop itself keeps a block or two (the last i, for one), so those
+    # kept by calls that allocate nothing are taken off
+    baseline = blocks_kept(lambda state, i: None, state, n)
+    return float(blocks_kept(case.call, state, n) - baseline) / n
+
+def run(case, reps, warmup):
+    state = case.setup()
+
+    # Grow the batch until it takes BATCH_SECONDS
+    batch = 1
+    while run_batch(case, state, batch) < BATCH_SECONDS:
+        batch *= 2
+
+    # Warm up until two consecutive batches agree within 2%
+    prev = None
+    start = time.time()
+    while time.time() - start < warmup:
+        per_call = run_batch(case, state, batch) / batch
+        if prev is not None and 0.98 * prev < per_call < 1.02 * prev:
+            break
+        prev = per_call
+
+    gc.disable()
+    try:
+        ns = sorted(run_batch(case, state, batch) * 1e9 / batch for r in range(reps))
+        allocs = allocs_per_call(case, state, min(batch, 10000))
+    finally:
+        gc.enable()
+
+    return {'name': case.name, 'ns_per_call': ns[reps // 2], 'min_ns_per_call': ns[0],
+            'allocs_per_call': allocs, 'calls': batch * reps}
+
+def main():
+    parser = argparse.ArgumentParser(description="Benchmarks for the _mcs binding")
+    parser.add_argument('-c', '--cpu', type=int, help="CPU to pin to (default: the current one)")
+    parser.add_argument('-r', '--repetitions', type=int, default=50)
+    parser.add_argument('-w', '--warmup', type=float, default=1.0, help="maximum warm-up time (s)")
+    parser.add_argument('--ghz', type=float, help="clock rate used for cycles_per_call")
+    parser.add_argument('names', nargs='*', help="benchmarks to run (default: all)")
+    args = parser.parse_args()
+
+    cpu = args.cpu
+    if hasattr(os, 'sched_setaffinity'):
+        if cpu is None:
+            cpu = sorted(os.sched_getaffinity(0))[0]
+        os.sched_setaffinity(0, [cpu])
+    elif cpu is not None:
+        sys.stderr.write("Can't pin to a CPU from this Python, run under taskset instead\n")
+        cpu = None
+    ghz = args.ghz or cpu_ghz()
+
+    results = []
+    for case in CASES:
+        if args.names and case.name not in args.names:
+            continue
+        result = run(case, args.repetitions, args.warmup)
+        result['cycles_per_call'] = result['ns_per_call'] * ghz if ghz else None
+        results.append(result)
+
+    json.dump({'cpu': cpu, 'repetitions': args.repetitions, 'python': sys.version.split()[0],
+               'benchmarks': results}, sys.stdout, indent=2, sort_keys=True)
+    sys.stdout.write('\n')
+
+if __name__ == '__main__':
+    main()
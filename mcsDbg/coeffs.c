@@ -0,0 +1,451 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "coeffs.h"
+#include "follow.h"
+#include "simd.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define COEFFS_X86
+#include <immintrin.h>
+#endif
+
+/*
+**  - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+**   c o e f f s _ q u a d r a t i c ,   c o e f f s _ l i n e a r
+**  - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+**
+**  calc_quadratic and calc_linear for n independent demand triples.
+**
+**  Given:
+**    in        coeffs_inputs*   times and positions of the triples
+**    n         long             number of triples
+**
+**  Returned:
+**    out       coeffs_outputs*  coefficients c0, c1, c2 of each fit
+**    status    double[n]        0 = OK, -1 = singular case (can be NULL)
+**
+**  Status:
+**            long      number of singular cases
+**
+**  Notes:
+**
+**  1)  Every triple gets exactly the results of calc_quadratic (or
+**      calc_linear) called on it: the same determinant test, and the
+**      coefficients of the singular cases are left untouched. dpmax is
+**      ignored by both routines, so it is not taken here.
+**
+**  2)  The vector kernels perform the same IEEE operations in the same
+**      order as the scalar code (no fused multiply-add), so the results
+**      are identical to it. Only the sign of the NaNs coming out of NaN
+**      inputs may differ.
+**
+**  3)  coeffs_set_level(-1) picks the kernel from what the CPU supports;
+**      until then it is the scalar one. The MCS_SIMD environment
+**      variable ("scalar", "sse2", "avx2" or "avx512") can lower the
+**      choice; "sse2" means scalar (see simd_best_level).
+*/
+
+/* quadratic_lanes - calc_quadratic for the triples from start to n-1
+ */
+static long quadratic_lanes (const coeffs_inputs *in, long start, long n,
+                             coeffs_outputs *out, double *status)
+{
+    long i, failed = 0;
+    int  ret;
+
+    for (i = start; i < n; i++)
+    {
+        ret = calc_quadratic (0.0, in->time[0][i], in->pos[0][i],
+                              in->time[1][i], in->pos[1][i],
+                              in->time[2][i], in->pos[2][i],
+                              &out->c[0][i], &out->c[1][i], &out->c[2][i]);
+        failed -= ret;
+        if (status != NULL)
+            status[i] = ret;
+    }
+
+    return failed;
+}
+
+/* linear_lanes - calc_linear for the triples from start to n-1
+ */
+static long linear_lanes (const coeffs_inputs *in, long start, long n,
+                          coeffs_outputs *out, double *status)
+{
+    long i, failed = 0;
+    int  ret;
+
+    for (i = start; i < n; i++)
+    {
+        ret = calc_linear (0.0, in->time[0][i], in->pos[0][i],
+                           in->time[1][i], in->pos[1][i],
+                           in->time[2][i], in->pos[2][i],
+                           &out->c[0][i], &out->c[1][i], &out->c[2][i]);
+        failed -= ret;
+        if (status != NULL)
+            status[i] = ret;
+    }
+
+    return failed;
+}
+
+#ifdef COEFFS_X86
+
+/* The vector kernels follow calc_quadratic and calc_linear. The
+ * coefficients are blended with their previous values, so that the
+ * singular lanes are left untouched. -x flips the sign bit, as the
+ * compiler does for the scalar code (0 - x would give +0.0 for +0.0)
+ */
+
+#define AVX2_BLEND(A, B, M)	_mm256_blendv_pd((A), (B), (M))
+#define AVX2_GT(A, B)		_mm256_cmp_pd((A), (B), _CMP_GT_OQ)
+#define AVX2_NEG(A)		_mm256_xor_pd((A), _mm256_set1_pd(-0.0))
+
+/* quadratic_avx2 - calc_quadratic, 4 triples at a time
+ */
+__attribute__((target("avx2")))
+static long quadratic_avx2 (const coeffs_inputs *in, long n,
+                            coeffs_outputs *out, double *status)
+{
+    const __m256d zero = _mm256_setzero_pd();
+    long i, failed = 0;
+    int  k, bits;
+
+    for (i = 0; i + 4 <= n; i += 4)
+    {
+        __m256d ta = _mm256_loadu_pd(&in->time[0][i]);
+        __m256d tb = _mm256_loadu_pd(&in->time[1][i]);
+        __m256d tc = _mm256_loadu_pd(&in->time[2][i]);
+        __m256d pa = _mm256_loadu_pd(&in->pos[0][i]);
+        __m256d pb = _mm256_loadu_pd(&in->pos[1][i]);
+        __m256d pc = _mm256_loadu_pd(&in->pos[2][i]);
+        __m256d ab, bc, ac, d, bad, c0, c1, c2;
+
+        /* Time differences */
+        ab = _mm256_sub_pd(ta, tb);
+        bc = _mm256_sub_pd(tb, tc);
+        ac = _mm256_sub_pd(ta, tc);
+
+        /* Determinant (must be non-zero) */
+        d   = _mm256_mul_pd(_mm256_mul_pd(ab, bc), ac);
+        bad = _mm256_cmp_pd(d, zero, _CMP_EQ_OQ);
+
+        /* Solution */
+        c0 = _mm256_div_pd(
+                _mm256_add_pd(
+                    _mm256_sub_pd(
+                        _mm256_mul_pd(_mm256_mul_pd(_mm256_mul_pd(pa, tb), tc), bc),
+                        _mm256_mul_pd(_mm256_mul_pd(_mm256_mul_pd(pb, ta), tc), ac)),
+                    _mm256_mul_pd(_mm256_mul_pd(_mm256_mul_pd(pc, ta), tb), ab)),
+                d);
+        c1 = _mm256_div_pd(
+                _mm256_sub_pd(
+                    _mm256_add_pd(
+                        _mm256_mul_pd(_mm256_mul_pd(AVX2_NEG(pa), bc),
+                                      _mm256_add_pd(tb, tc)),
+                        _mm256_mul_pd(_mm256_mul_pd(pb, ac), _mm256_add_pd(ta, tc))),
+                    _mm256_mul_pd(_mm256_mul_pd(pc, ab), _mm256_add_pd(ta, tb))),
+                d);
+        c2 = _mm256_div_pd(
+                _mm256_add_pd(
+                    _mm256_sub_pd(_mm256_mul_pd(pa, bc), _mm256_mul_pd(pb, ac)),
+                    _mm256_mul_pd(pc, ab)),
+                d);
+
+        _mm256_storeu_pd(&out->c[0][i], AVX2_BLEND(c0, _mm256_loadu_pd(&out->c[0][i]), bad));
+        _mm256_storeu_pd(&out->c[1][i], AVX2_BLEND(c1, _mm256_loadu_pd(&out->c[1][i]), bad));
+        _mm256_storeu_pd(&out->c[2][i], AVX2_BLEND(c2, _mm256_loadu_pd(&out->c[2][i]), bad));
+
+        bits = _mm256_movemask_pd(bad);
+        for (k = 0; k < 4; k++)
+        {
+            if (status != NULL)
+                status[i + k] = ((bits >> k) & 1) ? -1.0 : 0.0;
+            failed += (bits >> k) & 1;
+        }
+    }
+
+    return failed + quadratic_lanes (in, i, n, out, status);
+}
+
+/* linear_avx2 - calc_linear, 4 triples at a time
+ */
+__attribute__((target("avx2")))
+static long linear_avx2 (const coeffs_inputs *in, long n,
+                         coeffs_outputs *out, double *status)
+{
+    const __m256d zero = _mm256_setzero_pd();
+    long i, failed = 0;
+    int  k, bits;
+
+    for (i = 0; i + 4 <= n; i += 4)
+    {
+        __m256d ta = _mm256_loadu_pd(&in->time[0][i]);
+        __m256d tb = _mm256_loadu_pd(&in->time[1][i]);
+        __m256d tc = _mm256_loadu_pd(&in->time[2][i]);
+        __m256d pa = _mm256_loadu_pd(&in->pos[0][i]);
+        __m256d pb = _mm256_loadu_pd(&in->pos[1][i]);
+        __m256d pc = _mm256_loadu_pd(&in->pos[2][i]);
+        __m256d tw, pw, m, d, bad, c0, c1;
+
+        /* Sort so that the most recent two points are (tb,pb) and (tc,pc) */
+        m  = AVX2_GT(ta, tb);
+        tw = ta; pw = pa;
+        ta = AVX2_BLEND(ta, tb, m); pa = AVX2_BLEND(pa, pb, m);
+        tb = AVX2_BLEND(tb, tw, m); pb = AVX2_BLEND(pb, pw, m);
+        m  = AVX2_GT(tb, tc);
+        tw = tb; pw = pb;
+        tb = AVX2_BLEND(tb, tc, m); pb = AVX2_BLEND(pb, pc, m);
+        tc = AVX2_BLEND(tc, tw, m); pc = AVX2_BLEND(pc, pw, m);
+        m  = AVX2_GT(ta, tb);
+        tw = ta; pw = pa;
+        ta = AVX2_BLEND(ta, tb, m); pa = AVX2_BLEND(pa, pb, m);
+        tb = AVX2_BLEND(tb, tw, m); pb = AVX2_BLEND(pb, pw, m);
+
+        /* Determinant (must be non-zero) */
+        d   = _mm256_sub_pd(tc, tb);
+        bad = _mm256_cmp_pd(d, zero, _CMP_EQ_OQ);
+
+        /* Solution */
+        c0 = _mm256_div_pd(_mm256_sub_pd(_mm256_mul_pd(pb, tc), _mm256_mul_pd(pc, tb)), d);
+        c1 = _mm256_div_pd(_mm256_sub_pd(pc, pb), d);
+
+        _mm256_storeu_pd(&out->c[0][i], AVX2_BLEND(c0, _mm256_loadu_pd(&out->c[0][i]), bad));
+        _mm256_storeu_pd(&out->c[1][i], AVX2_BLEND(c1, _mm256_loadu_pd(&out->c[1][i]), bad));
+        _mm256_storeu_pd(&out->c[2][i], AVX2_BLEND(zero, _mm256_loadu_pd(&out->c[2][i]), bad));
+
+        bits = _mm256_movemask_pd(bad);
+        for (k = 0; k < 4; k++)
+        {
+            if (status != NULL)
+                status[i + k] = ((bits >> k) & 1) ? -1.0 : 0.0;
+            failed += (bits >> k) & 1;
+        }
+    }
+
+    return failed + linear_lanes (in, i, n, out, status);
+}
+
+#define AVX512_BLEND(A, B, M)	_mm512_mask_blend_pd((M), (A), (B))
+#define AVX512_GT(A, B)		_mm512_cmp_pd_mask((A), (B), _CMP_GT_OQ)
+#define AVX512_NEG(A)		_mm512_castsi512_pd(_mm512_xor_epi64( \
+				    _mm512_castpd_si512(A), \
+				    _mm512_set1_epi64((long long)0x8000000000000000ULL)))
+
+/* quadratic_avx512 - calc_quadratic, 8 triples at a time
+ */
+__attribute__((target("avx512f")))
+static long quadratic_avx512 (const coeffs_inputs *in, long n,
+                              coeffs_outputs *out, double *status)
+{
+    const __m512d zero = _mm512_setzero_pd();
+    long i, failed = 0;
+    int  k;
+
+    for (i = 0; i + 8 <= n; i += 8)
+    {
+        __m512d ta = _mm512_loadu_pd(&in->time[0][i]);
+        __m512d tb = _mm512_loadu_pd(&in->time[1][i]);
+        __m512d tc = _mm512_loadu_pd(&in->time[2][i]);
+        __m512d pa = _mm512_loadu_pd(&in->pos[0][i]);
+        __m512d pb = _mm512_loadu_pd(&in->pos[1][i]);
+        __m512d pc = _mm512_loadu_pd(&in->pos[2][i]);
+        __m512d ab, bc, ac, d, c0, c1, c2;
+        __mmask8 ok;
+
+        /* Time differences */
+        ab = _mm512_sub_pd(ta, tb);
+        bc = _mm512_sub_pd(tb, tc);
+        ac = _mm512_sub_pd(ta, tc);
+
+        /* Determinant (must be non-zero) */
+        d  = _mm512_mul_pd(_mm512_mul_pd(ab, bc), ac);
+        ok = _mm512_cmp_pd_mask(d, zero, _CMP_NEQ_UQ);
+
+        /* Solution */
+        c0 = _mm512_div_pd(
+                _mm512_add_pd(
+                    _mm512_sub_pd(
+                        _mm512_mul_pd(_mm512_mul_pd(_mm512_mul_pd(pa, tb), tc), bc),
+                        _mm512_mul_pd(_mm512_mul_pd(_mm512_mul_pd(pb, ta), tc), ac)),
+                    _mm512_mul_pd(_mm512_mul_pd(_mm512_mul_pd(pc, ta), tb), ab)),
+                d);
+        c1 = _mm512_div_pd(
+                _mm512_sub_pd(
+                    _mm512_add_pd(
+                        _mm512_mul_pd(_mm512_mul_pd(AVX512_NEG(pa), bc),
+                                      _mm512_add_pd(tb, tc)),
+                        _mm512_mul_pd(_mm512_mul_pd(pb, ac), _mm512_add_pd(ta, tc))),
+                    _mm512_mul_pd(_mm512_mul_pd(pc, ab), _mm512_add_pd(ta, tb))),
+                d);
+        c2 = _mm512_div_pd(
+                _mm512_add_pd(
+                    _mm512_sub_pd(_mm512_mul_pd(pa, bc), _mm512_mul_pd(pb, ac)),
+                    _mm512_mul_pd(pc, ab)),
+                d);
+
+        _mm512_mask_storeu_pd(&out->c[0][i], ok, c0);
+        _mm512_mask_storeu_pd(&out->c[1][i], ok, c1);
+        _mm512_mask_storeu_pd(&out->c[2][i], ok, c2);
+
+        for (k = 0; k < 8; k++)
+        {
+            if (status != NULL)
+                status[i + k] = ((ok >> k) & 1) ? 0.0 : -1.0;
+            failed += !((ok >> k) & 1);
+        }
+    }
+
+    return failed + quadratic_lanes (in, i, n, out, status);
+}
+
+/* linear_avx512 - calc_linear, 8 triples at a time
+ */
+__attribute__((target("avx512f")))
+static long linear_avx512 (const coeffs_inputs *in, long n,
+                           coeffs_outputs *out, double *status)
+{
+    const __m512d zero = _mm512_setzero_pd();
+    long i, failed = 0;
+    int  k;
+
+    for (i = 0; i + 8 <= n; i += 8)
+    {
+        __m512d ta = _mm512_loadu_pd(&in->time[0][i]);
+        __m512d tb = _mm512_loadu_pd(&in->time[1][i]);
+        __m512d tc = _mm512_loadu_pd(&in->time[2][i]);
+        __m512d pa = _mm512_loadu_pd(&in->pos[0][i]);
+        __m512d pb = _mm512_loadu_pd(&in->pos[1][i]);
+        __m512d pc = _mm512_loadu_pd(&in->pos[2][i]);
+        __m512d tw, pw, d, c0, c1;
+        __mmask8 m, ok;
+
+        /* Sort so that the most recent two points are (tb,pb) and (tc,pc) */
+        m  = AVX512_GT(ta, tb);
+        tw = ta; pw = pa;
+        ta = AVX512_BLEND(ta, tb, m); pa = AVX512_BLEND(pa, pb, m);
+        tb = AVX512_BLEND(tb, tw, m); pb = AVX512_BLEND(pb, pw, m);
+        m  = AVX512_GT(tb, tc);
+        tw = tb; pw = pb;
+        tb = AVX512_BLEND(tb, tc, m); pb = AVX512_BLEND(pb, pc, m);
+        tc = AVX512_BLEND(tc, tw, m); pc = AVX512_BLEND(pc, pw, m);
+        m  = AVX512_GT(ta, tb);
+        tw = ta; pw = pa;
+        ta = AVX512_BLEND(ta, tb, m); pa = AVX512_BLEND(pa, pb, m);
+        tb = AVX512_BLEND(tb, tw, m); pb = AVX512_BLEND(pb, pw, m);
+
+        /* Determinant (must be non-zero) */
+        d  = _mm512_sub_pd(tc, tb);
+        ok = _mm512_cmp_pd_mask(d, zero, _CMP_NEQ_UQ);
+
+        /* Solution */
+        c0 = _mm512_div_pd(_mm512_sub_pd(_mm512_mul_pd(pb, tc), _mm512_mul_pd(pc, tb)), d);
+        c1 = _mm512_div_pd(_mm512_sub_pd(pc, pb), d);
+
+        _mm512_mask_storeu_pd(&out->c[0][i], ok, c0);
+        _mm512_mask_storeu_pd(&out->c[1][i], ok, c1);
+        _mm512_mask_storeu_pd(&out->c[2][i], ok, zero);
+
+        for (k = 0; k < 8; k++)
+        {
+            if (status != NULL)
+                status[i + k] = ((ok >> k) & 1) ? 0.0 : -1.0;
+            failed += !((ok >> k) & 1);
+        }
+    }
+
+    return failed + linear_lanes (in, i, n, out, status);
+}
+
+#endif // COEFFS_X86
+
+static long quadratic_scalar (const coeffs_inputs *in, long n,
+                              coeffs_outputs *out, double *status)
+{
+    return quadratic_lanes (in, 0, n, out, status);
+}
+
+static long linear_scalar (const coeffs_inputs *in, long n,
+                           coeffs_outputs *out, double *status)
+{
+    return linear_lanes (in, 0, n, out, status);
+}
+
+typedef long (*coeffs_fit)(const coeffs_inputs *, long, coeffs_outputs *,
+                           double *);
+
+static const struct {
+    coeffs_fit quadratic;
+    coeffs_fit linear;
+} kernel_sets[] = {
+    { quadratic_scalar, linear_scalar },
+#ifdef COEFFS_X86
+    { quadratic_avx2,   linear_avx2   },
+    { quadratic_avx512, linear_avx512 },
+#endif
+};
+
+static const char *level_names[] = { "scalar", "avx2", "avx512" };
+
+/* The scalar kernels until coeffs_set_level is called (the module init
+ * picks the best ones). Read and written atomically, so that the level
+ * can change while others run
+ */
+static int current_level = COEFFS_SCALAR;
+
+/* coeffs_best_level - Highest kernel level the CPU supports (see
+ * simd_best_level)
+ */
+static int coeffs_best_level (void)
+{
+    switch (simd_best_level())
+    {
+    case SIMD_AVX512:
+        return COEFFS_AVX512;
+    case SIMD_AVX2:
+        return COEFFS_AVX2;
+    default:
+        return COEFFS_SCALAR;
+    }
+}
+
+/* coeffs_set_level - Select a kernel. Returns the level actually in use,
+ * which is lower than the one requested if the CPU lacks support
+ */
+int coeffs_set_level (int level)
+{
+    int best = coeffs_best_level();
+
+    if ((level < COEFFS_SCALAR) || (level > best))
+        level = best;
+
+    __atomic_store_n (&current_level, level, __ATOMIC_RELAXED);
+
+    return level;
+}
+
+int coeffs_level (void)
+{
+    return __atomic_load_n (&current_level, __ATOMIC_RELAXED);
+}
+
+const char *coeffs_level_name (int level)
+{
+    if ((level < COEFFS_SCALAR) || (level > COEFFS_AVX512))
+        return "unknown";
+
+    return level_names[level];
+}
+
+long coeffs_quadratic (const coeffs_inputs *in, long n, coeffs_outputs *out,
+                       double *status)
+{
+    return kernel_sets[coeffs_level()].quadratic (in, n, out, status);
+}
+
+long coeffs_linear (const coeffs_inputs *in, long n, coeffs_outputs *out,
+                    double *status)
+{
+    return kernel_sets[coeffs_level()].linear (in, n, out, status);
+}
@@ -0,0 +1,28 @@
+#ifndef __COEFFS_H__
+#define __COEFFS_H__
+
+/* Kernel levels, from slowest to fastest */
+#define COEFFS_SCALAR	0
+#define COEFFS_AVX2	1
+#define COEFFS_AVX512	2
+
+/* n demand triples, as arrays of n elements */
+typedef struct {
+	const double *time[3];	/* ta, tb, tc */
+	const double *pos[3];	/* pa, pb, pc */
+} coeffs_inputs;
+
+/* Polynomial coefficients (p = c0 + c1*t + c2*t*t) of n fits */
+typedef struct {
+	double *c[3];		/* c0, c1, c2 */
+} coeffs_outputs;
+
+long coeffs_quadratic	(const coeffs_inputs *, long, coeffs_outputs *,
+			 double *);
+long coeffs_linear	(const coeffs_inputs *, long, coeffs_outputs *,
+			 double *);
+int  coeffs_level	(void);
+int  coeffs_set_level	(int);
+const char *coeffs_level_name	(int);
+
+#endif // __COEFFS_H__
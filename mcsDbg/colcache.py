@@ -0,0 +1,243 @@
+# vim: ai:sw=4:sts=4:expandtab
+import os
+import mmap
+import struct
+import hashlib
+import numpy as np
+
+##################################################################
+# Binary columnar cache for parsed telemetry logs
+#
+# Parsing the tab separated logs (see util.CsvFile) is slow, so the
+# parsed rows are saved in a binary file that can be memory mapped on
+# later reads. The layout (all little endian) is:
+#
+#   header  - magic 'MCSCOL01', version, number of data columns,
+#             rows per block, size and mtime of the source log,
+#             then one 16 byte name per column
+#   blocks  - up to block_rows rows each, stored column by column:
+#             int64 timestamps (microseconds since the epoch, naive),
+#             followed by one float64 array per data column
+#   footer  - per block: file offset, number of rows, min and max
+#             timestamp; then the footer offset, number of blocks,
+#             total number of rows and the magic 'MCSCOLND'
+#
+# A reader asking for some columns or a time range only touches the
+# pages of the matching blocks and columns.
+
+MAGIC       = b'MCSCOL01'
+END_MAGIC   = b'MCSCOLND'
+VERSION     = 1
+BLOCK_ROWS  = 65536
+
+_HEADER     = struct.Struct('<8sIIIIqd')
+_NAME       = struct.Struct('<16s')
+_BLOCK      = struct.Struct('<QQqq')
+_TRAILER    = struct.Struct('<QQQ8s')
+
+def cache_dir():
+    """
+    Directory holding the cache files: $MCSDBG_CACHE_DIR, or
+    ~/.cache/mcsDbg by default
+    """
+    return os.environ.get('MCSDBG_CACHE_DIR',
+                          os.path.join(os.path.expanduser('~'), '.cache', 'mcsDbg'))
+
+def cache_path(source):
+    """
+    Cache file for a source log, keyed by its absolute path. The size and
+    mtime of the source are stored in the header to detect stale caches
+    """
+    key = hashlib.sha1(os.path.abspath(source).encode('utf-8')).hexdigest()
+    return os.path.join(cache_dir(), key + '.col')
+
+def open_cache(source, ncols):
+    """
+    Returns a ColumnarCache for the source log, or None if there is no
+    cache file or it doesn't match the current log (or the number of
+    data columns)
+    """
+    path = cache_path(source)
+    try:
+        st = os.stat(source)
+        cache = ColumnarCache(path)
+    except (IOError, OSError, ValueError):
+        return None
+
+    if (cache.source_size, cache.source_mtime, cache.ncols) != (st.st_size, st.st_mtime, ncols):
+        cache.close()
+        return None
+
+    return cache
+
+class ColumnarWriter(object):
+    """
+    Writes rows (timestamp in microseconds, ncols float values) to a new
+    cache file, one block at a time. The file is written under a temporary
+    name and only renamed into place by close()
+    """
+    def __init__(self, path, ncols, source_size, source_mtime, names=None, block_rows=BLOCK_ROWS):
+        if names is None:
+            names = ['c{0}'.format(i + 1) for i in range(ncols)]
+        if len(names) != ncols:
+            raise ValueError("Expected {0} column names".format(ncols))
+
+        dirname = os.path.dirname(path)
+        if dirname and not os.path.isdir(dirname):
+            os.makedirs(dirname)
+
+        self.path = path
+        self.tmp_path = '{0}.{1}.tmp'.format(path, os.getpid())
+        self.ncols = ncols
+        self.block_rows = block_rows
+        self.blocks = []
+        self.nrows = 0
+        self._reset()
+
+        self.f = open(self.tmp_path, 'wb')
+        self.f.write(_HEADER.pack(MAGIC, VERSION, ncols, block_rows, 0, source_size, source_mtime))
+        for name in names:
+            self.f.write(_NAME.pack(name.encode('utf-8')))
+
+    def _reset(self):
+        self.times = []
+        self.values = [[] for i in range(self.ncols)]
+
+    def append(self, t, values):
+        self.times.append(t)
+        for col, v in zip(self.values, values):
+            col.append(v)
+        if len(self.times) == self.block_rows:
+            self._flush()
+
+    def _flush(self):
+        if not self.times:
+            return
+        times = np.array(self.times, dtype='<i8')
+        offset = self.f.tell()
+        self.f.write(times.tobytes())
+        for col in self.values:
+            self.f.write(np.array(col, dtype='<f8').tobytes())
+        self.blocks.append((offset, len(times), int(times.min()), int(times.max())))
+        self.nrows += len(times)
+        self._reset()
+
+    def close(self):
+        self._flush()
+        footer = self.f.tell()
+        for block in self.blocks:
+            self.f.write(_BLOCK.pack(*block))
+        self.f.write(_TRAILER.pack(footer, len(self.blocks), self.nrows, END_MAGIC))
+        self.f.close()
+        os.rename(self.tmp_path, self.path)
+
+    def abort(self):
+        self.f.close()
+        try:
+            os.unlink(self.tmp_path)
+        except OSError:
+            pass
+
+class ColumnarCache(object):
+    """
+    Memory mapped view of a cache file.
+
+    Columns are referred to by their 0-based index among the data
+    columns (ie. excluding the timestamp)
+    """
+    def __init__(self, path):
+        self.f = open(path, 'rb')
+        try:
+            self.mm = mmap.mmap(self.f.fileno(), 0, access=mmap.ACCESS_READ)
+        except (ValueError, mmap.error):
+            self.f.close()
+            raise ValueError("Empty cache file")
+
+        try:
+            self._read_layout()
+        except (ValueError, struct.error):
+            self.close()
+            raise ValueError("Not a valid cache file: {0}".format(path))
+
+    def _read_layout(self):
+        mm = self.mm
+        (magic, version, self.ncols, self.block_rows, _,
+         self.source_size, self.source_mtime) = _HEADER.unpack_from(mm, 0)
+        if magic != MAGIC or version != VERSION:
+            raise ValueError
+        names = []
+        for i in range(self.ncols):
+            name = _NAME.unpack_from(mm, _HEADER.size + i * _NAME.size)[0]
+            names.append(name.rstrip(b'\0').decode('utf-8'))
+        self.names = names
+
+        footer, nblocks, self.nrows, end_magic = _TRAILER.unpack_from(mm, len(mm) - _TRAILER.size)
+        if end_magic != END_MAGIC:
+            raise ValueError
+        self.blocks = [_BLOCK.unpack_from(mm, footer + i * _BLOCK.size) for i in range(nblocks)]
+
+    def close(self):
+        if self.mm is not None:
+            self.mm.close()
+            self.mm = None
+        self.f.close()
+
+    def _block_times(self, block):
+        offset, n = block[:2]
+        return np.frombuffer(self.mm, dtype='<i8', count=n, offset=offset)
+
+    def _block_column(self, block, col):
+        offset, n = block[:2]
+        return np.frombuffer(self.mm, dtype='<f8', count=n, offset=offset + 8 * n * (col + 1))
+
+    def read(self, cols=None, start=None, end=None):
+        """
+        Returns (times, [column, ...]) as numpy arrays for the rows with
+        start <= time < end (both in microseconds, None meaning no limit).
+        Only the requested columns are read (all of them by default)
+        """
+        if cols is None:
+            cols = range(self.ncols)
+        cols = list(cols)
+        for col in cols:
+            if not 0 <= col < self.ncols:
+                raise IndexError("No such column: {0}".format(col))
+
+        times = []
+        values = [[] for col in cols]
+        for block in self.blocks:
+            tmin, tmax = block[2:]
+            if (start is not None and tmax < start) or (end is not None and tmin >= end):
+                continue
+            t = self._block_times(block)
+            if (start is None or tmin >= start) and (end is None or tmax < end):
+                sel = slice(None)
+            else:
+                sel = np.ones(len(t), dtype=bool)
+                if start is not None:
+                    sel &= t >= start
+                if end is not None:
+                    sel &= t < end
+            times.append(t[sel])
+            for vals, col in zip(values, cols):
+                vals.append(self._block_column(block, col)[sel])
+
+        def join(chunks, dtype):
+            if not chunks:
+                return np.empty(0, dtype=dtype)
+            if len(chunks) == 1:
+                return chunks[0]
+            return np.concatenate(chunks)
+
+        return join(times, '<i8'), [join(vals, '<f8') for vals in values]
+
+    def __iter__(self):
+        """
+        Iterates over all the rows, as (time, value, ...) tuples, the time
+        being integer microseconds
+        """
+        for block in self.blocks:
+            columns = [self._block_times(block).tolist()]
+            columns.extend(self._block_column(block, col).tolist() for col in range(self.ncols))
+            for row in zip(*columns):
+                yield row
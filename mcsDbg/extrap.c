@@ -0,0 +1,292 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "extrap.h"
+#include "simd.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define EXTRAP_X86
+#include <immintrin.h>
+#endif
+
+/*
+**  - - - - - - - - - - - - - - - -
+**   e x t r a p o l a t e _ a x e s
+**  - - - - - - - - - - - - - - - -
+**
+**  Evaluate the fitted parabolas for both axes on the extrapolation
+**  grid, tt = offset + i*dt for i = 1..n.
+**
+**  Given:
+**    az        double[3]    Az coefficients (A, B, C)
+**    el        double[3]    El coefficients (A, B, C), or NULL to skip El
+**    offset    double       start of the grid
+**    dt        double       grid step (TIME_INT)
+**    n         int          number of points
+**
+**  Returned:
+**    azPos, azVel   double[n]   Az position (A*tt + B)*tt + C
+**                               and velocity 2*A*tt + B
+**    elPos, elVel   double[n]   Same for El (untouched if el is NULL)
+**
+**  Notes:
+**
+**  1)  The vector kernels perform exactly the same sequence of IEEE
+**      multiplications and additions as the scalar loop (no fused
+**      multiply-add, no reassociation), so every kernel produces
+**      results identical to the scalar one: the error bound between
+**      them is 0 ULP.
+**
+**  2)  extrapolate_set_level(-1) picks the kernel from what the CPU
+**      supports; until then it is the scalar one. The MCS_SIMD
+**      environment variable ("scalar", "sse2" or "avx2") can lower the
+**      choice, eg. to compare the paths (see simd_best_level).
+**
+**  3)  n = 10, 20 and 40 (the usual PMAC buffer depths) run fully
+**      unrolled versions of the kernel; other sizes use a generic loop.
+*/
+
+typedef void (*extrap_kernel)(const double *, const double *, double, double,
+			      int, double *, double *, double *, double *);
+
+/* The kernel bodies are always inlined into thin wrappers with a constant
+ * number of points for the common sizes (10, 20 and 40), which lets the
+ * compiler unroll them completely. Any other size uses a generic wrapper.
+ */
+#define EXTRAP_INLINE	static inline __attribute__((always_inline))
+
+#if defined(__GNUC__) && !defined(__clang__) && (__GNUC__ >= 8)
+#define EXTRAP_UNROLL	_Pragma("GCC unroll 40")
+#else
+#define EXTRAP_UNROLL
+#endif
+
+#define EXTRAP_SPECIALIZE(LEVEL, ATTR, N)				\
+ATTR static void							\
+extrap_kernel_ ## LEVEL ## _ ## N (const double *az, const double *el,	\
+                                  double offset, double dt, int n,	\
+                                  double *azPos, double *azVel,		\
+                                  double *elPos, double *elVel)		\
+{									\
+    extrap_ ## LEVEL (az, el, offset, dt, N, azPos, azVel, elPos, elVel); \
+}
+
+#define EXTRAP_SPECIALIZE_ALL(LEVEL, ATTR)				\
+    EXTRAP_SPECIALIZE(LEVEL, ATTR, 10)					\
+    EXTRAP_SPECIALIZE(LEVEL, ATTR, 20)					\
+    EXTRAP_SPECIALIZE(LEVEL, ATTR, 40)					\
+    EXTRAP_SPECIALIZE(LEVEL, ATTR, n)
+
+EXTRAP_INLINE void
+extrap_tail (const double *az, const double *el, double offset, double dt,
+             int first, int n, double *azPos, double *azVel,
+             double *elPos, double *elVel)
+{
+    int    i;
+    double tt;
+
+    EXTRAP_UNROLL
+    for (i = first; i < n; i++)
+    {
+        tt       = offset + (i+1)*dt;
+        azPos[i] = (az[0]*tt + az[1])*tt + az[2];
+        azVel[i] = 2.0*az[0]*tt + az[1];
+        if (el != NULL)
+        {
+            elPos[i] = (el[0]*tt + el[1])*tt + el[2];
+            elVel[i] = 2.0*el[0]*tt + el[1];
+        }
+    }
+}
+
+EXTRAP_INLINE void
+extrap_scalar (const double *az, const double *el, double offset,
+               double dt, int n, double *azPos, double *azVel,
+               double *elPos, double *elVel)
+{
+    extrap_tail (az, el, offset, dt, 0, n, azPos, azVel, elPos, elVel);
+}
+
+EXTRAP_SPECIALIZE_ALL(scalar, )
+
+#ifdef EXTRAP_X86
+
+__attribute__((target("sse2")))
+EXTRAP_INLINE void
+extrap_sse2 (const double *az, const double *el, double offset,
+             double dt, int n, double *azPos, double *azVel,
+             double *elPos, double *elVel)
+{
+    int     i;
+    __m128d off = _mm_set1_pd(offset);
+    __m128d vdt = _mm_set1_pd(dt);
+    __m128d two = _mm_set1_pd(2.0);
+    __m128d aA  = _mm_set1_pd(az[0]), aB = _mm_set1_pd(az[1]), aC = _mm_set1_pd(az[2]);
+    __m128d a2A = _mm_mul_pd(two, aA);
+    __m128d eA, eB, eC, e2A;
+    __m128d idx = _mm_set_pd(2.0, 1.0);
+    __m128d inc = _mm_set1_pd(2.0);
+    __m128d tt;
+
+    if (el != NULL)
+    {
+        eA  = _mm_set1_pd(el[0]);
+        eB  = _mm_set1_pd(el[1]);
+        eC  = _mm_set1_pd(el[2]);
+        e2A = _mm_mul_pd(two, eA);
+    }
+
+    EXTRAP_UNROLL
+    for (i = 0; i + 2 <= n; i += 2, idx = _mm_add_pd(idx, inc))
+    {
+        tt = _mm_add_pd(off, _mm_mul_pd(idx, vdt));
+        _mm_storeu_pd(&azPos[i],
+            _mm_add_pd(_mm_mul_pd(_mm_add_pd(_mm_mul_pd(aA, tt), aB), tt), aC));
+        _mm_storeu_pd(&azVel[i], _mm_add_pd(_mm_mul_pd(a2A, tt), aB));
+        if (el != NULL)
+        {
+            _mm_storeu_pd(&elPos[i],
+                _mm_add_pd(_mm_mul_pd(_mm_add_pd(_mm_mul_pd(eA, tt), eB), tt), eC));
+            _mm_storeu_pd(&elVel[i], _mm_add_pd(_mm_mul_pd(e2A, tt), eB));
+        }
+    }
+
+    extrap_tail (az, el, offset, dt, i, n, azPos, azVel, elPos, elVel);
+}
+
+EXTRAP_SPECIALIZE_ALL(sse2, __attribute__((target("sse2"))))
+
+__attribute__((target("avx2")))
+EXTRAP_INLINE void
+extrap_avx2 (const double *az, const double *el, double offset,
+             double dt, int n, double *azPos, double *azVel,
+             double *elPos, double *elVel)
+{
+    int     i;
+    __m256d off = _mm256_set1_pd(offset);
+    __m256d vdt = _mm256_set1_pd(dt);
+    __m256d two = _mm256_set1_pd(2.0);
+    __m256d aA  = _mm256_set1_pd(az[0]), aB = _mm256_set1_pd(az[1]), aC = _mm256_set1_pd(az[2]);
+    __m256d a2A = _mm256_mul_pd(two, aA);
+    __m256d eA, eB, eC, e2A;
+    __m256d idx = _mm256_set_pd(4.0, 3.0, 2.0, 1.0);
+    __m256d inc = _mm256_set1_pd(4.0);
+    __m256d tt;
+
+    if (el != NULL)
+    {
+        eA  = _mm256_set1_pd(el[0]);
+        eB  = _mm256_set1_pd(el[1]);
+        eC  = _mm256_set1_pd(el[2]);
+        e2A = _mm256_mul_pd(two, eA);
+    }
+
+    EXTRAP_UNROLL
+    for (i = 0; i + 4 <= n; i += 4, idx = _mm256_add_pd(idx, inc))
+    {
+        tt = _mm256_add_pd(off, _mm256_mul_pd(idx, vdt));
+        _mm256_storeu_pd(&azPos[i],
+            _mm256_add_pd(_mm256_mul_pd(_mm256_add_pd(_mm256_mul_pd(aA, tt), aB), tt), aC));
+        _mm256_storeu_pd(&azVel[i], _mm256_add_pd(_mm256_mul_pd(a2A, tt), aB));
+        if (el != NULL)
+        {
+            _mm256_storeu_pd(&elPos[i],
+                _mm256_add_pd(_mm256_mul_pd(_mm256_add_pd(_mm256_mul_pd(eA, tt), eB), tt), eC));
+            _mm256_storeu_pd(&elVel[i], _mm256_add_pd(_mm256_mul_pd(e2A, tt), eB));
+        }
+    }
+
+    extrap_tail (az, el, offset, dt, i, n, azPos, azVel, elPos, elVel);
+}
+
+EXTRAP_SPECIALIZE_ALL(avx2, __attribute__((target("avx2"))))
+
+#endif // EXTRAP_X86
+
+typedef struct {
+    extrap_kernel n10;
+    extrap_kernel n20;
+    extrap_kernel n40;
+    extrap_kernel generic;
+} extrap_kernel_set;
+
+#define EXTRAP_KERNEL_SET(LEVEL)					\
+    { extrap_kernel_ ## LEVEL ## _10, extrap_kernel_ ## LEVEL ## _20,	\
+      extrap_kernel_ ## LEVEL ## _40, extrap_kernel_ ## LEVEL ## _n }
+
+static const extrap_kernel_set kernel_sets[] = {
+    EXTRAP_KERNEL_SET(scalar),
+#ifdef EXTRAP_X86
+    EXTRAP_KERNEL_SET(sse2),
+    EXTRAP_KERNEL_SET(avx2),
+#endif
+};
+
+static const char *level_names[] = { "scalar", "sse2", "avx2" };
+
+/* The scalar kernels until extrapolate_set_level is called (the module
+ * init picks the best ones, before any thread can extrapolate). Read and
+ * written atomically, so that the level can change while others run
+ */
+static int current_level = EXTRAP_SCALAR;
+
+/* extrapolate_best_level - Highest kernel level the CPU supports (see
+ * simd_best_level)
+ */
+static int extrapolate_best_level (void)
+{
+    int simd = simd_best_level();
+
+    return (simd > SIMD_AVX2) ? EXTRAP_AVX2 : simd;
+}
+
+/* extrapolate_set_level - Select a kernel. Returns the level actually
+ * in use, which is lower than the one requested if the CPU lacks support
+ */
+int extrapolate_set_level (int level)
+{
+    int best = extrapolate_best_level();
+
+    if ((level < EXTRAP_SCALAR) || (level > best))
+        level = best;
+
+    __atomic_store_n (&current_level, level, __ATOMIC_RELAXED);
+
+    return level;
+}
+
+int extrapolate_level (void)
+{
+    return __atomic_load_n (&current_level, __ATOMIC_RELAXED);
+}
+
+const char *extrapolate_level_name (int level)
+{
+    if ((level < EXTRAP_SCALAR) || (level > EXTRAP_AVX2))
+        return "unknown";
+
+    return level_names[level];
+}
+
+void extrapolate_axes (const double *az, const double *el, double offset,
+                       double dt, int n, double *azPos, double *azVel,
+                       double *elPos, double *elVel)
+{
+    const extrap_kernel_set *current_set = &kernel_sets[extrapolate_level()];
+
+    switch (n)
+    {
+    case 10:
+        current_set->n10 (az, el, offset, dt, n, azPos, azVel, elPos, elVel);
+        break;
+    case 20:
+        current_set->n20 (az, el, offset, dt, n, azPos, azVel, elPos, elVel);
+        break;
+    case 40:
+        current_set->n40 (az, el, offset, dt, n, azPos, azVel, elPos, elVel);
+        break;
+    default:
+        current_set->generic (az, el, offset, dt, n, azPos, azVel, elPos, elVel);
+        break;
+    }
+}
@@ -0,0 +1,15 @@
+#ifndef __EXTRAP_H__
+#define __EXTRAP_H__
+
+/* Kernel levels, from slowest to fastest */
+#define EXTRAP_SCALAR	0
+#define EXTRAP_SSE2	1
+#define EXTRAP_AVX2	2
+
+void extrapolate_axes	(const double *, const double *, double, double, int,
+			 double *, double *, double *, double *);
+int extrapolate_level	(void);
+int extrapolate_set_level	(int);
+const char *extrapolate_level_name	(int);
+
+#endif // __EXTRAP_H__
@@ -1,88 +1,244 @@
 #include <stdio.h>
+#include <stddef.h>
 #include <string.h>
 #include <math.h>
 #include <time.h>
 
 #include "follow.h"
+#include "extrap.h"
+#include "hist.h"
 
-#define TIME_INT        0.005  /* 5 msec                             */
-#define TRIGGER_LATENCY 0.1    /* Seconds before Bancomm trigger     */
 #define JUMP            0.1    /* Degrees change considered a slew   */
-#define AZ_JUMP         0.1    /* Degrees change considered a slew   */
-#define EL_JUMP         0.1    /* Degrees change considered a slew   */
-#define	DOUBLE_BUFF	(NUM_EXTRAP>10)
+#define	DOUBLE_BUFF(p)	((p)->numExtrap>10)
 
 
 
-/* fillBuffer - Extrapolate demands
+/* mcs_init_parameters - Set the persistent parameters to their initial
+ * state, with the default extrapolation horizon and cycle period
  */
-long fillBuffer (double *AA,  double *BB,  double *CC, 
-                 double *pos, double *vel, double offset, 
-                 long axis,   double *lastPMACDemand, double jump,
-                 double maxVel, double maxAcc, double currentPos,
-                 double currentVel, long trajectoryMode, int recent,
-		 mcs_parameters *internal_params)
+void mcs_init_parameters (mcs_parameters *internal_params)
+{
+    memset (internal_params, 0, sizeof(*internal_params));
+    internal_params->firstAzFit = 1;
+    internal_params->firstElFit = 1;
+    internal_params->numExtrap  = NUM_EXTRAP;
+    internal_params->timeInt    = TIME_INT;
+}
+
+
+/* log_event - Record an event in the ring of the instance, overwriting
+ * the oldest one if it is full. A few stores, no locks or syscalls.
+ */
+static void log_event (mcs_parameters *internal_params, int code, int axis,
+                       double time, double value0, double value1)
+{
+    mcs_event_ring *ring = &internal_params->events;
+    unsigned long   head = ring->head;
+    unsigned long   slot = head & (MCS_EVENT_RING - 1);
+
+    __atomic_store_n (&ring->slots[slot].seq, 2 * head + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+
+    ring->slots[slot].event.seq       = head;
+    ring->slots[slot].event.code      = code;
+    ring->slots[slot].event.axis      = axis;
+    ring->slots[slot].event.time      = time;
+    ring->slots[slot].event.values[0] = value0;
+    ring->slots[slot].event.values[1] = value1;
+
+    __atomic_store_n (&ring->slots[slot].seq, 2 * head + 2, __ATOMIC_RELEASE);
+    __atomic_store_n (&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+**  - - - - - - - - - - - - - - - - -
+**   m c s _ d r a i n _ e v e n t s
+**  - - - - - - - - - - - - - - - - -
+**
+**  Move up to max of the pending events, oldest first, out of the ring.
+**
+**  Returned:
+**    events    mcs_event*   the events
+**
+**  Status:
+**            int       number of events returned
+**
+**  Notes:
+**
+**  1)  Can run concurrently with the thread running the follow code on
+**      the same parameters, but only one thread may drain them.
+**
+**  2)  Events overwritten before being drained (including those being
+**      overwritten while they are read) are added to events.lost.
+*/
+int mcs_drain_events (mcs_parameters *internal_params, mcs_event *events,
+                      int max)
+{
+    mcs_event_ring *ring = &internal_params->events;
+    unsigned long   head = __atomic_load_n (&ring->head, __ATOMIC_ACQUIRE);
+    unsigned long   seq, slot;
+    int             n = 0;
+
+    if (head - ring->tail > MCS_EVENT_RING)
+    {
+        ring->lost += head - ring->tail - MCS_EVENT_RING;
+        ring->tail  = head - MCS_EVENT_RING;
+    }
+
+    for (; (ring->tail != head) && (n < max); ring->tail++)
+    {
+        slot = ring->tail & (MCS_EVENT_RING - 1);
+        seq  = __atomic_load_n (&ring->slots[slot].seq, __ATOMIC_ACQUIRE);
+        events[n] = ring->slots[slot].event;
+        __atomic_thread_fence (__ATOMIC_ACQUIRE);
+
+        if ((seq != 2 * ring->tail + 2) ||
+            (__atomic_load_n (&ring->slots[slot].seq, __ATOMIC_RELAXED) != seq))
+            ring->lost++;
+        else
+            n++;
+    }
+
+    return n;
+}
+
+
+/*
+**  - - - - - - - - - - - - -
+**   m c s _ s n a p s h o t
+**  - - - - - - - - - - - - -
+**
+**  Copy the follow state of an instance to a buffer, for mcs_restore.
+**
+**  Given:
+**    internal_params   mcs_parameters*   the instance
+**
+**  Returned:
+**    buf               unsigned char[]   mcs_snapshot_size() bytes
+**
+**  Notes:
+**
+**  1)  A snapshot is a header (mcs_snapshot_header) followed by the
+**      fields of mcs_parameters up to the events, as they are in memory:
+**      the coefficients and their origins, the last demands and
+**      velocities, the first fit flags, the settings, the fit windows
+**      and the counters. It can only be restored by a build with the
+**      same layout, which the header records.
+**
+**  2)  The events are left out, being diagnostics to be drained as they
+**      happen rather than state.
+*/
+size_t mcs_snapshot_size (void)
 {
-    int    i, imax;
+    return sizeof (mcs_snapshot_header) + offsetof (mcs_parameters, events);
+}
+
+void mcs_snapshot (const mcs_parameters *internal_params, unsigned char *buf)
+{
+    mcs_snapshot_header h;
+
+    h.magic    = MCS_SNAPSHOT_MAGIC;
+    h.version  = MCS_SNAPSHOT_VERSION;
+    h.size     = offsetof (mcs_parameters, events);
+    h.reserved = 0;
+
+    memcpy (buf, &h, sizeof (h));
+    memcpy (buf + sizeof (h), internal_params, h.size);
+}
+
+/* mcs_restore - Set the follow state of an instance from a snapshot
+ * (mcs_snapshot) of len bytes. Its events are dropped. Returns 0, or -1
+ * if buf is not a snapshot of this layout, or holds settings out of
+ * range, in which case the instance is left alone
+ */
+int mcs_restore (mcs_parameters *internal_params, const unsigned char *buf,
+                 size_t len)
+{
+    mcs_snapshot_header h;
+    mcs_parameters      state;
+
+    if (len != mcs_snapshot_size ())
+        return (-1);
+
+    memcpy (&h, buf, sizeof (h));
+    if ((h.magic != MCS_SNAPSHOT_MAGIC) || (h.version != MCS_SNAPSHOT_VERSION) ||
+        (h.size != offsetof (mcs_parameters, events)))
+        return (-1);
+
+    memset (&state, 0, sizeof (state));
+    memcpy (&state, buf + sizeof (h), h.size);
+    if ((state.numExtrap < 1) || (state.numExtrap > MAX_EXTRAP) ||
+        !(state.timeInt > 0.0) || (state.nextDemand < 0) || (state.nextDemand > 2))
+        return (-1);
+
+    *internal_params = state;
+
+    return (0);
+}
+
+
+/* fit_axis - Fit a parabola to the three demands of an axis, falling
+ * back to the previous coefficients if the fit fails. The coefficients
+ * are saved for the next call and returned as (A, B, C).
+ *
+ * With a window (holding the times of AA, BB and CC, in that order) the
+ * fit is made in its frame by mcs_window_fit, otherwise on the absolute
+ * times by calc_quadratic. The time origin of the coefficients is saved
+ * with them (azOrigin, elOrigin).
+ */
+static void fit_axis (double *AA, double *BB, double *CC, long axis,
+                      double jump, const mcs_window *window,
+                      double *coeffs, mcs_parameters *internal_params)
+{
+    unsigned long long t0 = MCS_HIST_START();
     long   error;
-    /*long   adjustment = 0; */
-    double lastPos = 0, lastVel = 0, acceleration = 0;
     double A;
     double B;
     double C;
-    double posA = 0;
-    double posB = 0;
-    double posC = 0;
-    double timeA = 0;
-    double timeB = 0;
-    double timeC = 0;
-    double tt;
+    double origin;
+    double pos[3], c[3];
 
+    internal_params->counters[(axis == 1) ? MCS_AZ : MCS_EL].fits++;
 
-    /* If the times in the three demands coming from the TCS are all zero
-     * then the TCS has not connected yet.
+    /* Fit a parabolla line to the last two demands.
      */
-    if ((AA[0] == 0.0) && (BB[0] == 0.0) && (CC[0] == 0.0))
+    if (window != NULL)
     {
-	printf ("TCS has not connected!\n");
-	return (1);
+        pos[0] = AA[1]; pos[1] = BB[1]; pos[2] = CC[1];
+        error  = mcs_window_fit (window, pos, c);
+        C = c[0]; B = c[1]; A = c[2];
+        origin = window->origin;
+    }
+    else
+    {
+        error = calc_quadratic(jump, AA[0], AA[1], BB[0], BB[1], 
+                               CC[0], CC[1], &C, &B, &A);
+        origin = 0.0;
     }
-
-    /* Fit a parabolla line to the last two demands.
-     */
-    error = calc_quadratic(jump, AA[0], AA[1], BB[0], BB[1], 
-	                   CC[0], CC[1], &C, &B, &A);
 
     /* Use the previous coefficients if the fit fails.
      */
     if (error)
     {
-	printf ("Time's Equal!!\n");
+	internal_params->counters[(axis == 1) ? MCS_AZ : MCS_EL].fitFailures++;
+	log_event (internal_params, MCS_EV_FIT_FAILED,
+	           (axis == 1) ? MCS_AZ : MCS_EL, CC[0], AA[0], BB[0]);
 	if (axis == 1)
 	{
 	    A = internal_params->azA;
 	    B = internal_params->azB;
 	    C = internal_params->azC;
+	    origin = internal_params->azOrigin;
 	}
 	else
 	{
 	    A = internal_params->elA;
 	    B = internal_params->elB;
 	    C = internal_params->elC;
+	    origin = internal_params->elOrigin;
 	}
     }
 
-    /* Extrapolate data. Data points are extrapolated from the starting
-     * time offset + TIME_INT (0.005) to time offset + NUM_EXTRAP * TIME_INT.
-     */
-    imax = NUM_EXTRAP + 1;
-    for (i=1; i<imax; i++)
-    {
-        tt       = offset + i*TIME_INT;
-	pos[i-1] = (A*tt + B)*tt + C;
-	vel[i-1] = 2.0*A*tt + B;
-    }
-
     /* Save coefficients for next call in case the fit fails.
      */
     if (axis == 1)
@@ -90,26 +246,279 @@ long fillBuffer (double *AA,  double *BB,  double *CC,
 	internal_params->azA = A;
 	internal_params->azB = B;
 	internal_params->azC = C;
+	internal_params->azOrigin = origin;
     }
     else
     {
 	internal_params->elA = A;
 	internal_params->elB = B;
 	internal_params->elC = C;
+	internal_params->elOrigin = origin;
+    }
+
+    coeffs[0] = A;
+    coeffs[1] = B;
+    coeffs[2] = C;
+
+    MCS_HIST_STOP(MCS_HIST_FIT, t0);
+}
+
+
+/* fillBuffer - Extrapolate demands
+ */
+long fillBuffer (double *AA,  double *BB,  double *CC, 
+                 double *pos, double *vel, double offset, 
+                 long axis,   double *lastPMACDemand, double jump,
+                 double maxVel, double maxAcc, double currentPos,
+                 double currentVel, long trajectoryMode, int recent,
+		 mcs_parameters *internal_params)
+{
+    double coeffs[3];
+    double times[3];
+    int    n = internal_params->numExtrap;
+    mcs_window *window = NULL;
+    unsigned long long t0;
+
+
+    /* If the times in the three demands coming from the TCS are all zero
+     * then the TCS has not connected yet.
+     */
+    if ((AA[0] == 0.0) && (BB[0] == 0.0) && (CC[0] == 0.0))
+    {
+	log_event (internal_params, MCS_EV_NOT_CONNECTED,
+	           (axis == 1) ? MCS_AZ : MCS_EL, 0.0, offset, 0.0);
+	return (1);
     }
 
+    if (internal_params->localFit)
+    {
+        times[0] = AA[0]; times[1] = BB[0]; times[2] = CC[0];
+        window = &internal_params->window[(axis == 1) ? MCS_AZ : MCS_EL];
+        mcs_window_update (window, times);
+    }
+
+    fit_axis (AA, BB, CC, axis, jump, window, coeffs, internal_params);
+
+    /* Extrapolate data. Data points are extrapolated from the starting
+     * time offset + timeInt (0.005) to time offset + numExtrap * timeInt.
+     */
+    t0 = MCS_HIST_START();
+    extrapolate_axes (coeffs, NULL,
+                      offset - ((axis == 1) ? internal_params->azOrigin
+                                            : internal_params->elOrigin),
+                      internal_params->timeInt, n, pos, vel, NULL, NULL);
+    MCS_HIST_STOP(MCS_HIST_EXTRAP, t0);
+
     /* Put the last PMAC position demand in a separate parameter.
      */
-    *lastPMACDemand = pos[NUM_EXTRAP-1];
+    *lastPMACDemand = pos[n-1];
     if (axis == 1)
-	internal_params->lastAzVelocity = vel[NUM_EXTRAP-1];
+	internal_params->lastAzVelocity = vel[n-1];
     else
-        internal_params->lastElVelocity = vel[NUM_EXTRAP-1];
+        internal_params->lastElVelocity = vel[n-1];
+
+    return (0);
+}
+
+
+/* limit_cycle - Limiter stage of a control cycle for both axes
+ *
+ * The new demand replaces the oldest of the three kept in internal_params,
+ * and its positions go through the velocity/acceleration limiters
+ * (fit_new_AZ_demand, fit_new_EL_demand). azp and elp get the three
+ * demands of each axis, limited.
+ *
+ * The -1 that the limiters return when the two latest times are equal is
+ * ignored, as the TCS code does: that axis keeps its new demand as it
+ * came, unlimited, and prevXXDemand is not updated (its slot keeps the
+ * demand of three cycles ago, now paired with the new time). The fit of
+ * such a cycle fails too (MCS_EV_FIT_FAILED), so the previous
+ * coefficients are used.
+ *
+ * Returns the slot of the new demand, or -1 if the TCS has not connected
+ * (all demand times are zero).
+ */
+static int limit_cycle (double applyTime, double azDemand, double elDemand,
+                        double offset, const mcs_axis_inputs *az,
+                        const mcs_axis_inputs *el, int recent,
+                        double *azp, double *elp,
+                        mcs_parameters *internal_params)
+{
+    double *t = internal_params->demandTime;
+    int    slot = internal_params->nextDemand;
+    int    i;
+    unsigned long long t0;
+
+    t[slot] = applyTime;
+    for (i = 0; i < 3; i++)
+    {
+        azp[i] = internal_params->prevAzDemand[i];
+        elp[i] = internal_params->prevElDemand[i];
+    }
+    azp[slot] = azDemand;
+    elp[slot] = elDemand;
+    internal_params->nextDemand = (slot + 1) % 3;
+
+    if ((t[0] == 0.0) && (t[1] == 0.0) && (t[2] == 0.0))
+    {
+	log_event (internal_params, MCS_EV_NOT_CONNECTED, -1, 0.0, offset, 0.0);
+	return (-1);
+    }
+
+    /* Limit the new demands. They are replaced in place.
+     */
+    t0 = MCS_HIST_START();
+    fit_new_AZ_demand (t[0], &azp[0], t[1], &azp[1], t[2], &azp[2],
+                       az->maxVel, az->maxAcc, az->currentPos, 0, recent,
+                       internal_params);
+    fit_new_EL_demand (t[0], &elp[0], t[1], &elp[1], t[2], &elp[2],
+                       el->maxVel, el->maxAcc, el->currentPos, 0, recent,
+                       internal_params);
+    MCS_HIST_STOP(MCS_HIST_LIMIT, t0);
+
+    return (slot);
+}
+
+
+/* mcs_step - One complete control cycle for both axes
+ *
+ * The new demand replaces the oldest of the three kept in internal_params.
+ * Its positions go through the velocity/acceleration limiters
+ * (fit_new_AZ_demand, fit_new_EL_demand), then the three demands are
+ * fitted and extrapolated for both axes in a single pass. See limit_cycle
+ * for what happens when the two latest demand times are equal.
+ *
+ * Returns 1 if the TCS has not connected (all demand times are zero),
+ * 0 otherwise.
+ */
+long mcs_step (double applyTime, double azDemand, double elDemand,
+               double offset, const mcs_axis_inputs *az,
+               const mcs_axis_inputs *el, int recent,
+               double *azPos, double *azVel, double *elPos, double *elVel,
+               mcs_parameters *internal_params)
+{
+    double *t = internal_params->demandTime;
+    double azp[3], elp[3];
+    double AA[2], BB[2], CC[2];
+    double azCoeffs[3], elCoeffs[3];
+    mcs_window *window = NULL;
+    unsigned long long t0;
+
+    if (limit_cycle (applyTime, azDemand, elDemand, offset, az, el, recent,
+                     azp, elp, internal_params) < 0)
+	return (1);
+
+    /* Both axes share the demand times, and so the window */
+    if (internal_params->localFit)
+    {
+        window = &internal_params->window[MCS_AZ];
+        mcs_window_update (window, t);
+    }
+
+    AA[0] = t[0]; BB[0] = t[1]; CC[0] = t[2];
+
+    AA[1] = azp[0]; BB[1] = azp[1]; CC[1] = azp[2];
+    fit_axis (AA, BB, CC, 1, az->jump, window, azCoeffs, internal_params);
+
+    AA[1] = elp[0]; BB[1] = elp[1]; CC[1] = elp[2];
+    fit_axis (AA, BB, CC, 2, el->jump, window, elCoeffs, internal_params);
+
+    t0 = MCS_HIST_START();
+    mcs_extrapolate (offset, azPos, azVel, elPos, elVel, internal_params);
+    MCS_HIST_STOP(MCS_HIST_EXTRAP, t0);
+
+    internal_params->lastAzVelocity = azVel[internal_params->numExtrap-1];
+    internal_params->lastElVelocity = elVel[internal_params->numExtrap-1];
 
     return (0);
 }
 
 
+/* mcs_extrapolate - Extrapolate both axes from the coefficients kept in
+ * internal_params, from offset + timeInt on, each in the frame of its own
+ * time origin (azOrigin, elOrigin)
+ */
+void mcs_extrapolate (double offset, double *azPos, double *azVel,
+                      double *elPos, double *elVel,
+                      mcs_parameters *internal_params)
+{
+    double az[3], el[3];
+
+    az[0] = internal_params->azA;
+    az[1] = internal_params->azB;
+    az[2] = internal_params->azC;
+    el[0] = internal_params->elA;
+    el[1] = internal_params->elB;
+    el[2] = internal_params->elC;
+
+    if (internal_params->azOrigin == internal_params->elOrigin)
+    {
+        extrapolate_axes (az, el, offset - internal_params->azOrigin,
+                          internal_params->timeInt, internal_params->numExtrap,
+                          azPos, azVel, elPos, elVel);
+    }
+    else
+    {
+        /* Only after a failed fit on one axis */
+        extrapolate_axes (az, NULL, offset - internal_params->azOrigin,
+                          internal_params->timeInt, internal_params->numExtrap,
+                          azPos, azVel, NULL, NULL);
+        extrapolate_axes (el, NULL, offset - internal_params->elOrigin,
+                          internal_params->timeInt, internal_params->numExtrap,
+                          elPos, elVel, NULL, NULL);
+    }
+}
+
+
+/* mcs_limit_series - Limiter stage of mcs_step over a series of demands
+ *
+ * demands holds n (applyTime, azDemand, elDemand) triples, that go
+ * through the limiters one after the other, exactly as n calls to
+ * mcs_step would do, without the fit and the extrapolation. az and el
+ * give the current positions and the limits for each cycle (n elements
+ * each). For each cycle, the limited demand and the velocity it implies
+ * (prevXXVel) are written to azPos, azVel, elPos and elVel.
+ *
+ * Returns the number of cycles done: n, or the index of the first one
+ * where the TCS has not connected (the scan stops there).
+ */
+long mcs_limit_series (const double *demands, long n,
+                       const mcs_axis_series *az, const mcs_axis_series *el,
+                       int recent, double *azPos, double *azVel,
+                       double *elPos, double *elVel,
+                       mcs_parameters *internal_params)
+{
+    mcs_axis_inputs azIn = { .jump = AZ_JUMP };
+    mcs_axis_inputs elIn = { .jump = EL_JUMP };
+    double azp[3], elp[3];
+    const double *dem;
+    long   i;
+    int    slot;
+
+    for (i = 0, dem = demands; i < n; i++, dem += 3)
+    {
+        azIn.currentPos = az->currentPos[i];
+        azIn.maxVel     = az->maxVel[i];
+        azIn.maxAcc     = az->maxAcc[i];
+        elIn.currentPos = el->currentPos[i];
+        elIn.maxVel     = el->maxVel[i];
+        elIn.maxAcc     = el->maxAcc[i];
+
+        slot = limit_cycle (dem[0], dem[1], dem[2], 0.0, &azIn, &elIn, recent,
+                            azp, elp, internal_params);
+        if (slot < 0)
+            break;
+
+        azPos[i] = azp[slot];
+        azVel[i] = internal_params->prevAzVel;
+        elPos[i] = elp[slot];
+        elVel[i] = internal_params->prevElVel;
+    }
+
+    return (i);
+}
+
+
 /* calc_coeffs - Not used anymore.
  */
 long calc_coeffs (double *aa, double *bb, double *cc, double *A,
@@ -330,6 +739,136 @@ int calc_quadratic( double dpmax,
 }
 
 
+void mcs_window_update (mcs_window *w, const double *time)
+/*
+**  - - - - - - - - - - - - - - - - -
+**   m c s _ w i n d o w _ u p d a t e
+**  - - - - - - - - - - - - - - - - -
+**
+**  Bring a window of three demand times up to date for mcs_window_fit.
+**
+**  Given:
+**    w         mcs_window*  window (zeroed before the first call)
+**    time      double[3]    current demand times, in the callers' slots
+**
+**  Returned:
+**    w                      up to date
+**
+**  Notes:
+**
+**  1)  When a single time has changed since the last call (the usual
+**      sliding window, one demand in and one out) it becomes the time
+**      origin, and the difference of the other two is kept as it was;
+**      only the two differences involving the new time are worked out.
+**      Otherwise the window starts afresh, from the latest of the times.
+**
+**  2)  The times are only ever subtracted from each other, which is
+**      exact for times close together, so nothing is lost beyond their
+**      own resolution, even on epoch seconds (see calc_quadratic note 4).
+**
+**  3)  Nothing is done if the times haven't changed, so both axes and
+**      repeated calls with the same demands share the work.
+*/
+{
+    static const int pair[3][2] = { { 0, 1 }, { 1, 2 }, { 0, 2 } };
+    double u[3], r;
+    int    i, k, changed = 0, slot = 0, fresh;
+
+    if (w->valid)
+        for (i = 0; i < 3; i++)
+            if (time[i] != w->time[i])
+            {
+                changed++;
+                slot = i;
+            }
+    if (w->valid && (changed == 0))
+        return;
+
+    fresh = !w->valid || (changed > 1);
+    if (fresh)
+    {
+        for (i = 0; i < 3; i++)
+            if (time[i] > time[slot])
+                slot = i;
+    }
+
+    /* Rebase on the time that entered the window last, which is not the
+     * latest one if the times come out of order (on a fresh window, the
+     * latest of the three). */
+    for (i = 0; i < 3; i++)
+        w->time[i] = time[i];
+    w->origin = time[slot];
+    for (i = 0; i < 3; i++)
+        u[i] = (i == slot) ? 0.0 : time[i] - w->origin;
+
+    for (k = 0; k < 3; k++)
+        if (fresh || (pair[k][0] == slot) || (pair[k][1] == slot))
+            w->diff[k] = u[pair[k][0]] - u[pair[k][1]];
+    w->valid = 1;
+
+    /* Lagrange weights, as in calc_quadratic with ab, bc, ac. */
+    r = w->diff[0] * w->diff[1] * w->diff[2];
+    if ((w->singular = (r == 0.0)))
+        return;
+    r = 1.0 / r;
+
+    w->weight[2][0] =  w->diff[1] * r;
+    w->weight[2][1] = -w->diff[2] * r;
+    w->weight[2][2] =  w->diff[0] * r;
+
+    w->weight[1][0] = -w->diff[1] * (u[1] + u[2]) * r;
+    w->weight[1][1] =  w->diff[2] * (u[0] + u[2]) * r;
+    w->weight[1][2] = -w->diff[0] * (u[0] + u[1]) * r;
+
+    /* At the origin, the parabola goes through the newest position. */
+    for (i = 0; i < 3; i++)
+        w->weight[0][i] = (i == slot) ? 1.0 : 0.0;
+}
+
+
+int mcs_window_fit (const mcs_window *w, const double *pos, double *c)
+/*
+**  - - - - - - - - - - - - - - -
+**   m c s _ w i n d o w _ f i t
+**  - - - - - - - - - - - - - - -
+**
+**  Fit a parabola to three positions, at the times of a window.
+**
+**  Given:
+**    w         mcs_window*  times of the demands (mcs_window_update)
+**    pos       double[3]    positions, in the same slots as the times
+**
+**  Returned:
+**    c         double[3]    polynomial coefficients for 1, t, t^2
+**
+**  Status:
+**            int       0 = OK
+**                     -1 = singular case (two or more equal times)
+**
+**  Notes:
+**
+**  1)  The polynomial predicts position, p, for the time t after the
+**      origin of the window:
+**
+**          p = c0 + c1*(t-origin) + c2*(t-origin)^2
+**
+**  2)  The same parabola as calc_quadratic, to rounding, but worked out
+**      from times close to zero, with 9 multiplications and no division.
+*/
+{
+    int k;
+
+    if (!w->valid || w->singular)
+        return -1;
+
+    for (k = 0; k < 3; k++)
+        c[k] = w->weight[k][0] * pos[0] + w->weight[k][1] * pos[1]
+             + w->weight[k][2] * pos[2];
+
+    return 0;
+}
+
+
 int fit_new_AZ_demand( double timeA, double *posA,
                        double timeB, double *posB,
                        double timeC, double *posC,
@@ -360,6 +899,10 @@ int fit_new_AZ_demand( double timeA, double *posA,
    double jump;
    int    flag  = 0;
    int    index = 0;
+   int    velLimited = 0;
+   mcs_axis_counters *count = &internal_params->counters[MCS_AZ];
+
+   count->demands++;
 
    pospa = *posA; 
    pospb = *posB; 
@@ -377,7 +920,8 @@ int fit_new_AZ_demand( double timeA, double *posA,
        internal_params->prevAzDemand[2] = pc = currentPos;
        internal_params->prevAzVel       = 0.0;
        internal_params->firstAzFit = 0;
-       printf("firstAzFit = 0\n");
+       log_event (internal_params, MCS_EV_FIRST_FIT, MCS_AZ, timeC,
+                  currentPos, 0.0);
    } else {
        pa = internal_params->prevAzDemand[0];
        pb = internal_params->prevAzDemand[1];
@@ -426,7 +970,10 @@ int fit_new_AZ_demand( double timeA, double *posA,
    jump = fabs(pc - pb);
  
    if ( jump >= 0.1)
+   {
       maxAcc = 2.0 * maxAcc;
+      count->slews++;
+   }
 
    /*newpos    = pc; */
    targetPos = pc;
@@ -443,6 +990,7 @@ int fit_new_AZ_demand( double timeA, double *posA,
    {
       vel = sign( maxVel, vel);
       flag = 1;
+      velLimited = 1;
    }
 
    accel = (vel - internal_params->prevAzVel)/d;
@@ -453,6 +1001,7 @@ int fit_new_AZ_demand( double timeA, double *posA,
        accel = sign( maxAcc, accel);
        vel   = internal_params->prevAzVel + (double)d * accel; 
        flag = 1;
+       count->accLimited++;
    }
 
 /* Apply Velocity Limit (yes again!!!)*/
@@ -461,6 +1010,7 @@ int fit_new_AZ_demand( double timeA, double *posA,
       vel = sign( maxVel, vel);
       accel = (vel - internal_params->prevAzVel)/(double)d;
       flag = 1;
+      velLimited = 1;
    }
 
 /* override the velocity demand if close to final position */
@@ -478,6 +1028,7 @@ int fit_new_AZ_demand( double timeA, double *posA,
       if ( (vel > velPos) ) 
       {
           vel = velPos; 
+          count->nearTarget++;
           accel = (vel - internal_params->prevAzVel)/(double)d; 
           flag  = 1; 
       } 
@@ -496,11 +1047,14 @@ int fit_new_AZ_demand( double timeA, double *posA,
       if ( (vel < velPos) ) 
       {
           vel = velPos; 
+          count->nearTarget++;
           accel = (vel - internal_params->prevAzVel)/(double)d;
           flag = 1; 
       } 
    } 
 
+   count->velLimited += velLimited;
+
 /* Adjust new position */
  
    if (flag)
@@ -531,7 +1085,8 @@ int fit_new_AZ_demand( double timeA, double *posA,
           *posC = pc = newpos;
           break;
       default:
-	  printf ("Incorrect value of index - %i", index);
+	  log_event (internal_params, MCS_EV_BAD_INDEX, MCS_AZ, timeC,
+	             index, 0.0);
 	  break;
       }
 
@@ -575,6 +1130,10 @@ int fit_new_EL_demand( double timeA, double *posA,
    double jump;
    int    flag  = 0;
    int    index = 0;
+   int    velLimited = 0;
+   mcs_axis_counters *count = &internal_params->counters[MCS_EL];
+
+   count->demands++;
 
    pospa = *posA; 
    pospb = *posB; 
@@ -592,7 +1151,8 @@ int fit_new_EL_demand( double timeA, double *posA,
        internal_params->prevElDemand[2] = pc = currentPos;
        internal_params->prevElVel       = 0.0;
        internal_params->firstElFit = 0;
-       printf("firstElFit = 0\n");
+       log_event (internal_params, MCS_EV_FIRST_FIT, MCS_EL, timeC,
+                  currentPos, 0.0);
    } else {
        pa = internal_params->prevElDemand[0];
        pb = internal_params->prevElDemand[1];
@@ -641,7 +1201,10 @@ int fit_new_EL_demand( double timeA, double *posA,
    jump = fabs(pc - pb);
  
    if ( jump >= 0.1)
+   {
       maxAcc = 2.0 * maxAcc;
+      count->slews++;
+   }
 
    /*newpos    = pc; */
    targetPos = pc;
@@ -658,6 +1221,7 @@ int fit_new_EL_demand( double timeA, double *posA,
    {
       vel = sign( maxVel, vel);
       flag = 1;
+      velLimited = 1;
    }
 
    accel = (vel - internal_params->prevElVel)/d;
@@ -668,6 +1232,7 @@ int fit_new_EL_demand( double timeA, double *posA,
        accel = sign( maxAcc, accel);
        vel   = internal_params->prevElVel + (double)d * accel; 
        flag = 1;
+       count->accLimited++;
    }
 
 /* Apply Velocity Limit (yes again!!!)*/
@@ -676,6 +1241,7 @@ int fit_new_EL_demand( double timeA, double *posA,
       vel = sign( maxVel, vel);
       accel = (vel - internal_params->prevElVel)/(double)d;
       flag = 1;
+      velLimited = 1;
    }
 
 /* override the velocity demand if close to final position */
@@ -693,6 +1259,7 @@ int fit_new_EL_demand( double timeA, double *posA,
       if ( (vel > velPos) ) 
       {
           vel = velPos; 
+          count->nearTarget++;
           accel = (vel - internal_params->prevElVel)/(double)d; 
           flag  = 1; 
       } 
@@ -711,11 +1278,14 @@ int fit_new_EL_demand( double timeA, double *posA,
       if ( (vel < velPos) ) 
       {
           vel = velPos; 
+          count->nearTarget++;
           accel = (vel - internal_params->prevElVel)/(double)d;
           flag = 1; 
       } 
    } 
 
+   count->velLimited += velLimited;
+
 /* Adjust new position */
  
    if (flag)
@@ -746,7 +1316,8 @@ int fit_new_EL_demand( double timeA, double *posA,
           *posC = pc = newpos;
           break;
       default:
-	  printf ("Incorrect value of index - %i", index);
+	  log_event (internal_params, MCS_EV_BAD_INDEX, MCS_EL, timeC,
+	             index, 0.0);
 	  break;
       }
 
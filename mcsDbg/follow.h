@@ -1,7 +1,80 @@
 #ifndef __FOLLOW_H__
 #define __FOLLOW_H__
 
-#define NUM_EXTRAP	20	/* number of points to extrapolate    */
+#include <stddef.h>
+
+#define NUM_EXTRAP	20	/* default number of points to extrapolate */
+#define TIME_INT	0.005	/* default cycle period, 5 msec       */
+#define TRIGGER_LATENCY	0.1	/* Seconds before Bancomm trigger     */
+#define MAX_EXTRAP	256	/* upper limit for numExtrap          */
+#define AZ_JUMP		0.1	/* Degrees change considered a slew   */
+#define EL_JUMP		0.1	/* Degrees change considered a slew   */
+
+#define MCS_AZ		0	/* index of each axis in counters[]   */
+#define MCS_EL		1
+
+/* Per-axis counters of the branches taken by the follow code. They are
+ * plain increments, cheap enough to be always on */
+typedef struct {
+	unsigned long fits;		/* parabola fits (fit_axis)            */
+	unsigned long fitFailures;	/* fits failed, previous coeffs used   */
+	unsigned long demands;		/* demands through fit_new_XX_demand   */
+	unsigned long slews;		/* jumps >= 0.1, maxAcc doubled        */
+	unsigned long velLimited;	/* demands clamped to maxVel           */
+	unsigned long accLimited;	/* demands clamped to maxAcc           */
+	unsigned long nearTarget;	/* velocity overridden near the target */
+} mcs_axis_counters;
+
+#define MCS_EVENT_RING	64	/* events kept per instance (power of 2) */
+
+/* Event codes. The values recorded with each of them are:
+ *   MCS_EV_NOT_CONNECTED  offset             -
+ *   MCS_EV_FIT_FAILED     time of demand A   time of demand B
+ *   MCS_EV_FIRST_FIT      currentPos         -
+ *   MCS_EV_BAD_INDEX      index              -
+ */
+enum {
+	MCS_EV_NOT_CONNECTED = 1,	/* all the demand times are zero       */
+	MCS_EV_FIT_FAILED,		/* equal times, previous coeffs used   */
+	MCS_EV_FIRST_FIT,		/* limiter initialized from currentPos */
+	MCS_EV_BAD_INDEX		/* no demand is the most recent one    */
+};
+
+typedef struct {
+	unsigned long seq;	/* number of the event in this instance */
+	int    code;		/* MCS_EV_*                              */
+	int    axis;		/* MCS_AZ, MCS_EL or -1 for both         */
+	double time;		/* time of the (latest) demand involved  */
+	double values[2];
+} mcs_event;
+
+/* Events recorded by the follow code, kept in a ring that overwrites the
+ * oldest ones. Lock-free for one producer (the thread running the follow
+ * code) and one consumer (mcs_drain_events): every slot carries a
+ * sequence number, odd while it is being written */
+typedef struct {
+	unsigned long head;	/* events recorded so far (producer)    */
+	unsigned long tail;	/* events consumed so far (consumer)    */
+	unsigned long lost;	/* overwritten before being drained     */
+	struct {
+		unsigned long seq;
+		mcs_event     event;
+	} slots[MCS_EVENT_RING];
+} mcs_event_ring;
+
+/* Three demand times, kept for the local fit (mcs_window_update,
+ * mcs_window_fit). The times are reckoned from the one that entered the
+ * window last, and the weights giving the polynomial coefficients from
+ * the positions only change when a time does, so they are shared by both
+ * axes and by the cycles that don't bring a new time */
+typedef struct {
+	double time[3];		/* absolute times, in the callers' slots       */
+	double origin;		/* time of the last one to enter the window    */
+	double diff[3];		/* time[0]-time[1], time[1]-time[2], time[0]-time[2] */
+	double weight[3][3];	/* c[k] = sum over i of weight[k][i] * pos[i]  */
+	int    singular;	/* two or more equal times                     */
+	int    valid;		/* time[] holds a window                       */
+} mcs_window;
 
 typedef struct {
 	int    firstAzFit;
@@ -18,11 +91,66 @@ typedef struct {
 	double prevAzDemand[3];
 	double prevElVel;
 	double prevElDemand[3];
+	double demandTime[3];	/* apply times of the demands, for mcs_step */
+	int    nextDemand;	/* slot in demandTime replaced by next step */
+	int    numExtrap;	/* points to extrapolate (NUM_EXTRAP) */
+	double timeInt;		/* cycle period, in seconds (TIME_INT) */
+	int    localFit;	/* fit in the window's frame (mcs_window) */
+	double azOrigin;	/* time origin of azA..azC (0 = absolute) */
+	double elOrigin;	/* time origin of elA..elC (0 = absolute) */
+	mcs_window window[2];	/* local fit windows, MCS_AZ, MCS_EL. mcs_step
+				 * uses the first one for both axes */
+	mcs_axis_counters counters[2];	/* MCS_AZ, MCS_EL */
+	mcs_event_ring events;
 } mcs_parameters;
 
+#define MCS_SNAPSHOT_MAGIC	0x5053434dU	/* "MCSP" */
+#define MCS_SNAPSHOT_VERSION	1
+
+/* Start of a snapshot of mcs_parameters (mcs_snapshot) */
+typedef struct {
+	unsigned int magic;	/* MCS_SNAPSHOT_MAGIC                    */
+	unsigned int version;	/* MCS_SNAPSHOT_VERSION                  */
+	unsigned int size;	/* bytes of state after the header       */
+	unsigned int reserved;
+} mcs_snapshot_header;
+
+/* Per-axis inputs for one control cycle (mcs_step) */
+typedef struct {
+	double currentPos;
+	double currentVel;
+	double maxVel;
+	double maxAcc;
+	double jump;
+} mcs_axis_inputs;
+
+/* Per-axis inputs for a series of cycles (mcs_limit_series), one element
+ * per cycle */
+typedef struct {
+	const double *currentPos;
+	const double *maxVel;
+	const double *maxAcc;
+} mcs_axis_series;
+
+void mcs_init_parameters	(mcs_parameters *);
+int  mcs_drain_events	(mcs_parameters *, mcs_event *, int);
+size_t mcs_snapshot_size	(void);
+void mcs_snapshot	(const mcs_parameters *, unsigned char *);
+int  mcs_restore	(mcs_parameters *, const unsigned char *, size_t);
 long fillBuffer		(double *, double *, double *, double *, double *,
 			 double, long, double *, double, double, double,
 			 double, double, long, int, mcs_parameters *);
+long mcs_step		(double, double, double, double,
+			 const mcs_axis_inputs *, const mcs_axis_inputs *, int,
+			 double *, double *, double *, double *,
+			 mcs_parameters *);
+long mcs_limit_series	(const double *, long, const mcs_axis_series *,
+			 const mcs_axis_series *, int, double *, double *,
+			 double *, double *, mcs_parameters *);
+void mcs_extrapolate	(double, double *, double *, double *, double *,
+			 mcs_parameters *);
+void mcs_window_update	(mcs_window *, const double *);
+int  mcs_window_fit	(const mcs_window *, const double *, double *);
 long calc_coeffs	(double *, double *, double *, double *, double *,
 			 double *);
 int calc_linear		(double, double, double, double, double, double,
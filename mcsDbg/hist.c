@@ -0,0 +1,181 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hist.h"
+
+/*
+**  Latency histograms of the hot entry points
+**
+**  Each timed entry point (MCS_HIST_xxx) has a histogram of its
+**  latencies in nanoseconds, in the style of HdrHistogram: the buckets
+**  are exact up to MCS_HIST_SUB ns, and above that each power of two is
+**  split in MCS_HIST_HALF buckets, so that any value is known within
+**  1/64 whatever its magnitude, from 1 ns to centuries, in a fixed table.
+**
+**  Notes:
+**
+**  1)  The times come from CLOCK_MONOTONIC_RAW, which is read from the
+**      TSC through the vDSO on the usual x86 Linux hosts (about 20 ns a
+**      call), but doesn't need calibrating or fixing up across CPUs.
+**
+**  2)  The counters are updated with relaxed atomic operations, so the
+**      histograms stay consistent when timed code runs in several
+**      threads at once (the batch functions release the GIL). A
+**      snapshot taken meanwhile can be off by the cycles in flight.
+**
+**  3)  Timing is off unless enabled from Python, or with the MCS_HIST
+**      environment variable set to a non zero number at import time.
+*/
+
+int mcs_hist_enabled = 0;
+
+static mcs_hist histograms[MCS_HIST_COUNT];
+
+static const char *hist_names[MCS_HIST_COUNT] = {
+    "fillBuffer", "step", "limit", "fit", "extrap", "pack"
+};
+
+/* hist_index - Bucket of a value
+ */
+static int hist_index (unsigned long long v)
+{
+    int e;
+
+    if (v < MCS_HIST_SUB)
+        return (int)v;
+
+    /* v has its most significant bit at MCS_HIST_SUB_BITS - 1 + e */
+    e = 63 - __builtin_clzll(v) - (MCS_HIST_SUB_BITS - 1);
+
+    return MCS_HIST_SUB + (e - 1) * MCS_HIST_HALF + (int)((v >> e) - MCS_HIST_HALF);
+}
+
+/* mcs_hist_bucket_value - Highest value that goes to a bucket
+ */
+unsigned long long mcs_hist_bucket_value (int idx)
+{
+    unsigned long long sub;
+    int e;
+
+    if (idx < MCS_HIST_SUB)
+        return idx;
+
+    e   = (idx - MCS_HIST_SUB) / MCS_HIST_HALF + 1;
+    sub = (idx - MCS_HIST_SUB) % MCS_HIST_HALF + MCS_HIST_HALF;
+
+    return ((sub + 1) << e) - 1;
+}
+
+/* mcs_hist_init - Empty all histograms, and enable timing if MCS_HIST
+ * says so
+ */
+void mcs_hist_init (void)
+{
+    const char *env;
+    int id;
+
+    for (id = 0; id < MCS_HIST_COUNT; id++)
+        mcs_hist_reset(id);
+
+    if ((env = getenv("MCS_HIST")) != NULL)
+        mcs_hist_enabled = (atoi(env) != 0);
+}
+
+unsigned long long mcs_hist_now (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* mcs_hist_record - Count a latency of ns nanoseconds
+ */
+void mcs_hist_record (int id, unsigned long long ns)
+{
+    mcs_hist *h = &histograms[id];
+    unsigned long long old;
+
+    __atomic_fetch_add(&h->bucket[hist_index(ns)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum, ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+
+    old = __atomic_load_n(&h->min, __ATOMIC_RELAXED);
+    while ((ns < old) &&
+           !__atomic_compare_exchange_n(&h->min, &old, ns, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+    old = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    while ((ns > old) &&
+           !__atomic_compare_exchange_n(&h->max, &old, ns, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/* mcs_hist_snapshot - Copy of a histogram
+ */
+void mcs_hist_snapshot (int id, mcs_hist *out)
+{
+    mcs_hist *h = &histograms[id];
+    int i;
+
+    out->count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+    out->sum   = __atomic_load_n(&h->sum, __ATOMIC_RELAXED);
+    out->min   = __atomic_load_n(&h->min, __ATOMIC_RELAXED);
+    out->max   = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    for (i = 0; i < MCS_HIST_BUCKETS; i++)
+        out->bucket[i] = __atomic_load_n(&h->bucket[i], __ATOMIC_RELAXED);
+}
+
+void mcs_hist_reset (int id)
+{
+    mcs_hist *h = &histograms[id];
+    int i;
+
+    __atomic_store_n(&h->count, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&h->sum, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&h->min, ~0ULL, __ATOMIC_RELAXED);
+    __atomic_store_n(&h->max, 0, __ATOMIC_RELAXED);
+    for (i = 0; i < MCS_HIST_BUCKETS; i++)
+        __atomic_store_n(&h->bucket[i], 0, __ATOMIC_RELAXED);
+}
+
+/* mcs_hist_percentile - Latency under which pct percent of the counts
+ * fall, as the highest value of its bucket (never above the maximum).
+ * 0 for an empty histogram
+ */
+unsigned long long mcs_hist_percentile (const mcs_hist *h, double pct)
+{
+    unsigned long long total = 0, rank, value;
+    int i;
+
+    for (i = 0; i < MCS_HIST_BUCKETS; i++)
+        total += h->bucket[i];
+    if (total == 0)
+        return 0;
+
+    rank = (unsigned long long)(pct / 100.0 * total);
+    if (rank < pct / 100.0 * total)
+        rank++;
+    if (rank < 1)
+        rank = 1;
+    if (rank > total)
+        rank = total;
+
+    for (i = 0, total = 0; i < MCS_HIST_BUCKETS; i++)
+    {
+        total += h->bucket[i];
+        if (total >= rank)
+            break;
+    }
+
+    value = mcs_hist_bucket_value(i);
+    return (value > h->max) ? h->max : value;
+}
+
+const char *mcs_hist_name (int id)
+{
+    if ((id < 0) || (id >= MCS_HIST_COUNT))
+        return "unknown";
+
+    return hist_names[id];
+}
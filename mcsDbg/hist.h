@@ -0,0 +1,49 @@
+#ifndef __HIST_H__
+#define __HIST_H__
+
+/* Timed entry points and stages */
+#define MCS_HIST_FILLBUFFER	0	/* _mcs.fillBuffer, the whole call        */
+#define MCS_HIST_STEP		1	/* McsParams.step, the whole call         */
+#define MCS_HIST_LIMIT		2	/* limiters of both axes (mcs_step)       */
+#define MCS_HIST_FIT		3	/* quadratic fit of one axis              */
+#define MCS_HIST_EXTRAP		4	/* extrapolation (one or both axes)       */
+#define MCS_HIST_PACK		5	/* building the Python results            */
+#define MCS_HIST_COUNT		6
+
+/* Log-linear buckets: 2^MCS_HIST_SUB_BITS per power of two (values below
+ * that are exact), so a bucket is within 1/64 of its values */
+#define MCS_HIST_SUB_BITS	7
+#define MCS_HIST_SUB		(1 << MCS_HIST_SUB_BITS)
+#define MCS_HIST_HALF		(MCS_HIST_SUB / 2)
+#define MCS_HIST_BUCKETS	(MCS_HIST_SUB + (64 - MCS_HIST_SUB_BITS) * MCS_HIST_HALF)
+
+/* Latencies of one entry point, in nanoseconds */
+typedef struct {
+	unsigned long long count;
+	unsigned long long sum;
+	unsigned long long min;
+	unsigned long long max;
+	unsigned long long bucket[MCS_HIST_BUCKETS];
+} mcs_hist;
+
+/* Non zero while timing. Off by default, or set by MCS_HIST=1 */
+extern int mcs_hist_enabled;
+
+/* Timing a section costs a test when disabled. A section that started
+ * while disabled is not recorded */
+#define MCS_HIST_START()	(mcs_hist_enabled ? mcs_hist_now() : 0ULL)
+#define MCS_HIST_STOP(id, t0)	do { \
+		if (t0) \
+			mcs_hist_record((id), mcs_hist_now() - (t0)); \
+	} while (0)
+
+void   mcs_hist_init		(void);
+unsigned long long mcs_hist_now		(void);
+void   mcs_hist_record		(int, unsigned long long);
+void   mcs_hist_snapshot	(int, mcs_hist *);
+void   mcs_hist_reset		(int);
+unsigned long long mcs_hist_percentile	(const mcs_hist *, double);
+unsigned long long mcs_hist_bucket_value	(int);
+const char *mcs_hist_name	(int);
+
+#endif // __HIST_H__
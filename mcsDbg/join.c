@@ -0,0 +1,203 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "join.h"
+
+/*
+**  Time aligned join of the logs
+**
+**  The logs come one file per signal, each with its own times. The
+**  follow code needs all of them at the time of each demand, so the
+**  signals are merged in one pass with sample and hold semantics: a
+**  joined row at time t has, for every signal, its last sample at or
+**  before t (NaN until the first). Only one sample ahead of each signal
+**  is kept, whatever the length of the logs.
+**
+**  Notes:
+**
+**  1)  Without a driver, there is a row at every time any signal has a
+**      sample. With one, there is a row per sample of the driver, with
+**      its time and values, as util.AsOf would give them.
+**
+**  2)  The times can go back in a log. A sample earlier than the time
+**      reached is taken at that time (no row goes back without a driver;
+**      with one, the rows follow the times of the driver).
+*/
+
+/* advance - Read the next sample of a source. Returns -1 on error
+ */
+static int advance (join_source *s)
+{
+    const double *values;
+    int status = s->next(s->ctx, &s->headTime, &values);
+
+    if (status == 1)
+        memcpy(s->head, values, s->ncols * sizeof(double));
+    s->hasHead = (status == 1);
+
+    return (status == -1) ? -1 : 0;
+}
+
+/*
+**  - - - - - - - - - -
+**   j o i n _ i n i t
+**  - - - - - - - - - -
+**
+**  Set up a join, reading the first sample of every source.
+**
+**  Given:
+**    sources   join_source[n]   next, ctx and ncols of each signal
+**    n         int              number of signals
+**    driver    int              signal giving the times, or -1 for all
+**    complete  int              only rows with every signal known
+**
+**  Returned:
+**    join      log_join*        the join, to be freed with join_free
+**
+**  Status:
+**            int       0 = OK
+**                     -1 = error reading a source, or no memory
+*/
+int join_init (log_join *join, join_source *sources, int n, int driver, int complete)
+{
+    int i, j;
+
+    memset(join, 0, sizeof(*join));
+    join->sources  = sources;
+    join->n        = n;
+    join->driver   = driver;
+    join->complete = complete;
+    join->missing  = n;
+
+    for (i = 0; i < n; i++)
+    {
+        sources[i].column = join->ncols;
+        join->ncols += sources[i].ncols;
+    }
+
+    join->held = malloc((join->ncols > 0 ? join->ncols : 1) * sizeof(double));
+    join->seen = calloc(n > 0 ? n : 1, 1);
+    if ((join->held == NULL) || (join->seen == NULL))
+    {
+        join_free(join);
+        return -1;
+    }
+    for (j = 0; j < join->ncols; j++)
+        join->held[j] = NAN;
+
+    for (i = 0; i < n; i++)
+        if (advance(&sources[i]) == -1)
+        {
+            join_free(join);
+            return -1;
+        }
+
+    return 0;
+}
+
+/* take - Hold the samples of source i at or before t: all of them, or
+ * only the next one for the driver. Returns -1 on error
+ */
+static int take (log_join *join, int i, long long t)
+{
+    join_source *s = &join->sources[i];
+
+    while (s->hasHead && (s->headTime <= t))
+    {
+        memcpy(&join->held[s->column], s->head, s->ncols * sizeof(double));
+        if (!join->seen[i])
+        {
+            join->seen[i] = 1;
+            join->missing--;
+        }
+        if (advance(s) == -1)
+            return -1;
+        if (i == join->driver)
+            break;
+    }
+
+    return 0;
+}
+
+/*
+**  - - - - - - - - - -
+**   j o i n _ f i l l
+**  - - - - - - - - - -
+**
+**  Join the next rows.
+**
+**  Given:
+**    join      log_join*     the join
+**    rows      long          room in out, in rows
+**
+**  Returned:
+**    out       double[rows][1 + ncols]
+**                            time of each row (microseconds, exact up
+**                            to 2^53), then the values of the signals
+**
+**  Status:
+**            long      rows joined, less than rows only at the end
+**                      -1 = error reading a source
+*/
+long join_fill (log_join *join, double *out, long rows)
+{
+    join_source *s;
+    long long    t;
+    long         filled = 0;
+    int          i, found;
+
+    while (filled < rows)
+    {
+        if (join->driver >= 0)
+        {
+            s = &join->sources[join->driver];
+            if (!s->hasHead)
+                break;
+            t = s->headTime;
+        }
+        else
+        {
+            for (i = 0, found = 0, t = 0; i < join->n; i++)
+            {
+                s = &join->sources[i];
+                if (s->hasHead && (!found || (s->headTime < t)))
+                {
+                    t     = s->headTime;
+                    found = 1;
+                }
+            }
+            if (!found)
+                break;
+            if (join->started && (t < join->last))
+                t = join->last;
+        }
+
+        /* The driver first: its sample is the one at t */
+        if ((join->driver >= 0) && (take(join, join->driver, t) == -1))
+            return -1;
+        for (i = 0; i < join->n; i++)
+            if ((i != join->driver) && (take(join, i, t) == -1))
+                return -1;
+
+        if (join->complete && (join->missing > 0))
+            continue;
+
+        out[0] = (double)t;
+        memcpy(&out[1], join->held, join->ncols * sizeof(double));
+        out += 1 + join->ncols;
+        filled++;
+        join->last    = t;
+        join->started = 1;
+    }
+
+    return filled;
+}
+
+void join_free (log_join *join)
+{
+    free(join->held);
+    free(join->seen);
+    join->held = NULL;
+    join->seen = NULL;
+}
@@ -0,0 +1,39 @@
+#ifndef __JOIN_H__
+#define __JOIN_H__
+
+#include "logrows.h"
+
+/* Gets the next row of a source: 1 = a row (the values stay valid until
+ * the next call), 0 = end, -1 = error */
+typedef int (*join_next_fn)(void *, long long *, const double **);
+
+/* One signal of a join */
+typedef struct {
+	join_next_fn next;
+	void        *ctx;
+	int          ncols;		/* data columns                      */
+	int          column;	/* first of them in the joined rows  */
+	int          hasHead;	/* next sample read, not yet taken   */
+	long long    headTime;
+	double       head[MAX_LOG_COLS];
+} join_source;
+
+/* As-of join of several signals by time (see join_fill) */
+typedef struct {
+	join_source *sources;
+	int          n;
+	int          driver;	/* source giving the times, or -1    */
+	int          complete;	/* only rows with every signal known */
+	int          ncols;		/* data columns of the joined rows   */
+	int          missing;	/* signals without a sample yet      */
+	int          started;
+	long long    last;		/* time of the last joined row       */
+	double      *held;		/* last value of every column        */
+	char        *seen;
+} log_join;
+
+int  join_init	(log_join *, join_source *, int, int, int);
+long join_fill	(log_join *, double *, long);
+void join_free	(log_join *);
+
+#endif // __JOIN_H__
@@ -0,0 +1,472 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "limit.h"
+#include "follow.h"
+#include "simd.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LIMIT_X86
+#include <immintrin.h>
+#endif
+
+/*
+**  - - - - - - - - - - - - -
+**   l i m i t _ d e m a n d s
+**  - - - - - - - - - - - - -
+**
+**  Velocity/acceleration limiter (fit_new_AZ_demand, fit_new_EL_demand)
+**  for one cycle of n independent scenarios.
+**
+**  Given:
+**    state     limit_state*   limiter state of each scenario
+**    in        limit_inputs*  demands and limits of each scenario
+**    n         int            number of scenarios
+**
+**  Returned:
+**    in->pos   double[3][n]   limited demands
+**    state                    updated for the next cycle
+**    status    double[n]      0 = OK, -1 = timeB == timeC (can be NULL)
+**
+**  Status:
+**            int       number of scenarios with status -1
+**
+**  Notes:
+**
+**  1)  Every scenario gets exactly the results of a call to
+**      fit_new_XX_demand with its own mcs_parameters, including the
+**      lanes where the routine bails out early (the first demand still
+**      initializes the state, the demands are left untouched). The
+**      counters and events of mcs_parameters are not kept.
+**
+**  2)  The vector kernels evaluate both sides of every branch and keep
+**      the right one per lane. They perform the same IEEE operations in
+**      the same order as the scalar code (no fused multiply-add), so the
+**      results are identical to it.
+**
+**  3)  limit_set_level(-1) picks the kernel from what the CPU supports;
+**      until then it is the scalar one. The MCS_SIMD environment
+**      variable ("scalar", "sse2", "avx2" or "avx512") can lower the
+**      choice; "sse2" means scalar (see simd_best_level).
+*/
+
+/* limit_lane - Scalar limiter for scenario i: fit_new_AZ_demand itself,
+ * with the state of the scenario moved in and out of params (scratch
+ * parameters, whose counters and events are dropped)
+ */
+static int limit_lane (limit_state *state, const limit_inputs *in, int i,
+                       mcs_parameters *params)
+{
+    double pos[3];
+    int    k, ret;
+
+    params->firstAzFit = (state->first[i] != 0.0);
+    params->prevAzVel  = state->prevVel[i];
+    for (k = 0; k < 3; k++)
+    {
+        params->prevAzDemand[k] = state->prevDemand[k][i];
+        pos[k] = in->pos[k][i];
+    }
+
+    ret = fit_new_AZ_demand (in->time[0][i], &pos[0], in->time[1][i], &pos[1],
+                             in->time[2][i], &pos[2], in->maxVel[i], in->maxAcc[i],
+                             in->currentPos[i], 0, 0, params);
+
+    if (!params->firstAzFit)
+        state->first[i] = 0.0;
+    state->prevVel[i] = params->prevAzVel;
+    for (k = 0; k < 3; k++)
+    {
+        state->prevDemand[k][i] = params->prevAzDemand[k];
+        in->pos[k][i] = pos[k];
+    }
+
+    return ret;
+}
+
+typedef int (*limit_kernel)(limit_state *, const limit_inputs *, int,
+                            double *);
+
+/* limit_lanes - Scalar limiter for the scenarios from start to n-1
+ */
+static int limit_lanes (limit_state *state, const limit_inputs *in,
+                        int start, int n, double *status)
+{
+    mcs_parameters params;
+    int i, failed = 0, ret;
+
+    if (start >= n)
+        return 0;
+    mcs_init_parameters (&params);
+
+    for (i = start; i < n; i++)
+    {
+        ret = limit_lane (state, in, i, &params);
+        failed -= ret;
+        if (status != NULL)
+            status[i] = ret;
+    }
+
+    return failed;
+}
+
+static int limit_scalar (limit_state *state, const limit_inputs *in, int n,
+                         double *status)
+{
+    return limit_lanes (state, in, 0, n, status);
+}
+
+#ifdef LIMIT_X86
+
+/* The vector kernels follow fit_new_AZ_demand. Both sides of every branch are
+ * computed, and blend(a, b, m) keeps b in the lanes where m is set.
+ */
+
+#define AVX2_BLEND(A, B, M)	_mm256_blendv_pd((A), (B), (M))
+#define AVX2_GT(A, B)		_mm256_cmp_pd((A), (B), _CMP_GT_OQ)
+#define AVX2_LT(A, B)		_mm256_cmp_pd((A), (B), _CMP_LT_OQ)
+
+__attribute__((target("avx2")))
+static int limit_avx2 (limit_state *state, const limit_inputs *in, int n,
+                       double *status)
+{
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d half = _mm256_set1_pd(0.5);
+    const __m256d two  = _mm256_set1_pd(2.0);
+    const __m256d tenth = _mm256_set1_pd(0.1);
+    const __m256d sbit = _mm256_set1_pd(-0.0);
+    int i, k, bits, failed = 0;
+
+    for (i = 0; i + 4 <= n; i += 4)
+    {
+        __m256d cur   = _mm256_loadu_pd(&in->currentPos[i]);
+        __m256d wasFirst = _mm256_loadu_pd(&state->first[i]);
+        __m256d first = _mm256_cmp_pd(wasFirst, zero, _CMP_NEQ_UQ);
+        __m256d prevpa = AVX2_BLEND(_mm256_loadu_pd(&state->prevDemand[0][i]), cur, first);
+        __m256d prevpb = AVX2_BLEND(_mm256_loadu_pd(&state->prevDemand[1][i]), cur, first);
+        __m256d prevpc = AVX2_BLEND(_mm256_loadu_pd(&state->prevDemand[2][i]), cur, first);
+        __m256d prevVel = _mm256_andnot_pd(first, _mm256_loadu_pd(&state->prevVel[i]));
+        __m256d maxVel = _mm256_loadu_pd(&in->maxVel[i]);
+        __m256d maxAcc = _mm256_loadu_pd(&in->maxAcc[i]);
+        __m256d ta = _mm256_loadu_pd(&in->time[0][i]);
+        __m256d tb = _mm256_loadu_pd(&in->time[1][i]);
+        __m256d tc = _mm256_loadu_pd(&in->time[2][i]);
+        __m256d posA = _mm256_loadu_pd(&in->pos[0][i]);
+        __m256d posB = _mm256_loadu_pd(&in->pos[1][i]);
+        __m256d posC = _mm256_loadu_pd(&in->pos[2][i]);
+        __m256d pa = prevpa, pb = prevpb, pc = prevpc;
+        __m256d newpos = zero;
+        __m256d is0, is1, is2, m, tw, pw, d, bad, vel, accel, flag;
+        __m256d targetPos, diff, velPos, velPosP, velPosN, distP, distN, up, fixed;
+
+        /* Most recent demand */
+        is0 = _mm256_and_pd(AVX2_GT(ta, tb), AVX2_GT(ta, tc));
+        is1 = _mm256_andnot_pd(is0, _mm256_and_pd(AVX2_GT(tb, ta), AVX2_GT(tb, tc)));
+        is2 = _mm256_andnot_pd(_mm256_or_pd(is0, is1),
+                               _mm256_and_pd(AVX2_GT(tc, ta), AVX2_GT(tc, tb)));
+        newpos = AVX2_BLEND(newpos, posA, is0);
+        newpos = AVX2_BLEND(newpos, posB, is1);
+        newpos = AVX2_BLEND(newpos, posC, is2);
+        pa = AVX2_BLEND(pa, posA, is0);
+        pb = AVX2_BLEND(pb, posB, is1);
+        pc = AVX2_BLEND(pc, posC, is2);
+        is0 = _mm256_andnot_pd(_mm256_or_pd(is1, is2), _mm256_cmp_pd(zero, zero, _CMP_EQ_OQ));
+
+        /* Sort by time */
+        m  = AVX2_GT(ta, tb);
+        tw = ta; pw = pa;
+        ta = AVX2_BLEND(ta, tb, m); pa = AVX2_BLEND(pa, pb, m);
+        tb = AVX2_BLEND(tb, tw, m); pb = AVX2_BLEND(pb, pw, m);
+        m  = AVX2_GT(tb, tc);
+        tw = tb; pw = pb;
+        tb = AVX2_BLEND(tb, tc, m); pb = AVX2_BLEND(pb, pc, m);
+        tc = AVX2_BLEND(tc, tw, m); pc = AVX2_BLEND(pc, pw, m);
+        m  = AVX2_GT(ta, tb);
+        tw = ta; pw = pa;
+        ta = AVX2_BLEND(ta, tb, m); pa = AVX2_BLEND(pa, pb, m);
+        tb = AVX2_BLEND(tb, tw, m); pb = AVX2_BLEND(pb, pw, m);
+
+        /* Slew */
+        m = _mm256_cmp_pd(_mm256_andnot_pd(sbit, _mm256_sub_pd(pc, pb)), tenth, _CMP_GE_OQ);
+        maxAcc = AVX2_BLEND(maxAcc, _mm256_mul_pd(two, maxAcc), m);
+
+        targetPos = pc;
+        d   = _mm256_sub_pd(tc, tb);
+        bad = _mm256_cmp_pd(d, zero, _CMP_EQ_OQ);
+
+        /* Velocity limit */
+        vel  = _mm256_div_pd(_mm256_sub_pd(pc, pb), d);
+        flag = AVX2_GT(_mm256_andnot_pd(sbit, vel), maxVel);
+        vel  = AVX2_BLEND(vel, AVX2_BLEND(maxVel, _mm256_xor_pd(maxVel, sbit), AVX2_LT(vel, zero)), flag);
+
+        /* Acceleration limit */
+        accel = _mm256_div_pd(_mm256_sub_pd(vel, prevVel), d);
+        m     = AVX2_GT(_mm256_andnot_pd(sbit, accel), maxAcc);
+        accel = AVX2_BLEND(accel, AVX2_BLEND(maxAcc, _mm256_xor_pd(maxAcc, sbit), AVX2_LT(accel, zero)), m);
+        vel   = AVX2_BLEND(vel, _mm256_add_pd(prevVel, _mm256_mul_pd(d, accel)), m);
+        flag  = _mm256_or_pd(flag, m);
+
+        /* Velocity limit again */
+        m     = AVX2_GT(_mm256_andnot_pd(sbit, vel), maxVel);
+        vel   = AVX2_BLEND(vel, AVX2_BLEND(maxVel, _mm256_xor_pd(maxVel, sbit), AVX2_LT(vel, zero)), m);
+        accel = AVX2_BLEND(accel, _mm256_div_pd(_mm256_sub_pd(vel, prevVel), d), m);
+        flag  = _mm256_or_pd(flag, m);
+
+        /* Override the velocity close to the target */
+        up      = AVX2_GT(vel, zero);
+        diff    = _mm256_sub_pd(targetPos, pb);
+        distP   = _mm256_andnot_pd(AVX2_LT(diff, zero), _mm256_andnot_pd(sbit, diff));
+        distN   = _mm256_andnot_pd(AVX2_GT(diff, zero),
+                                   _mm256_andnot_pd(sbit, _mm256_sub_pd(pb, targetPos)));
+        velPosP = _mm256_sqrt_pd(_mm256_mul_pd(_mm256_mul_pd(two, maxAcc), distP));
+        velPosN = _mm256_xor_pd(_mm256_sqrt_pd(_mm256_mul_pd(_mm256_mul_pd(two, maxAcc), distN)), sbit);
+        velPos  = AVX2_BLEND(velPosN, velPosP, up);
+        m       = AVX2_BLEND(AVX2_LT(vel, velPos), AVX2_GT(vel, velPos), up);
+        vel     = AVX2_BLEND(vel, velPos, m);
+        accel   = AVX2_BLEND(accel, _mm256_div_pd(_mm256_sub_pd(vel, prevVel), d), m);
+        flag    = _mm256_or_pd(flag, m);
+
+        /* New position */
+        fixed  = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(prevVel, d),
+                                             _mm256_mul_pd(_mm256_mul_pd(_mm256_mul_pd(half, accel), d), d)),
+                               pb);
+        newpos = AVX2_BLEND(newpos, fixed, flag);
+        m      = _mm256_or_pd(_mm256_and_pd(AVX2_GT(vel, zero), AVX2_GT(newpos, targetPos)),
+                              _mm256_and_pd(AVX2_LT(vel, zero), AVX2_LT(newpos, targetPos)));
+        newpos = AVX2_BLEND(newpos, targetPos, _mm256_and_pd(flag, m));
+
+        pa = AVX2_BLEND(prevpa, newpos, is0);
+        pb = AVX2_BLEND(prevpb, newpos, is1);
+        pc = AVX2_BLEND(prevpc, newpos, is2);
+
+        /* Lanes with tb == tc keep their demands, and only the first
+         * demand initialization of the state */
+        _mm256_storeu_pd(&in->pos[0][i], AVX2_BLEND(pa, posA, bad));
+        _mm256_storeu_pd(&in->pos[1][i], AVX2_BLEND(pb, posB, bad));
+        _mm256_storeu_pd(&in->pos[2][i], AVX2_BLEND(pc, posC, bad));
+        _mm256_storeu_pd(&state->prevDemand[0][i], AVX2_BLEND(pa, prevpa, bad));
+        _mm256_storeu_pd(&state->prevDemand[1][i], AVX2_BLEND(pb, prevpb, bad));
+        _mm256_storeu_pd(&state->prevDemand[2][i], AVX2_BLEND(pc, prevpc, bad));
+        _mm256_storeu_pd(&state->prevVel[i], AVX2_BLEND(vel, prevVel, bad));
+        _mm256_storeu_pd(&state->first[i], _mm256_andnot_pd(first, wasFirst));
+
+        bits = _mm256_movemask_pd(bad);
+        for (k = 0; k < 4; k++)
+        {
+            if (status != NULL)
+                status[i + k] = ((bits >> k) & 1) ? -1.0 : 0.0;
+            failed += (bits >> k) & 1;
+        }
+    }
+
+    return failed + limit_lanes (state, in, i, n, status);
+}
+
+#define AVX512_BLEND(A, B, M)	_mm512_mask_blend_pd((M), (A), (B))
+#define AVX512_GT(A, B)		_mm512_cmp_pd_mask((A), (B), _CMP_GT_OQ)
+#define AVX512_LT(A, B)		_mm512_cmp_pd_mask((A), (B), _CMP_LT_OQ)
+#define AVX512_ABS(A)		_mm512_castsi512_pd(_mm512_andnot_si512(sbit, _mm512_castpd_si512(A)))
+#define AVX512_NEG(A)		_mm512_castsi512_pd(_mm512_xor_si512(sbit, _mm512_castpd_si512(A)))
+
+__attribute__((target("avx512f")))
+static int limit_avx512 (limit_state *state, const limit_inputs *in, int n,
+                         double *status)
+{
+    const __m512d zero  = _mm512_setzero_pd();
+    const __m512d half  = _mm512_set1_pd(0.5);
+    const __m512d two   = _mm512_set1_pd(2.0);
+    const __m512d tenth = _mm512_set1_pd(0.1);
+    const __m512i sbit  = _mm512_castpd_si512(_mm512_set1_pd(-0.0));
+    int i, k, failed = 0;
+
+    for (i = 0; i + 8 <= n; i += 8)
+    {
+        __m512d cur    = _mm512_loadu_pd(&in->currentPos[i]);
+        __m512d wasFirst = _mm512_loadu_pd(&state->first[i]);
+        __mmask8 first = _mm512_cmp_pd_mask(wasFirst, zero, _CMP_NEQ_UQ);
+        __m512d prevpa = AVX512_BLEND(_mm512_loadu_pd(&state->prevDemand[0][i]), cur, first);
+        __m512d prevpb = AVX512_BLEND(_mm512_loadu_pd(&state->prevDemand[1][i]), cur, first);
+        __m512d prevpc = AVX512_BLEND(_mm512_loadu_pd(&state->prevDemand[2][i]), cur, first);
+        __m512d prevVel = AVX512_BLEND(_mm512_loadu_pd(&state->prevVel[i]), zero, first);
+        __m512d maxVel = _mm512_loadu_pd(&in->maxVel[i]);
+        __m512d maxAcc = _mm512_loadu_pd(&in->maxAcc[i]);
+        __m512d ta = _mm512_loadu_pd(&in->time[0][i]);
+        __m512d tb = _mm512_loadu_pd(&in->time[1][i]);
+        __m512d tc = _mm512_loadu_pd(&in->time[2][i]);
+        __m512d posA = _mm512_loadu_pd(&in->pos[0][i]);
+        __m512d posB = _mm512_loadu_pd(&in->pos[1][i]);
+        __m512d posC = _mm512_loadu_pd(&in->pos[2][i]);
+        __m512d pa = prevpa, pb = prevpb, pc = prevpc;
+        __m512d newpos = zero;
+        __m512d tw, pw, d, vel, accel;
+        __m512d targetPos, diff, velPos, velPosP, velPosN, distP, distN, fixed;
+        __mmask8 is0, is1, is2, m, bad, flag, up;
+
+        /* Most recent demand */
+        is0 = AVX512_GT(ta, tb) & AVX512_GT(ta, tc);
+        is1 = ~is0 & AVX512_GT(tb, ta) & AVX512_GT(tb, tc);
+        is2 = ~(is0 | is1) & AVX512_GT(tc, ta) & AVX512_GT(tc, tb);
+        newpos = AVX512_BLEND(newpos, posA, is0);
+        newpos = AVX512_BLEND(newpos, posB, is1);
+        newpos = AVX512_BLEND(newpos, posC, is2);
+        pa = AVX512_BLEND(pa, posA, is0);
+        pb = AVX512_BLEND(pb, posB, is1);
+        pc = AVX512_BLEND(pc, posC, is2);
+        is0 = ~(is1 | is2);
+
+        /* Sort by time */
+        m  = AVX512_GT(ta, tb);
+        tw = ta; pw = pa;
+        ta = AVX512_BLEND(ta, tb, m); pa = AVX512_BLEND(pa, pb, m);
+        tb = AVX512_BLEND(tb, tw, m); pb = AVX512_BLEND(pb, pw, m);
+        m  = AVX512_GT(tb, tc);
+        tw = tb; pw = pb;
+        tb = AVX512_BLEND(tb, tc, m); pb = AVX512_BLEND(pb, pc, m);
+        tc = AVX512_BLEND(tc, tw, m); pc = AVX512_BLEND(pc, pw, m);
+        m  = AVX512_GT(ta, tb);
+        tw = ta; pw = pa;
+        ta = AVX512_BLEND(ta, tb, m); pa = AVX512_BLEND(pa, pb, m);
+        tb = AVX512_BLEND(tb, tw, m); pb = AVX512_BLEND(pb, pw, m);
+
+        /* Slew */
+        m = _mm512_cmp_pd_mask(AVX512_ABS(_mm512_sub_pd(pc, pb)), tenth, _CMP_GE_OQ);
+        maxAcc = AVX512_BLEND(maxAcc, _mm512_mul_pd(two, maxAcc), m);
+
+        targetPos = pc;
+        d   = _mm512_sub_pd(tc, tb);
+        bad = _mm512_cmp_pd_mask(d, zero, _CMP_EQ_OQ);
+
+        /* Velocity limit */
+        vel  = _mm512_div_pd(_mm512_sub_pd(pc, pb), d);
+        flag = AVX512_GT(AVX512_ABS(vel), maxVel);
+        vel  = AVX512_BLEND(vel, AVX512_BLEND(maxVel, AVX512_NEG(maxVel), AVX512_LT(vel, zero)), flag);
+
+        /* Acceleration limit */
+        accel = _mm512_div_pd(_mm512_sub_pd(vel, prevVel), d);
+        m     = AVX512_GT(AVX512_ABS(accel), maxAcc);
+        accel = AVX512_BLEND(accel, AVX512_BLEND(maxAcc, AVX512_NEG(maxAcc), AVX512_LT(accel, zero)), m);
+        vel   = AVX512_BLEND(vel, _mm512_add_pd(prevVel, _mm512_mul_pd(d, accel)), m);
+        flag |= m;
+
+        /* Velocity limit again */
+        m     = AVX512_GT(AVX512_ABS(vel), maxVel);
+        vel   = AVX512_BLEND(vel, AVX512_BLEND(maxVel, AVX512_NEG(maxVel), AVX512_LT(vel, zero)), m);
+        accel = AVX512_BLEND(accel, _mm512_div_pd(_mm512_sub_pd(vel, prevVel), d), m);
+        flag |= m;
+
+        /* Override the velocity close to the target */
+        up      = AVX512_GT(vel, zero);
+        diff    = _mm512_sub_pd(targetPos, pb);
+        distP   = AVX512_BLEND(AVX512_ABS(diff), zero, AVX512_LT(diff, zero));
+        distN   = AVX512_BLEND(AVX512_ABS(_mm512_sub_pd(pb, targetPos)), zero, AVX512_GT(diff, zero));
+        velPosP = _mm512_sqrt_pd(_mm512_mul_pd(_mm512_mul_pd(two, maxAcc), distP));
+        velPosN = AVX512_NEG(_mm512_sqrt_pd(_mm512_mul_pd(_mm512_mul_pd(two, maxAcc), distN)));
+        velPos  = AVX512_BLEND(velPosN, velPosP, up);
+        m       = (up & AVX512_GT(vel, velPos)) | (~up & AVX512_LT(vel, velPos));
+        vel     = AVX512_BLEND(vel, velPos, m);
+        accel   = AVX512_BLEND(accel, _mm512_div_pd(_mm512_sub_pd(vel, prevVel), d), m);
+        flag |= m;
+
+        /* New position */
+        fixed  = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(prevVel, d),
+                                             _mm512_mul_pd(_mm512_mul_pd(_mm512_mul_pd(half, accel), d), d)),
+                               pb);
+        newpos = AVX512_BLEND(newpos, fixed, flag);
+        m      = (AVX512_GT(vel, zero) & AVX512_GT(newpos, targetPos)) |
+                 (AVX512_LT(vel, zero) & AVX512_LT(newpos, targetPos));
+        newpos = AVX512_BLEND(newpos, targetPos, flag & m);
+
+        pa = AVX512_BLEND(prevpa, newpos, is0);
+        pb = AVX512_BLEND(prevpb, newpos, is1);
+        pc = AVX512_BLEND(prevpc, newpos, is2);
+
+        /* Lanes with tb == tc keep their demands, and only the first
+         * demand initialization of the state */
+        _mm512_storeu_pd(&in->pos[0][i], AVX512_BLEND(pa, posA, bad));
+        _mm512_storeu_pd(&in->pos[1][i], AVX512_BLEND(pb, posB, bad));
+        _mm512_storeu_pd(&in->pos[2][i], AVX512_BLEND(pc, posC, bad));
+        _mm512_storeu_pd(&state->prevDemand[0][i], AVX512_BLEND(pa, prevpa, bad));
+        _mm512_storeu_pd(&state->prevDemand[1][i], AVX512_BLEND(pb, prevpb, bad));
+        _mm512_storeu_pd(&state->prevDemand[2][i], AVX512_BLEND(pc, prevpc, bad));
+        _mm512_storeu_pd(&state->prevVel[i], AVX512_BLEND(vel, prevVel, bad));
+        _mm512_storeu_pd(&state->first[i], AVX512_BLEND(wasFirst, zero, first));
+
+        for (k = 0; k < 8; k++)
+        {
+            if (status != NULL)
+                status[i + k] = ((bad >> k) & 1) ? -1.0 : 0.0;
+            failed += (bad >> k) & 1;
+        }
+    }
+
+    return failed + limit_lanes (state, in, i, n, status);
+}
+
+#endif // LIMIT_X86
+
+static const limit_kernel kernels[] = {
+    limit_scalar,
+#ifdef LIMIT_X86
+    limit_avx2,
+    limit_avx512,
+#endif
+};
+
+static const char *level_names[] = { "scalar", "avx2", "avx512" };
+
+/* The scalar kernel until limit_set_level is called (the module init
+ * picks the best one). Read and written atomically, so that the level can
+ * change while others run
+ */
+static int current_level = LIMIT_SCALAR;
+
+/* limit_best_level - Highest kernel level the CPU supports (see
+ * simd_best_level)
+ */
+static int limit_best_level (void)
+{
+    switch (simd_best_level())
+    {
+    case SIMD_AVX512:
+        return LIMIT_AVX512;
+    case SIMD_AVX2:
+        return LIMIT_AVX2;
+    default:
+        return LIMIT_SCALAR;
+    }
+}
+
+/* limit_set_level - Select a kernel. Returns the level actually in use,
+ * which is lower than the one requested if the CPU lacks support
+ */
+int limit_set_level (int level)
+{
+    int best = limit_best_level();
+
+    if ((level < LIMIT_SCALAR) || (level > best))
+        level = best;
+
+    __atomic_store_n (&current_level, level, __ATOMIC_RELAXED);
+
+    return level;
+}
+
+int limit_level (void)
+{
+    return __atomic_load_n (&current_level, __ATOMIC_RELAXED);
+}
+
+const char *limit_level_name (int level)
+{
+    if ((level < LIMIT_SCALAR) || (level > LIMIT_AVX512))
+        return "unknown";
+
+    return level_names[level];
+}
+
+int limit_demands (limit_state *state, const limit_inputs *in, int n,
+                   double *status)
+{
+    return kernels[limit_level()] (state, in, n, status);
+}
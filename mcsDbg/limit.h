@@ -0,0 +1,32 @@
+#ifndef __LIMIT_H__
+#define __LIMIT_H__
+
+/* Kernel levels, from slowest to fastest */
+#define LIMIT_SCALAR	0
+#define LIMIT_AVX2	1
+#define LIMIT_AVX512	2
+
+/* Limiter state of n independent scenarios (one axis each), as a
+ * structure of arrays with one element per scenario. Same meaning as
+ * prevXXDemand, prevXXVel and firstXXFit in mcs_parameters */
+typedef struct {
+	double *prevDemand[3];
+	double *prevVel;
+	double *first;		/* non zero until the first demand */
+} limit_state;
+
+/* Inputs of one cycle for the n scenarios */
+typedef struct {
+	const double *time[3];	/* timeA, timeB, timeC                */
+	double       *pos[3];	/* posA, posB, posC (limited in place) */
+	const double *maxVel;
+	const double *maxAcc;
+	const double *currentPos;
+} limit_inputs;
+
+int  limit_demands	(limit_state *, const limit_inputs *, int, double *);
+int  limit_level	(void);
+int  limit_set_level	(int);
+const char *limit_level_name	(int);
+
+#endif // __LIMIT_H__
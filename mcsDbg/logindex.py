@@ -0,0 +1,157 @@
+# vim: ai:sw=4:sts=4:expandtab
+import os
+import struct
+import hashlib
+import numpy as np
+import _mcs
+import colcache
+
+##################################################################
+# Sparse index of the telemetry logs
+#
+# To read a log from an arbitrary time (or row) without parsing all of
+# it, _mcs.indexLog scans it once and notes where to start reading every
+# so many lines: the byte offset of the line, how many rows (with the
+# Repeat runs expanded) come before it, and the range of their times.
+# The index is saved next to the log, or in the cache directory (see
+# colcache) if that can't be written. The layout (little endian) is:
+#
+#   header  - magic 'MCSIDX01', version, number of data columns,
+#             lines per entry, size and mtime of the source log,
+#             number of entries
+#   entries - ENTRY records, one every so many lines from the first
+#
+# A Repeat line is expanded up to the time of the line after it, and
+# a Repeat line at the end of the log with the average period of the
+# runs before it; each entry keeps that average, so that reading from
+# it gives the same rows as reading the whole log.
+
+MAGIC       = b'MCSIDX01'
+VERSION     = 1
+EVERY       = 1024
+
+_HEADER     = struct.Struct('<8sIIqqdq')
+
+ENTRY = np.dtype([('offset', '<i8'),        # of the line, in bytes
+                  ('line', '<i8'),          # from 0 after the header
+                  ('row', '<i8'),           # rows before the line
+                  ('maxBefore', '<i8'),     # latest time of those
+                  ('minTime', '<i8'),       # range of times of the rows up
+                  ('maxTime', '<i8'),       #   to the next entry
+                  ('cmaAvg', '<f8'),        # average period of the runs
+                  ('cmaN', '<i8')])         #   before the line
+
+# _mcs.indexLog returns the entries in the byte order of the machine
+_NATIVE = ENTRY.newbyteorder('=')
+
+def index_paths(source):
+    """
+    Where the index of a source log can be: next to it, or in the cache
+    directory, keyed by its absolute path
+    """
+    key = hashlib.sha1(os.path.abspath(source).encode('utf-8')).hexdigest()
+    return [source + '.idx', os.path.join(colcache.cache_dir(), key + '.idx')]
+
+def open_index(source, ncols, every=EVERY):
+    """
+    Returns the LogIndex of a source log, making it (and trying to save
+    it) if there is none that matches the current log
+    """
+    st = os.stat(source)
+    for path in index_paths(source):
+        try:
+            index = LogIndex.load(path)
+        except (IOError, OSError, ValueError):
+            continue
+        if (index.source_size, index.source_mtime, index.ncols, index.every) == \
+           (st.st_size, st.st_mtime, ncols, every):
+            return index
+
+    entries = np.frombuffer(_mcs.indexLog(source, ncols, every), dtype=_NATIVE).astype(ENTRY)
+    index = LogIndex(entries, ncols, every, st.st_size, st.st_mtime)
+    for path in index_paths(source):
+        try:
+            index.save(path)
+            break
+        except (IOError, OSError):
+            pass
+
+    return index
+
+class LogIndex(object):
+    """
+    Entries of the sparse index of a log, and the lookups on them. The
+    times are in microseconds
+    """
+    def __init__(self, entries, ncols, every, source_size, source_mtime):
+        self.entries = entries
+        self.ncols = ncols
+        self.every = every
+        self.source_size = source_size
+        self.source_mtime = source_mtime
+        # Earliest time from each entry to the end of the log: the times
+        # can go back, so the last entry worth reading is found on this
+        self.min_after = np.minimum.accumulate(entries['minTime'][::-1])[::-1]
+
+    @classmethod
+    def load(cls, path):
+        with open(path, 'rb') as f:
+            data = f.read()
+        try:
+            magic, version, ncols, every, size, mtime, n = _HEADER.unpack_from(data, 0)
+        except struct.error:
+            raise ValueError("Not a valid index file: {0}".format(path))
+        if magic != MAGIC or version != VERSION or \
+           len(data) != _HEADER.size + n * ENTRY.itemsize:
+            raise ValueError("Not a valid index file: {0}".format(path))
+        entries = np.frombuffer(data, dtype=ENTRY, count=n, offset=_HEADER.size)
+        return cls(entries, ncols, every, size, mtime)
+
+    def save(self, path):
+        # Written under a temporary name, and renamed into place
+        dirname = os.path.dirname(path)
+        if dirname and not os.path.isdir(dirname):
+            os.makedirs(dirname)
+        tmp_path = '{0}.{1}.tmp'.format(path, os.getpid())
+        try:
+            with open(tmp_path, 'wb') as f:
+                f.write(_HEADER.pack(MAGIC, VERSION, self.ncols, self.every, self.source_size,
+                                     self.source_mtime, len(self.entries)))
+                f.write(self.entries.tobytes())
+            os.rename(tmp_path, path)
+        except (IOError, OSError):
+            try:
+                os.unlink(tmp_path)
+            except OSError:
+                pass
+            raise
+
+    def __len__(self):
+        return len(self.entries)
+
+    def for_time(self, start):
+        """
+        Last entry with only rows earlier than start before it: reading
+        from there gives every row at or after start
+        """
+        if start is None or not len(self.entries):
+            return 0
+        return max(int(np.searchsorted(self.entries['maxBefore'], start, 'left')) - 1, 0)
+
+    def until(self, end):
+        """
+        First entry with only rows at or after end from it to the end of
+        the log, or None: reading up to there gives every row before end
+        """
+        if end is None:
+            return None
+        i = int(np.searchsorted(self.min_after, end, 'left'))
+        return i if i < len(self.entries) else None
+
+    def for_row(self, n):
+        """
+        Last entry at or before row n (from 0)
+        """
+        if not len(self.entries):
+            return 0
+        return max(int(np.searchsorted(self.entries['row'], n, 'right')) - 1, 0)
@@ -0,0 +1,372 @@
+#define _GNU_SOURCE	/* memmem */
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "logrows.h"
+#include "tstamp.h"
+
+/* parse_double - Parse a whole field as a double, allowing surrounding
+ * blanks (like Python's float())
+ */
+static int parse_double (const char *p, const char *end, double *value)
+{
+    char  buf[64];
+    char *stop;
+    size_t len;
+
+    while ((p < end) && isspace((unsigned char)*p))
+        p++;
+    while ((end > p) && isspace((unsigned char)end[-1]))
+        end--;
+
+    len = end - p;
+    if ((len == 0) || (len >= sizeof(buf)))
+        return -1;
+    memcpy(buf, p, len);
+    buf[len] = '\0';
+
+    *value = strtod(buf, &stop);
+
+    return (*stop == '\0') ? 0 : -1;
+}
+
+/* parse_repeat - Parse the "Repeat N" field
+ */
+static int parse_repeat (const char *p, const char *end, long *count)
+{
+    const char *last;
+    char       *stop;
+    char        buf[32];
+    size_t      len;
+
+    while ((end > p) && isspace((unsigned char)end[-1]))
+        end--;
+    if ((memmem(p, end - p, "Repeat", 6)) == NULL)
+        return -1;
+
+    for (last = end; (last > p) && !isspace((unsigned char)last[-1]); last--)
+        ;
+    len = end - last;
+    if ((len == 0) || (len >= sizeof(buf)))
+        return -1;
+    memcpy(buf, last, len);
+    buf[len] = '\0';
+
+    *count = strtol(buf, &stop, 10);
+
+    return (*stop == '\0') ? 0 : -1;
+}
+
+/*
+**  - - - - - - - - - - - - - - -
+**   p a r s e _ l o g _ l i n e
+**  - - - - - - - - - - - - - - -
+**
+**  Parse a tab separated log line: timestamp, ncols values and, for
+**  compressed runs, a trailing "Repeat N" field.
+**
+**  Status:
+**            int       0 = OK
+**                     -1 = corrupt line
+*/
+int parse_log_line (const char *line, size_t len, int ncols, log_row *row)
+{
+    const char *p = line, *end = line + len, *tab;
+    int         field;
+
+    while ((p < end) && isspace((unsigned char)*p))
+        p++;
+    while ((end > p) && isspace((unsigned char)end[-1]))
+        end--;
+
+    row->repeat = 0;
+    for (field = 0; ; field++, p = tab + 1)
+    {
+        if ((tab = memchr(p, '\t', end - p)) == NULL)
+            tab = end;
+
+        if (field == 0)
+        {
+            if (parse_timestamp(p, tab - p, &row->time) == -1)
+                return -1;
+        }
+        else if (field <= ncols)
+        {
+            if (parse_double(p, tab, &row->values[field - 1]) == -1)
+                return -1;
+        }
+        else if ((field == ncols + 1) && (tab == end))
+        {
+            if ((parse_repeat(p, tab, &row->repeat) == -1) || (row->repeat < 1))
+                return -1;
+        }
+        else
+            return -1;
+
+        if (tab == end)
+            break;
+    }
+
+    return (field >= ncols) ? 0 : -1;
+}
+
+void repeat_init (repeat_expander *exp, int ncols)
+{
+    memset(exp, 0, sizeof(*exp));
+    exp->ncols = ncols;
+}
+
+/* floor_div - Division rounding towards minus infinity, like Python's //
+ */
+static long long floor_div (long long a, long long b)
+{
+    long long q = a / b;
+
+    if (((a % b) != 0) && ((a < 0) != (b < 0)))
+        q--;
+
+    return q;
+}
+
+static void start_run (repeat_expander *exp, long long span)
+{
+    exp->emit_t0   = exp->run.time;
+    exp->emit_span = span;
+    exp->emit_k    = 1;
+    exp->emit_n    = exp->run.repeat;
+    memcpy(exp->emit_values, exp->run.values, exp->ncols * sizeof(double));
+    exp->pending   = 0;
+}
+
+/*
+**  - - - - - - - - - - - -
+**   r e p e a t _ p u s h
+**  - - - - - - - - - - - -
+**
+**  Feed the next parsed line. The caller has to drain the output with
+**  repeat_next before pushing again.
+**
+**  Notes:
+**
+**  1)  A pending Repeat line ends at the time of this line. Its N-1
+**      extra samples are emitted first, at t0 + k*(t - t0)/N (integer
+**      microseconds, rounded down), then this line itself.
+**
+**  2)  Each completed run adds its sample period to a cumulative
+**      average, used by repeat_finish.
+*/
+void repeat_push (repeat_expander *exp, const log_row *row)
+{
+    if (exp->pending)
+    {
+        long long span = row->time - exp->run.time;
+        double    x    = (double)span / exp->run.repeat / 1000000.0;
+
+        exp->cma_avg = exp->cma_avg + (x - exp->cma_avg) / (exp->cma_n + 1);
+        exp->cma_n++;
+        start_run(exp, span);
+    }
+
+    exp->next = *row;
+    exp->held = 1;
+}
+
+/*
+**  - - - - - - - - - - - - - -
+**   r e p e a t _ f i n i s h
+**  - - - - - - - - - - - - - -
+**
+**  End of the log. A pending Repeat line has no following line to tell
+**  when it ends, so its samples are spread using the average sample
+**  period of the previous runs.
+*/
+void repeat_finish (repeat_expander *exp)
+{
+    if (exp->pending)
+        start_run(exp, llround(exp->cma_avg * 1000000.0 * exp->run.repeat));
+}
+
+/*
+**  - - - - - - - - - - -
+**   r e p e a t _ n e x t
+**  - - - - - - - - - - -
+**
+**  Get the next output row. The values stay valid until the next call
+**  to repeat_next or repeat_push.
+**
+**  Status:
+**            int       1 = a row was returned
+**                      0 = more input needed (or end of the log)
+*/
+int repeat_next (repeat_expander *exp, long long *time, const double **values)
+{
+    if (exp->emit_k < exp->emit_n)
+    {
+        *time   = exp->emit_t0 + floor_div(exp->emit_k * exp->emit_span, exp->emit_n);
+        *values = exp->emit_values;
+        exp->emit_k++;
+        return 1;
+    }
+
+    if (exp->held)
+    {
+        exp->held = 0;
+        if (exp->next.repeat > 0)
+        {
+            exp->run     = exp->next;
+            exp->pending = 1;
+        }
+        *time   = exp->next.time;
+        *values = exp->next.values;
+        return 1;
+    }
+
+    return 0;
+}
+
+/* index_rows - Drain the rows the expander has ready, counting them in
+ * entry cur, or in entry next from the row of the line just pushed if
+ * next >= 0. Returns the entry of the last row
+ */
+static long index_rows (repeat_expander *exp, log_index_entry *e, long cur,
+                        long next, long long *rows, long long *maxTime)
+{
+    const double *values;
+    long long     t;
+    int           held;
+
+    for (;;)
+    {
+        held = exp->held;
+        if (!repeat_next(exp, &t, &values))
+            break;
+
+        /* The run of a Repeat line comes before the next line */
+        if ((next >= 0) && held && !exp->held)
+        {
+            e[next].row       = *rows;
+            e[next].maxBefore = *maxTime;
+            e[next].minTime   = LLONG_MAX;
+            e[next].maxTime   = LLONG_MIN;
+            e[next].cmaAvg    = exp->cma_avg;
+            e[next].cmaN      = exp->cma_n;
+            cur  = next;
+            next = -1;
+        }
+
+        (*rows)++;
+        if (t > *maxTime)
+            *maxTime = t;
+        if (t < e[cur].minTime)
+            e[cur].minTime = t;
+        if (t > e[cur].maxTime)
+            e[cur].maxTime = t;
+    }
+
+    return cur;
+}
+
+/*
+**  - - - - - - - - - -
+**   l o g _ i n d e x
+**  - - - - - - - - - -
+**
+**  Scan a log, and make a sparse index of it: one entry every so many
+**  lines, to start reading from.
+**
+**  Given:
+**    f         FILE*              the log, at its start
+**    ncols     int                data columns
+**    skip      int                header lines
+**    every     long               lines per entry (> 0)
+**
+**  Returned:
+**    entries   log_index_entry**  the entries (to be freed), the first
+**                                 one at the first line
+**    badLine   long long*         corrupt line (from 0 after the header)
+**
+**  Status:
+**            long      number of entries
+**                      -1 = read or memory error, with errno set
+**                      -2 = corrupt line
+**
+**  Notes:
+**
+**  1)  The run of a Repeat line is counted in the entry of the Repeat
+**      line, even when the line that ends the run starts a new entry.
+**
+**  2)  The times can go back in a log, so each entry has the latest
+**      time before it and the range of times up to the next one.
+*/
+long log_index (FILE *f, int ncols, int skip, long every,
+                log_index_entry **entries, long long *badLine)
+{
+    repeat_expander  exp;
+    log_index_entry *e = NULL, *tmp;
+    log_row          row;
+    char            *line = NULL;
+    size_t           cap = 0;
+    ssize_t          len;
+    long long        offset = 0, lineNo = 0, rows = 0, maxTime = LLONG_MIN;
+    long             n = 0, size = 0, cur = -1;
+    int              i, err;
+
+    for (i = 0; (i < skip) && ((len = getline(&line, &cap, f)) != -1); i++)
+        offset += len;
+    repeat_init(&exp, ncols);
+
+    while ((len = getline(&line, &cap, f)) != -1)
+    {
+        if (parse_log_line(line, (size_t)len, ncols, &row) == -1)
+        {
+            *badLine = lineNo;
+            free(line);
+            free(e);
+            return -2;
+        }
+        repeat_push(&exp, &row);
+
+        if (lineNo % every == 0)
+        {
+            if (n == size)
+            {
+                size = size ? 2 * size : 256;
+                if ((tmp = realloc(e, size * sizeof(*e))) == NULL)
+                    goto error;
+                e = tmp;
+            }
+            e[n].offset = offset;
+            e[n].line   = lineNo;
+            cur = index_rows(&exp, e, cur, n, &rows, &maxTime);
+            n++;
+        }
+        else
+            cur = index_rows(&exp, e, cur, -1, &rows, &maxTime);
+
+        offset += len;
+        lineNo++;
+    }
+    if (ferror(f))
+        goto error;
+
+    repeat_finish(&exp);
+    if (cur >= 0)
+        index_rows(&exp, e, cur, -1, &rows, &maxTime);
+
+    free(line);
+    *entries = e;
+
+    return n;
+
+error:
+    err = errno;
+    free(line);
+    free(e);
+    errno = err;
+
+    return -1;
+}
@@ -0,0 +1,65 @@
+#ifndef __LOGROWS_H__
+#define __LOGROWS_H__
+
+#include <stddef.h>
+#include <stdio.h>
+
+#define MAX_LOG_COLS	64	/* data columns per log line          */
+
+/* One parsed log line */
+typedef struct {
+	long long time;			/* microseconds since the epoch */
+	long      repeat;		/* N for a "Repeat N" line, 0 otherwise */
+	double    values[MAX_LOG_COLS];
+} log_row;
+
+/* Streaming expansion of "Repeat N" lines. A Repeat line is followed by
+ * N-1 samples with its values, evenly spread up to the time of the next
+ * line. Only the current run is kept, whatever its length.
+ */
+typedef struct {
+	int       ncols;
+
+	/* Repeat line waiting for the next one to know where its run ends */
+	int       pending;
+	log_row   run;
+
+	/* Run being emitted: samples t0 + k*span/n for k = emit_k .. n-1 */
+	long long emit_t0;
+	long long emit_span;
+	long      emit_k;
+	long      emit_n;
+	double    emit_values[MAX_LOG_COLS];
+
+	/* Line to be emitted after the run */
+	int       held;
+	log_row   next;
+
+	/* Cumulative average of the sample period (seconds), used to
+	 * expand a Repeat line found at the end of the log */
+	double    cma_avg;
+	long      cma_n;
+} repeat_expander;
+
+/* Entry of a sparse index of a log (log_index): reading the log from
+ * offset, with an expander whose averages are set to cmaAvg and cmaN,
+ * gives the rows from number row on. Times in microseconds */
+typedef struct {
+	long long offset;	/* of the line, in bytes               */
+	long long line;		/* of the line, from 0 after the header */
+	long long row;		/* rows before those of the line        */
+	long long maxBefore;	/* latest time of those (LLONG_MIN)     */
+	long long minTime;	/* earliest and latest times of the rows */
+	long long maxTime;	/* up to the next entry                  */
+	double    cmaAvg;
+	long long cmaN;
+} log_index_entry;
+
+int  parse_log_line	(const char *, size_t, int, log_row *);
+void repeat_init	(repeat_expander *, int);
+void repeat_push	(repeat_expander *, const log_row *);
+void repeat_finish	(repeat_expander *);
+int  repeat_next	(repeat_expander *, long long *, const double **);
+long log_index		(FILE *, int, int, long, log_index_entry **, long long *);
+
+#endif // __LOGROWS_H__
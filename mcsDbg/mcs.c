@@ -1,20 +1,67 @@
+#define PY_SSIZE_T_CLEAN
 #include <Python.h>
 #include <structmember.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <math.h>
 #include "follow.h"
+#include "extrap.h"
+#include "tstamp.h"
+#include "logrows.h"
+#include "limit.h"
+#include "coeffs.h"
+#include "pace.h"
+#include "hist.h"
+#include "ring.h"
+#include "traj.h"
+#include "sweep.h"
+#include "join.h"
+
+/*
+ * The module builds against Python 2 and 3. The Python 2 names are kept
+ * in the code, and mapped to their Python 3 equivalents here
+ */
+
+#if PY_MAJOR_VERSION >= 3
+#define PyInt_Check             PyLong_Check
+#define PyInt_AsLong            PyLong_AsLong
+#define PyInt_FromLong          PyLong_FromLong
+#define PyString_FromString     PyUnicode_FromString
+#define PyString_AsString       PyUnicode_AsUTF8
+#define PyString_ConcatAndDel   PyUnicode_AppendAndDel
+#define _PyString_Join          PyUnicode_Join
+#define PyClass_Check           PyType_Check
+#endif
+
+#ifndef Py_TPFLAGS_HAVE_ITER
+#define Py_TPFLAGS_HAVE_ITER 0
+#endif
+
+/*
+ * From 3.7 on, the per-cycle entry points (fillBuffer, McsParams.step) are
+ * METH_FASTCALL: the arguments come in a C array, and the common case
+ * (numbers given as floats or ints, demands as tuples or lists) is
+ * converted without going through PyArg_ParseTupleAndKeywords. Anything
+ * else falls back to the regular parser, which also reports the errors
+ */
+
+#if PY_VERSION_HEX >= 0x030700A0
+#define _MCS_FASTCALL 1
+#endif
 
 static PyObject *_mcs_get_bool(int *);
 static int _mcs_set_bool(int *, PyObject *);
 static PyObject *_mcs_get_double(double *);
 static double _mcs_set_double(double *, PyObject *);
-static PyObject *_mcs_get_double_arr(double [], unsigned);
+static PyObject *_mcs_get_double_arr(PyObject *, const int *, double [], unsigned);
 static double _mcs_set_double_arr(double [], unsigned, PyObject *);
 
 /*
  * This type is essentially a writable tuple (ie. fixed size) to proxy
- * a C array
+ * a C array. The array belongs to owner, which the proxy keeps alive;
+ * writes raise while the owner is busy (see _mcs_params_in_use)
  */
 
 typedef struct {
@@ -22,8 +69,25 @@ typedef struct {
 
 	Py_ssize_t size;
 	double *p;
+	PyObject *owner;
+	const int *busy;
 } _DoubleArrayProxy;
 
+static int _DoubleArrayProxy_in_use(_DoubleArrayProxy *self) {
+	if (*self->busy) {
+		PyErr_SetString(PyExc_RuntimeError, "McsParams is in use by a call in another thread");
+		return 1;
+	}
+
+	return 0;
+}
+
+static void
+_DoubleArrayProxy_dealloc(_DoubleArrayProxy *self) {
+	Py_XDECREF(self->owner);
+	PyObject_Del(self);
+}
+
 static Py_ssize_t _DoubleArrayProxy_sq_length (_DoubleArrayProxy *self) {
 	return self->size;
 }
@@ -42,6 +106,8 @@ static int _DoubleArrayProxy_sq_ass_item(_DoubleArrayProxy *self, Py_ssize_t ind
 		PyErr_SetString(PyExc_IndexError, "Index out of bounds");
 		return -1;
 	}
+	if (_DoubleArrayProxy_in_use(self))
+		return -1;
 
 	return _mcs_set_double(&self->p[index], item);
 }
@@ -71,6 +137,8 @@ _DoubleArrayProxy_init(_DoubleArrayProxy *self, PyObject *args, PyObject *kwds)
 		free(message);
 		return -1;
 	}
+	if (_DoubleArrayProxy_in_use(self))
+		return -1;
 
 	for (i = 0, p = self->p; i < self->size; i++, p++) {
 		PyObject *item = PySequence_GetItem(seq, i);
@@ -132,7 +200,7 @@ static PyTypeObject _DoubleArrayProxyType = {
 	"_mcs._DoubleArrayProxy",
 	sizeof(_DoubleArrayProxy),
 	0,                               /* tp_itemsize */
-	0,                               /* tp_dealloc */
+	(destructor)_DoubleArrayProxy_dealloc, /* tp_dealloc */
 	0,                               /* tp_print */
 	0,                               /* tp_getattr */
 	0,                               /* tp_setattr */
@@ -151,6 +219,170 @@ static PyTypeObject _DoubleArrayProxyType = {
 	"Writable tuple-like object", /* tp_doc */
 };
 
+/*
+ * This type owns a contiguous block of doubles (1 or 2 dimensions) and
+ * exposes it through the buffer protocol, so that bulk results can be
+ * handed over to NumPy without creating a Python object per element
+ */
+
+#ifndef Py_TPFLAGS_HAVE_NEWBUFFER
+#define Py_TPFLAGS_HAVE_NEWBUFFER 0
+#endif
+
+typedef struct {
+	PyObject_HEAD
+
+	int ndim;
+	Py_ssize_t shape[2];
+	Py_ssize_t strides[2];
+	double *p;
+} _DoubleBuffer;
+
+static PyTypeObject _DoubleBufferType;
+
+static _DoubleBuffer *
+_DoubleBuffer_create(Py_ssize_t rows, Py_ssize_t cols) {
+	_DoubleBuffer *self;
+	Py_ssize_t elements = rows * ((cols > 0) ? cols : 1);
+
+	self = PyObject_New(_DoubleBuffer, &_DoubleBufferType);
+	if (self == NULL)
+		return NULL;
+
+	self->p = malloc((elements > 0 ? elements : 1) * sizeof(double));
+	if (self->p == NULL) {
+		PyObject_Del(self);
+		PyErr_NoMemory();
+		return NULL;
+	}
+
+	if (cols > 0) {
+		self->ndim = 2;
+		self->shape[0] = rows;
+		self->shape[1] = cols;
+		self->strides[0] = cols * sizeof(double);
+		self->strides[1] = sizeof(double);
+	} else {
+		self->ndim = 1;
+		self->shape[0] = rows;
+		self->shape[1] = 1;
+		self->strides[0] = sizeof(double);
+		self->strides[1] = sizeof(double);
+	}
+
+	return self;
+}
+
+static void
+_DoubleBuffer_dealloc(_DoubleBuffer *self) {
+	free(self->p);
+	PyObject_Del(self);
+}
+
+static Py_ssize_t _DoubleBuffer_sq_length (_DoubleBuffer *self) {
+	return self->shape[0];
+}
+
+static PyObject *_DoubleBuffer_sq_item(_DoubleBuffer *self, Py_ssize_t index) {
+	PyObject *row;
+	double *p;
+	Py_ssize_t i;
+
+	if ((index < 0) || (index >= self->shape[0])) {
+		PyErr_SetString(PyExc_IndexError, "Index out of bounds");
+		return NULL;
+	}
+
+	if (self->ndim == 1)
+		return PyFloat_FromDouble(self->p[index]);
+
+	row = PyTuple_New(self->shape[1]);
+	if (row == NULL)
+		return NULL;
+	for (i = 0, p = &self->p[index * self->shape[1]]; i < self->shape[1]; i++, p++) {
+		PyObject *item = PyFloat_FromDouble(*p);
+		if (item == NULL) {
+			Py_DECREF(row);
+			return NULL;
+		}
+		PyTuple_SET_ITEM(row, i, item);
+	}
+
+	return row;
+}
+
+static int
+_DoubleBuffer_getbuffer(_DoubleBuffer *self, Py_buffer *view, int flags) {
+	view->buf = self->p;
+	view->obj = (PyObject *)self;
+	Py_INCREF(self);
+	view->len = self->shape[0] * ((self->ndim == 2) ? self->shape[1] : 1) * sizeof(double);
+	view->readonly = 0;
+	view->itemsize = sizeof(double);
+	view->format = (flags & PyBUF_FORMAT) ? "d" : NULL;
+	view->ndim = self->ndim;
+	view->shape = (flags & PyBUF_ND) ? self->shape : NULL;
+	view->strides = ((flags & PyBUF_STRIDES) == PyBUF_STRIDES) ? self->strides : NULL;
+	view->suboffsets = NULL;
+	view->internal = NULL;
+
+	return 0;
+}
+
+static PyObject *
+_DoubleBuffer_get_shape(_DoubleBuffer *self, void *closure) {
+	if (self->ndim == 1)
+		return Py_BuildValue("(n)", self->shape[0]);
+	return Py_BuildValue("(nn)", self->shape[0], self->shape[1]);
+}
+
+static PySequenceMethods _DoubleBufferSeqMeth = {
+	.sq_length = (lenfunc)_DoubleBuffer_sq_length,
+	.sq_item = (ssizeargfunc)_DoubleBuffer_sq_item,
+};
+
+static PyBufferProcs _DoubleBufferBufferProcs = {
+	.bf_getbuffer = (getbufferproc)_DoubleBuffer_getbuffer,
+};
+
+static PyGetSetDef _DoubleBuffer_getsetters[] = {
+	{"shape", (getter)_DoubleBuffer_get_shape, NULL, "Dimensions of the buffer"},
+	{NULL} // Sentinel
+};
+
+static PyTypeObject _DoubleBufferType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	"_mcs.DoubleBuffer",
+	sizeof(_DoubleBuffer),
+	0,                               /* tp_itemsize */
+	(destructor)_DoubleBuffer_dealloc, /* tp_dealloc */
+	0,                               /* tp_print */
+	0,                               /* tp_getattr */
+	0,                               /* tp_setattr */
+	0,                               /* tp_compare */
+	0,                               /* tp_repr */
+	0,                               /* tp_as_number */
+	&_DoubleBufferSeqMeth,           /* tp_as_sequence */
+	0,                               /* tp_as_mapping */
+	0,                               /* tp_hash */
+	0,                               /* tp_call */
+	0,                               /* tp_str */
+	0,                               /* tp_getattro */
+	0,                               /* tp_setattro */
+	&_DoubleBufferBufferProcs,       /* tp_as_buffer */
+	Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER, /* tp_flags */
+	"Contiguous array of doubles exposing the buffer protocol", /* tp_doc */
+	0,                               /* tp_traverse */
+	0,                               /* tp_clear */
+	0,                               /* tp_richcompare */
+	0,                               /* tp_weaklistoffset */
+	0,                               /* tp_iter */
+	0,                               /* tp_iternext */
+	0,                               /* tp_methods */
+	0,                               /* tp_members */
+	_DoubleBuffer_getsetters,        /* tp_getset */
+};
+
 /*
  * Utility functions
  */
@@ -177,11 +409,13 @@ double _mcs_set_double(double *ptr, PyObject *value) {
 	if(PyFloat_Check(value)) {
 		*ptr = PyFloat_AsDouble(value);
 	}
-	else if (PyInt_Check(value)) {
-		*ptr = (double)PyInt_AsLong(value);
-	}
 	else if (PyLong_Check(value)) {
 		*ptr = PyLong_AsDouble(value);
+		if ((*ptr == -1.0) && PyErr_Occurred())
+			return -1;
+	}
+	else if (PyInt_Check(value)) {
+		*ptr = (double)PyInt_AsLong(value);
 	}
 	else {
 		PyObject *repr;
@@ -202,15 +436,17 @@ double _mcs_set_double(double *ptr, PyObject *value) {
 	return 0;
 }
 
-PyObject *_mcs_get_double_arr(double ptr[], unsigned sz) {
+PyObject *_mcs_get_double_arr(PyObject *owner, const int *busy, double ptr[], unsigned sz) {
 	unsigned elements = sz / sizeof(double);
 	_DoubleArrayProxy *dap;
 
 	dap = PyObject_New(_DoubleArrayProxy, &_DoubleArrayProxyType);
-	Py_INCREF(dap);
 	if (dap != NULL) {
 		dap->size = elements;
 		dap->p = ptr;
+		Py_INCREF(owner);
+		dap->owner = owner;
+		dap->busy = busy;
 	} else {
 		PyErr_SetString(PyExc_MemoryError, "Could not create the array proxy object");
 	}
@@ -245,253 +481,3381 @@ double _mcs_set_double_arr(double ptr[], unsigned sz, PyObject *value) {
 }
 
 /*
- * MCS Parameters Type
+ * Gets a C-contiguous view of doubles out of any object implementing the
+ * buffer protocol (NumPy arrays, ctypes arrays, _mcs.DoubleBuffer, ...)
  */
 
-typedef struct {
-	PyObject_HEAD
+static int _mcs_get_double_view(PyObject *obj, Py_buffer *view, int writable, const char *name) {
+	int flags = PyBUF_C_CONTIGUOUS | PyBUF_FORMAT;
+	const char *fmt;
 
-	mcs_parameters persistent_pars;
-} _mcs_McsParamsObject;
+	if (writable)
+		flags |= PyBUF_WRITABLE;
 
+	if (!PyObject_CheckBuffer(obj) || (PyObject_GetBuffer(obj, view, flags) == -1)) {
+		PyErr_Clear();
+		PyErr_Format(PyExc_TypeError, "%s must be a %scontiguous buffer of doubles",
+			     name, writable ? "writable " : "");
+		return -1;
+	}
 
-#define PY_ATTR_GETSET(NAME, TYPE) \
-static PyObject *_mcs_McsParams_ ## NAME ## _getter(PyObject *self, void *closure) {\
-	mcs_parameters *p = &((_mcs_McsParamsObject *)self)->persistent_pars;\
-	return _mcs_get_ ## TYPE (&p->NAME);\
-}\
-static int _mcs_McsParams_ ## NAME ## _setter(PyObject *self, PyObject *value, void *closure) {\
-	mcs_parameters *p = &((_mcs_McsParamsObject *)self)->persistent_pars;\
-	return _mcs_set_ ## TYPE (&p->NAME, value);\
+	fmt = view->format;
+	if ((fmt != NULL) && ((*fmt == '@') || (*fmt == '=') || (*fmt == '<')))
+		fmt++;
+	if ((view->itemsize != sizeof(double)) || ((fmt != NULL) && strcmp(fmt, "d"))) {
+		PyBuffer_Release(view);
+		PyErr_Format(PyExc_TypeError, "%s must hold doubles", name);
+		return -1;
+	}
+
+	return 0;
 }
 
-#define PY_ATTR_GETSET_ARR(NAME, TYPE) \
-static PyObject *_mcs_McsParams_ ## NAME ## _getter(PyObject *self, void *closure) {\
-	mcs_parameters *p = &((_mcs_McsParamsObject *)self)->persistent_pars;\
-	return _mcs_get_ ## TYPE ## _arr (p->NAME, sizeof(p->NAME));\
-}\
-static int _mcs_McsParams_ ## NAME ## _setter(PyObject *self, PyObject *value, void *closure) {\
-	mcs_parameters *p = &((_mcs_McsParamsObject *)self)->persistent_pars;\
-	return _mcs_set_ ## TYPE ## _arr (p->NAME, sizeof(p->NAME), value);\
+/*
+ * Gets writable views for an out= argument, which must be a tuple with
+ * exactly count buffers (eg. (pos, vel)), each of them holding n doubles
+ */
+
+static int _mcs_get_out_views(PyObject *out, Py_buffer views[], int count, Py_ssize_t n) {
+	char name[16];
+	int i, j;
+
+	if (!PyTuple_Check(out) || (PyTuple_GET_SIZE(out) != count)) {
+		PyErr_Format(PyExc_TypeError, "out must be a tuple of %d buffers", count);
+		return -1;
+	}
+
+	for (i = 0; i < count; i++) {
+		snprintf(name, sizeof(name), "out[%d]", i);
+		if (_mcs_get_double_view(PyTuple_GET_ITEM(out, i), &views[i], 1, name) == -1)
+			break;
+		if ((views[i].len / (Py_ssize_t)sizeof(double)) != n) {
+			PyErr_Format(PyExc_ValueError, "%s must have exactly %zd elements", name, n);
+			PyBuffer_Release(&views[i]);
+			break;
+		}
+	}
+	if (i < count) {
+		for (j = 0; j < i; j++)
+			PyBuffer_Release(&views[j]);
+		return -1;
+	}
+
+	return 0;
 }
 
-#define PY_TP_GETSET(NAME) { #NAME, _mcs_McsParams_ ## NAME ## _getter, _mcs_McsParams_ ## NAME ## _setter }
+static void _mcs_release_out_views(Py_buffer views[], int count) {
+	int i;
 
-PY_ATTR_GETSET(firstAzFit, bool)
-PY_ATTR_GETSET(firstElFit, bool)
-PY_ATTR_GETSET_ARR(prevAzDemand, double)
-PY_ATTR_GETSET_ARR(prevElDemand, double)
+	for (i = 0; i < count; i++)
+		PyBuffer_Release(&views[i]);
+}
 
-static PyGetSetDef _mcs_McsParams_getsetters[] = {
-	PY_TP_GETSET(firstAzFit),
-	PY_TP_GETSET(firstElFit),
-	PY_TP_GETSET(prevAzDemand),
-	PY_TP_GETSET(prevElDemand),
-	{NULL} // Sentinel
-};
+/*
+ * A column holds a per-cycle input for the batch functions. It can be given
+ * either as a single number (repeated for every cycle) or as a buffer with
+ * exactly one double per cycle
+ */
 
-static PyMemberDef _mcs_McsParams_members[] = {
-	{"azA", T_DOUBLE, offsetof(_mcs_McsParamsObject, persistent_pars.azA), 0, NULL},
-	{"azB", T_DOUBLE, offsetof(_mcs_McsParamsObject, persistent_pars.azB), 0, NULL},
-	{"azC", T_DOUBLE, offsetof(_mcs_McsParamsObject, persistent_pars.azC), 0, NULL},
-	{"lastAzVelocity", T_DOUBLE, offsetof(_mcs_McsParamsObject, persistent_pars.lastAzVelocity), 0, NULL},
-	{"prevAzVel", T_DOUBLE, offsetof(_mcs_McsParamsObject, persistent_pars.prevAzVel), 0, NULL},
-	{"elA", T_DOUBLE, offsetof(_mcs_McsParamsObject, persistent_pars.elA), 0, NULL},
-	{"elB", T_DOUBLE, offsetof(_mcs_McsParamsObject, persistent_pars.elB), 0, NULL},
-	{"elC", T_DOUBLE, offsetof(_mcs_McsParamsObject, persistent_pars.elC), 0, NULL},
-	{"lastElVelocity", T_DOUBLE, offsetof(_mcs_McsParamsObject, persistent_pars.lastElVelocity), 0, NULL},
-	{"prevElVel", T_DOUBLE, offsetof(_mcs_McsParamsObject, persistent_pars.prevElVel), 0, NULL},
-	{NULL} // Sentinel
-};
+typedef struct {
+	double value;
+	double *p;
+	Py_buffer view;
+} _mcs_column;
 
-static int
-_mcs_McsParams_init(_mcs_McsParamsObject *self, PyObject *args, PyObject *kwds) {
-	if ((PySequence_Length(args) > 0)  || (kwds != NULL)) {
-		PyErr_SetString(PyExc_TypeError, "McsParams.__init__ takes no parameters");
+#define _MCS_COLUMN_AT(col, i) (((col).p != NULL) ? (col).p[i] : (col).value)
+
+static int _mcs_column_init(_mcs_column *col, PyObject *obj, Py_ssize_t n, const char *name) {
+	col->p = NULL;
+
+	if (PyFloat_Check(obj) || PyInt_Check(obj) || PyLong_Check(obj))
+		return (int)_mcs_set_double(&col->value, obj);
+
+	if (_mcs_get_double_view(obj, &col->view, 0, name) == -1)
 		return -1;
-	}
 
-	self->persistent_pars.firstAzFit = 1;
-	self->persistent_pars.firstElFit = 1;
+	if ((col->view.len / (Py_ssize_t)sizeof(double)) != n) {
+		PyBuffer_Release(&col->view);
+		PyErr_Format(PyExc_ValueError, "%s must have exactly %zd elements", name, n);
+		return -1;
+	}
+	col->p = col->view.buf;
 
 	return 0;
 }
 
-static PyTypeObject _mcs_McsParamsType = {
-	PyVarObject_HEAD_INIT(NULL, 0)
-	"_mcs.McsParams",
-	sizeof(_mcs_McsParamsObject),
-	0,                         /* tp_itemsize */
-	0,                         /* tp_dealloc */
-	0,                         /* tp_print */
-	0,                         /* tp_getattr */
-	0,                         /* tp_setattr */
-	0,                         /* tp_compare */
-	0,                         /* tp_repr */
-	0,                         /* tp_as_number */
-	0,                         /* tp_as_sequence */
-	0,                         /* tp_as_mapping */
-	0,                         /* tp_hash */
-	0,                         /* tp_call */
-	0,                         /* tp_str */
-	0,                         /* tp_getattro */
-	0,                         /* tp_setattro */
-	0,                         /* tp_as_buffer */
-	Py_TPFLAGS_DEFAULT,        /* tp_flags */
-	"MCS Calc Simulation Persistent Parameters",           /* tp_doc */
-	0,                         /* tp_traverse */
-	0,                         /* tp_clear */
-	0,                         /* tp_richcompare */
-	0,                         /* tp_weaklistoffset */
-	0,                         /* tp_iter */
-	0,                         /* tp_iternext */
-	0,                         /* tp_methods */
-	_mcs_McsParams_members,    /* tp_members */
-	_mcs_McsParams_getsetters, /* tp_getset */
-	0,                         /* tp_base */
-	0,                         /* tp_dict */
-	0,                         /* tp_descr_get */
-	0,                         /* tp_descr_set */
-	0,                         /* tp_dictoffset */
-	(initproc)_mcs_McsParams_init, /* tp_init */
-};
+static void _mcs_column_release(_mcs_column *col) {
+	if (col->p != NULL) {
+		PyBuffer_Release(&col->view);
+		col->p = NULL;
+	}
+}
 
-static PyObject *
-iface_mcs_sim_fillBuffer(PyObject *self, PyObject *args, PyObject *kwds) {
-	static char *kwlist[] = {
-		"params", "demands", "offset", "jump", "max_vel", "max_acc",
-		"curr_pos", "curr_vel", "recent", "storage", NULL
-	};
+/*
+ * Like _mcs_column_init, for the functions that want one element per
+ * cycle: a number is repeated into a new array, returned in *filled (to be
+ * freed by the caller, after releasing the column). Returns NULL, with
+ * the column released, on error
+ */
 
-	_mcs_McsParamsObject *mcs_params;
-	PyObject *dem[3];
-	double AA[2], BB[2], CC[2];
-	int axis;
-	int recent;
-	double offset;
-	double jump;
-	double max_vel, max_acc;
-	double curr_pos, curr_vel;
-	PyObject *ret;
-	PyObject *storage = NULL;
+static double *_mcs_column_array(_mcs_column *col, PyObject *obj, Py_ssize_t n,
+				 const char *name, double **filled) {
+	Py_ssize_t i;
 
-	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!(OOO)iddddddi|O", kwlist,
-			&_mcs_McsParamsType, &mcs_params,
-			&dem[0], &dem[1], &dem[2],
-			&axis, &offset, &jump,
-			&max_vel, &max_acc,
-			&curr_pos, &curr_vel,
-			&recent, &storage))
+	*filled = NULL;
+	if (_mcs_column_init(col, obj, n, name) == -1)
 		return NULL;
+	if (col->p != NULL)
+		return col->p;
 
-	if ((storage != NULL) && (!PyClass_Check(storage))) {
-		PyErr_SetString(PyExc_TypeError, "storage must be a class object");
+	if ((*filled = malloc((n > 0 ? n : 1) * sizeof(double))) == NULL) {
+		_mcs_column_release(col);
+		PyErr_NoMemory();
 		return NULL;
 	}
+	for (i = 0; i < n; i++)
+		(*filled)[i] = col->value;
 
-	{
-		PyObject *tuple;
-		PyObject *item;
-		int i, j, ret;
-		double *arr;
-		char *message;
-
-		for (i = 0; i < 3; i++) {
-			tuple = dem[i];
-			if (!PySequence_Check(tuple) || (PySequence_Length(tuple) != 2)) {
-				if (asprintf(&message, "Demand #%d is not a 2-element sequence", i) != -1) {
-					PyErr_SetString(PyExc_ValueError, message);
-					free(message);
-				} else {
-					PyErr_SetString(PyExc_ValueError, "One of the demands is not a 2-element sequence");
-				}
-				return NULL;
-			}
+	return *filled;
+}
 
-			switch (i) {
-				case 0:
-					arr = AA;
-					break;
-				case 1:
-					arr = BB;
-					break;
-				case 2:
-					arr = CC;
-					break;
-				default:
-					// Should never happen...
-					fputs("Something is seriously wrong with this loop...", stderr);
-					abort();
-					break;
-			}
+#ifdef _MCS_FASTCALL
+/*
+ * Helpers for the METH_FASTCALL entry points. They return 0 when the
+ * argument is not one of the simple cases (without raising), in which
+ * case the call goes to _mcs_fastcall_fallback
+ */
 
-			for (j = 0; j < 2; j++) {
-				item = PySequence_GetItem(tuple, j);
-				ret = _mcs_set_double(&arr[j], item);
-				Py_DECREF(item);
-				if (ret != 0)
-					return NULL;
-			}
+static int _mcs_fast_double(PyObject *obj, double *value) {
+	if (PyFloat_CheckExact(obj)) {
+		*value = PyFloat_AS_DOUBLE(obj);
+		return 1;
+	}
+	if (PyLong_CheckExact(obj)) {
+		*value = PyLong_AsDouble(obj);
+		if ((*value == -1.0) && PyErr_Occurred()) {
+			PyErr_Clear();
+			return 0;
 		}
+		return 1;
 	}
 
-	{
-		double pos[NUM_EXTRAP];
-		double vel[NUM_EXTRAP];
-		double prevDemand;
-		PyObject *ret, *demand_tuple;
-		PyObject *item;
-		int i;
+	return 0;
+}
 
-		if (fillBuffer(AA, BB, CC, pos, vel, offset, axis, &prevDemand, jump,
-			   max_vel, max_acc, curr_pos, curr_vel, 0, recent,
-			   &mcs_params->persistent_pars) == 1)
-		{
+static int _mcs_fast_int(PyObject *obj, int *value) {
+	long n;
+
+	if (!PyLong_CheckExact(obj))
+		return 0;
+	n = PyLong_AsLong(obj);
+	if (((n == -1) && PyErr_Occurred()) || (n < INT_MIN) || (n > INT_MAX)) {
+		PyErr_Clear();
+		return 0;
+	}
+	*value = (int)n;
+
+	return 1;
+}
+
+/*
+ * Puts the arguments of a call in the slots given by kwlist: positional
+ * arguments first, then the keywords. Slots not given are left as NULL.
+ * Returns 0 (without raising) for unknown or repeated arguments
+ */
+
+static int _mcs_fast_bind(PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames,
+			  char *kwlist[], PyObject *slots[], int nslots) {
+	Py_ssize_t i, nkw = (kwnames != NULL) ? PyTuple_GET_SIZE(kwnames) : 0;
+	int j;
+
+	if (nargs > nslots)
+		return 0;
+
+	for (j = 0; j < nslots; j++)
+		slots[j] = (j < nargs) ? args[j] : NULL;
+
+	for (i = 0; i < nkw; i++) {
+		PyObject *name = PyTuple_GET_ITEM(kwnames, i);
+
+		for (j = 0; j < nslots; j++)
+			if (PyUnicode_CompareWithASCIIString(name, kwlist[j]) == 0)
+				break;
+		if ((j == nslots) || (slots[j] != NULL))
+			return 0;
+		slots[j] = args[nargs + i];
+	}
+
+	return 1;
+}
+
+/*
+ * Calls the regular (METH_VARARGS | METH_KEYWORDS) version of an entry
+ * point with the arguments of a METH_FASTCALL call
+ */
+
+static PyObject *
+_mcs_fastcall_fallback(PyCFunctionWithKeywords func, PyObject *self,
+		       PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+	PyObject *tuple, *kwds = NULL, *ret = NULL;
+	Py_ssize_t i, nkw = (kwnames != NULL) ? PyTuple_GET_SIZE(kwnames) : 0;
+
+	if ((tuple = PyTuple_New(nargs)) == NULL)
+		return NULL;
+	for (i = 0; i < nargs; i++) {
+		Py_INCREF(args[i]);
+		PyTuple_SET_ITEM(tuple, i, args[i]);
+	}
+
+	if (nkw > 0) {
+		if ((kwds = PyDict_New()) == NULL)
+			goto exit;
+		for (i = 0; i < nkw; i++)
+			if (PyDict_SetItem(kwds, PyTuple_GET_ITEM(kwnames, i), args[nargs + i]) == -1)
+				goto exit;
+	}
+
+	ret = func(self, tuple, kwds);
+
+exit:
+	Py_DECREF(tuple);
+	Py_XDECREF(kwds);
+
+	return ret;
+}
+#endif // _MCS_FASTCALL
+
+/*
+ * Demand Ring Type
+ *
+ * This process' end of a ring of demands in shared memory (see ring.c).
+ * The ring has a single producer and a single consumer: push from one
+ * thread or process, and pop (or McsParams.followRing) from another one.
+ * While followRing consumes from it, pop and a second followRing raise
+ */
+
+typedef struct {
+	PyObject_HEAD
+	demand_ring ring;
+	PyObject *name;
+	unsigned long nextSeq;	/* sequence number of the next push */
+	int busy;		/* followRing is consuming, without the GIL */
+} _DemandRing;
+
+static PyObject *
+_DemandRing_new(PyTypeObject *type, PyObject *args, PyObject *kwds) {
+	static char *kwlist[] = {"name", "capacity", NULL};
+	const char *name;
+	Py_ssize_t capacity = 0;
+	_DemandRing *self;
+	int ret;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|n", kwlist, &name, &capacity))
+		return NULL;
+
+	if (capacity < 0) {
+		PyErr_SetString(PyExc_ValueError, "capacity must be positive");
+		return NULL;
+	}
+
+	self = (_DemandRing *)type->tp_alloc(type, 0);
+	if (self == NULL)
+		return NULL;
+	if ((self->name = PyString_FromString(name)) == NULL) {
+		Py_DECREF(self);
+		return NULL;
+	}
+
+	if (capacity > 0)
+		ret = ring_create(&self->ring, name, (unsigned long)capacity);
+	else
+		ret = ring_open(&self->ring, name);
+	if (ret == -1) {
+		PyErr_SetFromErrnoWithFilename(PyExc_OSError, name);
+		Py_DECREF(self);
+		return NULL;
+	}
+
+	return (PyObject *)self;
+}
+
+static void
+_DemandRing_dealloc(_DemandRing *self) {
+	ring_close(&self->ring);
+	Py_XDECREF(self->name);
+	Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+/*
+ * Publishes a demand, stamped with the time and the next sequence number.
+ * Returns False if the ring was full (the demand is dropped)
+ */
+
+static PyObject *
+_DemandRing_push(_DemandRing *self, PyObject *args) {
+	ring_demand d;
+
+	if (!PyArg_ParseTuple(args, "ddd", &d.applyTime, &d.az, &d.el))
+		return NULL;
+
+	d.seq = self->nextSeq++;
+	d.sent = ring_now();
+
+	return PyBool_FromLong(ring_push(&self->ring, &d) == 0);
+}
+
+/*
+ * Takes the oldest demand, as (seq, applyTime, az, el, sent), or returns
+ * None if the ring is empty
+ */
+
+static PyObject *
+_DemandRing_pop(_DemandRing *self, PyObject *unused) {
+	ring_demand d;
+
+	if (self->busy) {
+		PyErr_SetString(PyExc_RuntimeError, "DemandRing is being consumed by followRing");
+		return NULL;
+	}
+	if (!ring_pop(&self->ring, &d))
+		Py_RETURN_NONE;
+
+	return Py_BuildValue("(kdddd)", d.seq, d.applyTime, d.az, d.el, d.sent);
+}
+
+static PyObject *
+_DemandRing_finish(_DemandRing *self, PyObject *unused) {
+	ring_finish(&self->ring);
+
+	Py_RETURN_NONE;
+}
+
+static PyObject *
+_DemandRing_unlink(_DemandRing *self, PyObject *unused) {
+	if (ring_unlink(PyString_AsString(self->name)) == -1)
+		return PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, self->name);
+
+	Py_RETURN_NONE;
+}
+
+static PyObject *
+_DemandRing_pending_getter(_DemandRing *self, void *closure) {
+	return PyLong_FromUnsignedLong(ring_pending(&self->ring));
+}
+
+static PyObject *
+_DemandRing_dropped_getter(_DemandRing *self, void *closure) {
+	return PyLong_FromUnsignedLong(__atomic_load_n(&self->ring.shm->dropped, __ATOMIC_RELAXED));
+}
+
+static PyObject *
+_DemandRing_done_getter(_DemandRing *self, void *closure) {
+	return PyBool_FromLong(__atomic_load_n(&self->ring.shm->done, __ATOMIC_ACQUIRE) != 0);
+}
+
+static PyObject *
+_DemandRing_capacity_getter(_DemandRing *self, void *closure) {
+	return PyLong_FromUnsignedLong(self->ring.shm->capacity);
+}
+
+static PyMethodDef _DemandRing_methods[] = {
+	{"push", (PyCFunction)_DemandRing_push, METH_VARARGS,
+	 "Publish a demand (applyTime, az, el)"},
+	{"pop", (PyCFunction)_DemandRing_pop, METH_NOARGS,
+	 "Take the oldest demand"},
+	{"finish", (PyCFunction)_DemandRing_finish, METH_NOARGS,
+	 "Tell the consumer there are no more demands"},
+	{"unlink", (PyCFunction)_DemandRing_unlink, METH_NOARGS,
+	 "Remove the name of the ring"},
+	{NULL} // Sentinel
+};
+
+static PyGetSetDef _DemandRing_getsetters[] = {
+	{"pending", (getter)_DemandRing_pending_getter, NULL,
+	 "Demands published and not consumed yet"},
+	{"dropped", (getter)_DemandRing_dropped_getter, NULL,
+	 "Demands that found the ring full"},
+	{"done", (getter)_DemandRing_done_getter, NULL,
+	 "True once the producer has finished"},
+	{"capacity", (getter)_DemandRing_capacity_getter, NULL,
+	 "Number of slots"},
+	{NULL} // Sentinel
+};
+
+static PyMemberDef _DemandRing_members[] = {
+	{"name", T_OBJECT, offsetof(_DemandRing, name), READONLY, NULL},
+	{NULL} // Sentinel
+};
+
+static PyTypeObject _DemandRingType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	"_mcs.DemandRing",
+	sizeof(_DemandRing),
+	0,                               /* tp_itemsize */
+	(destructor)_DemandRing_dealloc, /* tp_dealloc */
+	0,                               /* tp_print */
+	0,                               /* tp_getattr */
+	0,                               /* tp_setattr */
+	0,                               /* tp_compare */
+	0,                               /* tp_repr */
+	0,                               /* tp_as_number */
+	0,                               /* tp_as_sequence */
+	0,                               /* tp_as_mapping */
+	0,                               /* tp_hash */
+	0,                               /* tp_call */
+	0,                               /* tp_str */
+	0,                               /* tp_getattro */
+	0,                               /* tp_setattro */
+	0,                               /* tp_as_buffer */
+	Py_TPFLAGS_DEFAULT,              /* tp_flags */
+	"DemandRing(name, capacity=0)\n\n"
+	"Ring of demands in shared memory. With a capacity (a power of 2) the\n"
+	"ring is created, otherwise an existing one is opened", /* tp_doc */
+	0,                               /* tp_traverse */
+	0,                               /* tp_clear */
+	0,                               /* tp_richcompare */
+	0,                               /* tp_weaklistoffset */
+	0,                               /* tp_iter */
+	0,                               /* tp_iternext */
+	_DemandRing_methods,             /* tp_methods */
+	_DemandRing_members,             /* tp_members */
+	_DemandRing_getsetters,          /* tp_getset */
+	0,                               /* tp_base */
+	0,                               /* tp_dict */
+	0,                               /* tp_descr_get */
+	0,                               /* tp_descr_set */
+	0,                               /* tp_dictoffset */
+	0,                               /* tp_init */
+	0,                               /* tp_alloc */
+	_DemandRing_new,                 /* tp_new */
+};
+
+/*
+ * MCS Parameters Type
+ */
+
+typedef struct {
+	PyObject_HEAD
+
+	mcs_parameters persistent_pars;
+	int busy;		/* a call runs on persistent_pars without the GIL */
+} _mcs_McsParamsObject;
+
+/*
+ * The calls that release the GIL (limitSeries, runPaced, followRing) mark
+ * the instance busy while they run on it. Meanwhile, every other call that
+ * touches its state raises, as does a second such call; only drainEvents
+ * is allowed (see mcs_drain_events). The flag is only read and written
+ * with the GIL held
+ */
+
+static int
+_mcs_params_in_use(_mcs_McsParamsObject *self) {
+	if (self->busy) {
+		PyErr_SetString(PyExc_RuntimeError, "McsParams is in use by a call in another thread");
+		return 1;
+	}
+
+	return 0;
+}
+
+static int
+_mcs_McsParams_setattro(PyObject *self, PyObject *name, PyObject *value) {
+	if (_mcs_params_in_use((_mcs_McsParamsObject *)self))
+		return -1;
+
+	return PyObject_GenericSetAttr(self, name, value);
+}
+
+
+#define PY_ATTR_GETSET(NAME, TYPE) \
+static PyObject *_mcs_McsParams_ ## NAME ## _getter(PyObject *self, void *closure) {\
+	mcs_parameters *p = &((_mcs_McsParamsObject *)self)->persistent_pars;\
+	return _mcs_get_ ## TYPE (&p->NAME);\
+}\
+static int _mcs_McsParams_ ## NAME ## _setter(PyObject *self, PyObject *value, void *closure) {\
+	mcs_parameters *p = &((_mcs_McsParamsObject *)self)->persistent_pars;\
+	return _mcs_set_ ## TYPE (&p->NAME, value);\
+}
+
+#define PY_ATTR_GETSET_ARR(NAME, TYPE) \
+static PyObject *_mcs_McsParams_ ## NAME ## _getter(PyObject *self, void *closure) {\
+	mcs_parameters *p = &((_mcs_McsParamsObject *)self)->persistent_pars;\
+	return _mcs_get_ ## TYPE ## _arr (self, &((_mcs_McsParamsObject *)self)->busy,\
+					  p->NAME, sizeof(p->NAME));\
+}\
+static int _mcs_McsParams_ ## NAME ## _setter(PyObject *self, PyObject *value, void *closure) {\
+	mcs_parameters *p = &((_mcs_McsParamsObject *)self)->persistent_pars;\
+	return _mcs_set_ ## TYPE ## _arr (p->NAME, sizeof(p->NAME), value);\
+}
+
+/*
+ * The extrapolation horizon and cycle period can be changed at any time,
+ * but have to stay within sensible limits
+ */
+
+static int _mcs_check_num_extrap(long value) {
+	if ((value < 1) || (value > MAX_EXTRAP)) {
+		PyErr_Format(PyExc_ValueError, "numExtrap must be between 1 and %d", MAX_EXTRAP);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int _mcs_check_time_int(double value) {
+	if (!(value > 0.0)) {
+		PyErr_SetString(PyExc_ValueError, "timeInt must be positive");
+		return -1;
+	}
+
+	return 0;
+}
+
+static PyObject *_mcs_McsParams_numExtrap_getter(PyObject *self, void *closure) {
+	return PyInt_FromLong(((_mcs_McsParamsObject *)self)->persistent_pars.numExtrap);
+}
+
+static int _mcs_McsParams_numExtrap_setter(PyObject *self, PyObject *value, void *closure) {
+	long n;
+
+	if (value == NULL) {
+		PyErr_SetString(PyExc_TypeError, "Cannot delete numExtrap");
+		return -1;
+	}
+	n = PyInt_AsLong(value);
+	if ((n == -1) && PyErr_Occurred())
+		return -1;
+	if (_mcs_check_num_extrap(n) == -1)
+		return -1;
+	((_mcs_McsParamsObject *)self)->persistent_pars.numExtrap = (int)n;
+
+	return 0;
+}
+
+static PyObject *_mcs_McsParams_nextDemand_getter(PyObject *self, void *closure) {
+	return PyInt_FromLong(((_mcs_McsParamsObject *)self)->persistent_pars.nextDemand);
+}
+
+/* nextDemand indexes the three demand slots, so it must stay in 0..2 */
+static int _mcs_McsParams_nextDemand_setter(PyObject *self, PyObject *value, void *closure) {
+	long n;
+
+	if (value == NULL) {
+		PyErr_SetString(PyExc_TypeError, "Cannot delete nextDemand");
+		return -1;
+	}
+	n = PyInt_AsLong(value);
+	if ((n == -1) && PyErr_Occurred())
+		return -1;
+	if ((n < 0) || (n > 2)) {
+		PyErr_SetString(PyExc_ValueError, "nextDemand must be 0, 1 or 2");
+		return -1;
+	}
+	((_mcs_McsParamsObject *)self)->persistent_pars.nextDemand = (int)n;
+
+	return 0;
+}
+
+static PyObject *_mcs_McsParams_timeInt_getter(PyObject *self, void *closure) {
+	return _mcs_get_double(&((_mcs_McsParamsObject *)self)->persistent_pars.timeInt);
+}
+
+static int _mcs_McsParams_timeInt_setter(PyObject *self, PyObject *value, void *closure) {
+	double t;
+
+	if (value == NULL) {
+		PyErr_SetString(PyExc_TypeError, "Cannot delete timeInt");
+		return -1;
+	}
+	if (_mcs_set_double(&t, value) == -1)
+		return -1;
+	if (_mcs_check_time_int(t) == -1)
+		return -1;
+	((_mcs_McsParamsObject *)self)->persistent_pars.timeInt = t;
+
+	return 0;
+}
+
+/*
+ * Hot path counters (mcs_axis_counters), returned as
+ * {'az': {name: count, ...}, 'el': {...}}
+ */
+
+static const struct {
+	const char *name;
+	size_t offset;
+} _mcs_counter_fields[] = {
+	{"fits", offsetof(mcs_axis_counters, fits)},
+	{"fitFailures", offsetof(mcs_axis_counters, fitFailures)},
+	{"demands", offsetof(mcs_axis_counters, demands)},
+	{"slews", offsetof(mcs_axis_counters, slews)},
+	{"velLimited", offsetof(mcs_axis_counters, velLimited)},
+	{"accLimited", offsetof(mcs_axis_counters, accLimited)},
+	{"nearTarget", offsetof(mcs_axis_counters, nearTarget)},
+	{NULL, 0} // Sentinel
+};
+
+static PyObject *_mcs_counters_dict(const mcs_parameters *pars) {
+	static const char *axes[] = {"az", "el"};
+	PyObject *ret, *axis, *value;
+	int i, j;
+
+	if ((ret = PyDict_New()) == NULL)
+		return NULL;
+
+	for (i = 0; i < 2; i++) {
+		if ((axis = PyDict_New()) == NULL)
+			goto error;
+		if (PyDict_SetItemString(ret, axes[i], axis) == -1) {
+			Py_DECREF(axis);
+			goto error;
+		}
+		Py_DECREF(axis);
+
+		for (j = 0; _mcs_counter_fields[j].name != NULL; j++) {
+			const char *base = (const char *)&pars->counters[i];
+
+			value = PyLong_FromUnsignedLong(*(const unsigned long *)(base + _mcs_counter_fields[j].offset));
+			if ((value == NULL) || (PyDict_SetItemString(axis, _mcs_counter_fields[j].name, value) == -1)) {
+				Py_XDECREF(value);
+				goto error;
+			}
+			Py_DECREF(value);
+		}
+	}
+
+	return ret;
+
+error:
+	Py_DECREF(ret);
+	return NULL;
+}
+
+static PyObject *_mcs_McsParams_counters_getter(PyObject *self, void *closure) {
+	return _mcs_counters_dict(&((_mcs_McsParamsObject *)self)->persistent_pars);
+}
+
+#define PY_TP_GETSET(NAME) { #NAME, _mcs_McsParams_ ## NAME ## _getter, _mcs_McsParams_ ## NAME ## _setter }
+
+PY_ATTR_GETSET(firstAzFit, bool)
+PY_ATTR_GETSET(firstElFit, bool)
+PY_ATTR_GETSET_ARR(prevAzDemand, double)
+PY_ATTR_GETSET_ARR(prevElDemand, double)
+PY_ATTR_GETSET_ARR(demandTime, double)
+
+static PyGetSetDef _mcs_McsParams_getsetters[] = {
+	PY_TP_GETSET(firstAzFit),
+	PY_TP_GETSET(firstElFit),
+	PY_TP_GETSET(prevAzDemand),
+	PY_TP_GETSET(prevElDemand),
+	PY_TP_GETSET(demandTime),
+	PY_TP_GETSET(numExtrap),
+	PY_TP_GETSET(timeInt),
+	PY_TP_GETSET(nextDemand),
+	{"counters", _mcs_McsParams_counters_getter, NULL,
+	 "Per-axis counters of the branches taken by the follow code"},
+	{NULL} // Sentinel
+};
+
+static PyMemberDef _mcs_McsParams_members[] = {
+	{"azA", T_DOUBLE, offsetof(_mcs_McsParamsObject, persistent_pars.azA), 0, NULL},
+	{"azB", T_DOUBLE, offsetof(_mcs_McsParamsObject, persistent_pars.azB), 0, NULL},
+	{"azC", T_DOUBLE, offsetof(_mcs_McsParamsObject, persistent_pars.azC), 0, NULL},
+	{"lastAzVelocity", T_DOUBLE, offsetof(_mcs_McsParamsObject, persistent_pars.lastAzVelocity), 0, NULL},
+	{"prevAzVel", T_DOUBLE, offsetof(_mcs_McsParamsObject, persistent_pars.prevAzVel), 0, NULL},
+	{"elA", T_DOUBLE, offsetof(_mcs_McsParamsObject, persistent_pars.elA), 0, NULL},
+	{"elB", T_DOUBLE, offsetof(_mcs_McsParamsObject, persistent_pars.elB), 0, NULL},
+	{"elC", T_DOUBLE, offsetof(_mcs_McsParamsObject, persistent_pars.elC), 0, NULL},
+	{"lastElVelocity", T_DOUBLE, offsetof(_mcs_McsParamsObject, persistent_pars.lastElVelocity), 0, NULL},
+	{"prevElVel", T_DOUBLE, offsetof(_mcs_McsParamsObject, persistent_pars.prevElVel), 0, NULL},
+	{"localFit", T_INT, offsetof(_mcs_McsParamsObject, persistent_pars.localFit), 0,
+	 "Fit in the frame of the demand window (azOrigin, elOrigin)"},
+	{"azOrigin", T_DOUBLE, offsetof(_mcs_McsParamsObject, persistent_pars.azOrigin), 0, NULL},
+	{"elOrigin", T_DOUBLE, offsetof(_mcs_McsParamsObject, persistent_pars.elOrigin), 0, NULL},
+	{"eventsLost", T_ULONG, offsetof(_mcs_McsParamsObject, persistent_pars.events.lost), READONLY,
+	 "Events overwritten before being drained"},
+	{NULL} // Sentinel
+};
+
+static int
+_mcs_McsParams_init(_mcs_McsParamsObject *self, PyObject *args, PyObject *kwds) {
+	static char *kwlist[] = { "num_extrap", "time_int", "local_fit", NULL };
+	int num_extrap = NUM_EXTRAP;
+	double time_int = TIME_INT;
+	PyObject *local_fit = NULL;
+	int local = 0;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|idO", kwlist, &num_extrap, &time_int,
+					 &local_fit))
+		return -1;
+
+	if ((local_fit != NULL) && ((local = PyObject_IsTrue(local_fit)) == -1))
+		return -1;
+	if (_mcs_params_in_use(self))
+		return -1;
+
+	if ((_mcs_check_num_extrap(num_extrap) == -1) || (_mcs_check_time_int(time_int) == -1))
+		return -1;
+
+	mcs_init_parameters(&self->persistent_pars);
+	self->persistent_pars.numExtrap = num_extrap;
+	self->persistent_pars.timeInt = time_int;
+	self->persistent_pars.localFit = local;
+
+	return 0;
+}
+
+/*
+ * Runs one complete control cycle for both axes: the new demand goes
+ * through the velocity/acceleration limiters, and then is fitted and
+ * extrapolated together with the two previous ones.
+ *
+ *   demand - (applyTime, az, el), eg. a mcs.Demand
+ *
+ * Returns (azPos, azVel, elPos, elVel) as DoubleBuffer objects, or fills the
+ * four writable buffers passed as out=, and returns it
+ */
+
+static PyObject *
+_mcs_McsParams_run_step(_mcs_McsParamsObject *self, PyObject *demand, double offset,
+			mcs_axis_inputs *az, mcs_axis_inputs *el, int recent, PyObject *out) {
+	PyObject *ret = NULL;
+	double dem[3];
+	double *bufs[4];
+	_DoubleBuffer *res[4] = { NULL, NULL, NULL, NULL };
+	Py_buffer out_views[4];
+	int nx = self->persistent_pars.numExtrap;
+	unsigned long long t0, pack = 0;
+	int i;
+
+	if (_mcs_params_in_use(self))
+		return NULL;
+	if (out == Py_None)
+		out = NULL;
+
+	if (PyTuple_Check(demand) && (PyTuple_GET_SIZE(demand) == 3)) {
+		for (i = 0; i < 3; i++)
+			if (((dem[i] = PyFloat_AsDouble(PyTuple_GET_ITEM(demand, i))) == -1.0) && PyErr_Occurred())
+				return NULL;
+	}
+	else {
+		PyObject *seq = PySequence_Fast(demand, "demand must be an (applyTime, az, el) sequence");
+
+		if (seq == NULL)
+			return NULL;
+		if (PySequence_Fast_GET_SIZE(seq) != 3) {
+			Py_DECREF(seq);
+			PyErr_SetString(PyExc_ValueError, "demand must be an (applyTime, az, el) sequence");
+			return NULL;
+		}
+		for (i = 0; i < 3; i++)
+			if (((dem[i] = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(seq, i))) == -1.0) && PyErr_Occurred()) {
+				Py_DECREF(seq);
+				return NULL;
+			}
+		Py_DECREF(seq);
+	}
+
+	if (out != NULL) {
+		if (_mcs_get_out_views(out, out_views, 4, nx) == -1)
+			return NULL;
+		for (i = 0; i < 4; i++)
+			bufs[i] = out_views[i].buf;
+	}
+	else {
+		// The result buffers count as packing, made ahead of the step
+		t0 = MCS_HIST_START();
+		for (i = 0; i < 4; i++) {
+			if ((res[i] = _DoubleBuffer_create(nx, 0)) == NULL)
+				goto exit;
+			bufs[i] = res[i]->p;
+		}
+		if (t0)
+			pack = mcs_hist_now() - t0;
+	}
+
+	if (mcs_step(dem[0], dem[1], dem[2], offset, az, el, recent,
+		     bufs[0], bufs[1], bufs[2], bufs[3],
+		     &self->persistent_pars) == 1)
+	{
+		PyErr_SetString(PyExc_RuntimeError, "TCS has not connected");
+	}
+	else if (out != NULL) {
+		// Recorded as fillBuffer does with out=, though there's little to it
+		t0 = MCS_HIST_START();
+		Py_INCREF(out);
+		ret = out;
+		MCS_HIST_STOP(MCS_HIST_PACK, t0);
+	}
+	else {
+		t0 = MCS_HIST_START();
+		ret = Py_BuildValue("(OOOO)", res[0], res[1], res[2], res[3]);
+		if (t0)
+			mcs_hist_record(MCS_HIST_PACK, pack + mcs_hist_now() - t0);
+	}
+
+exit:
+	if (out != NULL)
+		_mcs_release_out_views(out_views, 4);
+	for (i = 0; i < 4; i++)
+		Py_XDECREF(res[i]);
+
+	return ret;
+}
+
+static char *_mcs_McsParams_step_kwlist[] = {
+	"demand", "offset",
+	"az_pos", "az_vel", "az_max_vel", "az_max_acc",
+	"el_pos", "el_vel", "el_max_vel", "el_max_acc",
+	"az_jump", "el_jump", "recent", "out", NULL
+};
+
+static PyObject *
+_mcs_McsParams_step(_mcs_McsParamsObject *self, PyObject *args, PyObject *kwds) {
+	PyObject *demand;
+	PyObject *out = NULL;
+	double offset;
+	mcs_axis_inputs az = { .jump = AZ_JUMP };
+	mcs_axis_inputs el = { .jump = EL_JUMP };
+	int recent = 0;
+	PyObject *ret;
+	unsigned long long t0 = MCS_HIST_START();
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "Oddddddddd|ddiO", _mcs_McsParams_step_kwlist,
+			&demand, &offset,
+			&az.currentPos, &az.currentVel, &az.maxVel, &az.maxAcc,
+			&el.currentPos, &el.currentVel, &el.maxVel, &el.maxAcc,
+			&az.jump, &el.jump, &recent, &out))
+		return NULL;
+
+	ret = _mcs_McsParams_run_step(self, demand, offset, &az, &el, recent, out);
+	MCS_HIST_STOP(MCS_HIST_STEP, t0);
+
+	return ret;
+}
+
+#ifdef _MCS_FASTCALL
+#define _MCS_STEP_SLOTS 14
+
+static PyObject *
+_mcs_McsParams_step_fast(_mcs_McsParamsObject *self, PyObject *const *args, Py_ssize_t nargs,
+			 PyObject *kwnames) {
+	PyObject *slot[_MCS_STEP_SLOTS];
+	mcs_axis_inputs az = { .jump = AZ_JUMP };
+	mcs_axis_inputs el = { .jump = EL_JUMP };
+	double offset;
+	double *num[11] = {
+		&offset,
+		&az.currentPos, &az.currentVel, &az.maxVel, &az.maxAcc,
+		&el.currentPos, &el.currentVel, &el.maxVel, &el.maxAcc,
+		&az.jump, &el.jump
+	};
+	int recent = 0;
+	int i;
+	PyObject *ret;
+	unsigned long long t0 = MCS_HIST_START();
+
+	if (!_mcs_fast_bind(args, nargs, kwnames, _mcs_McsParams_step_kwlist, slot, _MCS_STEP_SLOTS))
+		goto fallback;
+
+	// demand, offset and the eight axis values are required
+	for (i = 0; i < 10; i++)
+		if (slot[i] == NULL)
+			goto fallback;
+
+	for (i = 0; i < 11; i++)
+		if ((slot[i + 1] != NULL) && !_mcs_fast_double(slot[i + 1], num[i]))
+			goto fallback;
+	if ((slot[12] != NULL) && !_mcs_fast_int(slot[12], &recent))
+		goto fallback;
+
+	ret = _mcs_McsParams_run_step(self, slot[0], offset, &az, &el, recent, slot[13]);
+	MCS_HIST_STOP(MCS_HIST_STEP, t0);
+
+	return ret;
+
+	// The slow path times the call itself
+fallback:
+	return _mcs_fastcall_fallback((PyCFunctionWithKeywords)_mcs_McsParams_step,
+				      (PyObject *)self, args, nargs, kwnames);
+}
+#endif // _MCS_FASTCALL
+
+/*
+ * Runs the limiter stage of step (fit_new_AZ_demand, fit_new_EL_demand)
+ * over a whole series of demands, carrying the state in params exactly as
+ * the same number of calls to step would do. Nothing is fitted or
+ * extrapolated. The GIL is released during the scan, with the instance
+ * busy. If the TCS has not connected at some cycle, RuntimeError is
+ * raised and the state is left as it was before the call.
+ *
+ *   demands - buffer of N*3 doubles: (applyTime, az, el) per cycle
+ *   az_pos, az_max_vel, az_max_acc, el_pos, el_max_vel, el_max_acc
+ *           - either a number or a buffer of N doubles
+ *
+ * Returns (azPos, azVel, elPos, elVel) as DoubleBuffer objects with N
+ * elements (the limited demands, and the velocities they imply), or fills
+ * the four writable buffers passed as out=, and returns it
+ */
+
+#define _MCS_SERIES_COLUMNS 6
+
+static PyObject *
+_mcs_McsParams_limitSeries(_mcs_McsParamsObject *self, PyObject *args, PyObject *kwds) {
+	static char *kwlist[] = {
+		"demands",
+		"az_pos", "az_max_vel", "az_max_acc",
+		"el_pos", "el_max_vel", "el_max_acc",
+		"recent", "out", NULL
+	};
+	static const char *colnames[_MCS_SERIES_COLUMNS] = {
+		"az_pos", "az_max_vel", "az_max_acc",
+		"el_pos", "el_max_vel", "el_max_acc"
+	};
+
+	PyObject *demands_obj;
+	PyObject *colobj[_MCS_SERIES_COLUMNS];
+	_mcs_column col[_MCS_SERIES_COLUMNS];
+	const double *colp[_MCS_SERIES_COLUMNS];
+	double *filled[_MCS_SERIES_COLUMNS] = { NULL, NULL, NULL, NULL, NULL, NULL };
+	Py_buffer demands;
+	Py_buffer out_views[4];
+	PyObject *out = NULL;
+	_DoubleBuffer *res[4] = { NULL, NULL, NULL, NULL };
+	double *bufs[4];
+	mcs_axis_series az, el;
+	mcs_parameters saved;
+	PyObject *ret = NULL;
+	Py_ssize_t n, done;
+	int recent = 0;
+	int c, ncols = 0;
+	int have_out = 0;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "OOOOOOO|iO", kwlist,
+			&demands_obj,
+			&colobj[0], &colobj[1], &colobj[2],
+			&colobj[3], &colobj[4], &colobj[5],
+			&recent, &out))
+		return NULL;
+
+	if (out == Py_None)
+		out = NULL;
+	if (_mcs_params_in_use(self))
+		return NULL;
+
+	if (_mcs_get_double_view(demands_obj, &demands, 0, "demands") == -1)
+		return NULL;
+
+	n = demands.len / sizeof(double);
+	if ((n % 3) != 0) {
+		PyErr_SetString(PyExc_ValueError, "demands must hold (applyTime, az, el) per cycle");
+		goto exit;
+	}
+	n /= 3;
+
+	// The scan wants one element per cycle: numbers are repeated
+	for (ncols = 0; ncols < _MCS_SERIES_COLUMNS; ncols++)
+		if ((colp[ncols] = _mcs_column_array(&col[ncols], colobj[ncols], n,
+						     colnames[ncols], &filled[ncols])) == NULL)
+			goto exit;
+
+	if (out != NULL) {
+		if (_mcs_get_out_views(out, out_views, 4, n) == -1)
+			goto exit;
+		have_out = 1;
+		for (c = 0; c < 4; c++)
+			bufs[c] = out_views[c].buf;
+	}
+	else {
+		for (c = 0; c < 4; c++) {
+			if ((res[c] = _DoubleBuffer_create(n, 0)) == NULL)
+				goto exit;
+			bufs[c] = res[c]->p;
+		}
+	}
+
+	az.currentPos = colp[0];
+	az.maxVel = colp[1];
+	az.maxAcc = colp[2];
+	el.currentPos = colp[3];
+	el.maxVel = colp[4];
+	el.maxAcc = colp[5];
+
+	// Everything but the events, to roll back to on failure
+	memcpy(&saved, &self->persistent_pars, offsetof(mcs_parameters, events));
+
+	self->busy = 1;
+	Py_BEGIN_ALLOW_THREADS
+	done = mcs_limit_series(demands.buf, n, &az, &el, recent,
+				bufs[0], bufs[1], bufs[2], bufs[3],
+				&self->persistent_pars);
+	Py_END_ALLOW_THREADS
+	self->busy = 0;
+
+	if (done < n) {
+		memcpy(&self->persistent_pars, &saved, offsetof(mcs_parameters, events));
+		PyErr_Format(PyExc_RuntimeError, "TCS has not connected (cycle %zd)", done);
+		goto exit;
+	}
+
+	if (have_out) {
+		Py_INCREF(out);
+		ret = out;
+	}
+	else
+		ret = Py_BuildValue("(OOOO)", res[0], res[1], res[2], res[3]);
+
+exit:
+	if (have_out)
+		_mcs_release_out_views(out_views, 4);
+	for (c = 0; c < 4; c++)
+		Py_XDECREF(res[c]);
+	for (c = 0; c < ncols; c++) {
+		_mcs_column_release(&col[c]);
+		free(filled[c]);
+	}
+	PyBuffer_Release(&demands);
+
+	return ret;
+}
+
+/*
+ * Runs step in real time over a series of demands: one cycle every
+ * timeInt seconds, on the monotonic clock, with the calculation made
+ * latency seconds before the trigger. The GIL is released during the run,
+ * with the instance busy.
+ *
+ *   demands - buffer of N*3 doubles: (applyTime, az, el) per cycle
+ *   az_pos, az_max_vel, az_max_acc, el_pos, el_max_vel, el_max_acc
+ *           - either a number or a buffer of N doubles
+ *   latency  - seconds between the calculation and the trigger
+ *   priority - SCHED_FIFO priority to run at (0 keeps the current policy)
+ *   lock     - lock the process memory during the run
+ *   cpu      - CPU to pin the thread to (-1 does not pin)
+ *
+ * Returns a dictionary with the counts (cycles, misses, notConnected), the
+ * summary timings in seconds (maxJitter, meanJitter, maxCompute,
+ * meanCompute, maxLateness) and the per cycle jitter and compute times as
+ * DoubleBuffer objects. Raises OSError if the real-time settings can't be
+ * applied (usually EPERM)
+ */
+
+static PyObject *
+_mcs_McsParams_runPaced(_mcs_McsParamsObject *self, PyObject *args, PyObject *kwds) {
+	static char *kwlist[] = {
+		"demands",
+		"az_pos", "az_max_vel", "az_max_acc",
+		"el_pos", "el_max_vel", "el_max_acc",
+		"latency", "priority", "lock", "cpu", NULL
+	};
+	static const char *colnames[_MCS_SERIES_COLUMNS] = {
+		"az_pos", "az_max_vel", "az_max_acc",
+		"el_pos", "el_max_vel", "el_max_acc"
+	};
+
+	PyObject *demands_obj;
+	PyObject *colobj[_MCS_SERIES_COLUMNS];
+	PyObject *lock_obj = NULL;
+	_mcs_column col[_MCS_SERIES_COLUMNS];
+	const double *colp[_MCS_SERIES_COLUMNS];
+	double *filled[_MCS_SERIES_COLUMNS] = { NULL, NULL, NULL, NULL, NULL, NULL };
+	Py_buffer demands;
+	_DoubleBuffer *jitter = NULL, *compute = NULL;
+	mcs_axis_series az, el;
+	pace_config config;
+	pace_stats stats;
+	PyObject *ret = NULL;
+	Py_ssize_t n;
+	int c, ncols = 0;
+	int err;
+
+	config.latency = TRIGGER_LATENCY;
+	config.priority = 0;
+	config.cpu = -1;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "OOOOOOO|diOi", kwlist,
+			&demands_obj,
+			&colobj[0], &colobj[1], &colobj[2],
+			&colobj[3], &colobj[4], &colobj[5],
+			&config.latency, &config.priority, &lock_obj, &config.cpu))
+		return NULL;
+
+	if ((config.lock = (lock_obj != NULL) ? PyObject_IsTrue(lock_obj) : 0) == -1)
+		return NULL;
+	if (_mcs_params_in_use(self))
+		return NULL;
+
+	if (_mcs_get_double_view(demands_obj, &demands, 0, "demands") == -1)
+		return NULL;
+
+	n = demands.len / sizeof(double);
+	if ((n % 3) != 0) {
+		PyErr_SetString(PyExc_ValueError, "demands must hold (applyTime, az, el) per cycle");
+		goto exit;
+	}
+	n /= 3;
+
+	for (ncols = 0; ncols < _MCS_SERIES_COLUMNS; ncols++)
+		if ((colp[ncols] = _mcs_column_array(&col[ncols], colobj[ncols], n,
+						     colnames[ncols], &filled[ncols])) == NULL)
+			goto exit;
+
+	if (((jitter = _DoubleBuffer_create(n, 0)) == NULL) ||
+	    ((compute = _DoubleBuffer_create(n, 0)) == NULL))
+		goto exit;
+
+	az.currentPos = colp[0];
+	az.maxVel = colp[1];
+	az.maxAcc = colp[2];
+	el.currentPos = colp[3];
+	el.maxVel = colp[4];
+	el.maxAcc = colp[5];
+	stats.jitter = jitter->p;
+	stats.compute = compute->p;
+
+	self->busy = 1;
+	Py_BEGIN_ALLOW_THREADS
+	err = pace_run(demands.buf, n, &az, &el, &config, &stats, &self->persistent_pars);
+	Py_END_ALLOW_THREADS
+	self->busy = 0;
+
+	if (err != 0) {
+		errno = err;
+		PyErr_SetFromErrno(PyExc_OSError);
+		goto exit;
+	}
+
+	ret = Py_BuildValue("{s:l,s:l,s:l,s:d,s:d,s:d,s:d,s:d,s:O,s:O}",
+			    "cycles", stats.cycles,
+			    "misses", stats.misses,
+			    "notConnected", stats.notConnected,
+			    "maxJitter", stats.maxJitter,
+			    "meanJitter", stats.meanJitter,
+			    "maxCompute", stats.maxCompute,
+			    "meanCompute", stats.meanCompute,
+			    "maxLateness", stats.maxLateness,
+			    "jitter", jitter,
+			    "compute", compute);
+
+exit:
+	Py_XDECREF(jitter);
+	Py_XDECREF(compute);
+	for (c = 0; c < ncols; c++) {
+		_mcs_column_release(&col[c]);
+		free(filled[c]);
+	}
+	PyBuffer_Release(&demands);
+
+	return ret;
+}
+
+/*
+ * Runs step on the demands coming through a DemandRing, as they arrive,
+ * with the GIL released: until count demands have been consumed, the
+ * producer has finished, or no demand has come for idle seconds. The mount
+ * is taken to follow perfectly (see ring_follow). Both the instance and
+ * the ring are busy meanwhile.
+ *
+ * Returns a dictionary with the counts (demands, lost, notConnected), the
+ * elapsed time, the mean and max latency from publishing a demand to its
+ * buffers being filled (seconds), and the latency of each demand as a
+ * DoubleBuffer
+ */
+
+static PyObject *
+_mcs_McsParams_followRing(_mcs_McsParamsObject *self, PyObject *args, PyObject *kwds) {
+	static char *kwlist[] = {
+		"ring", "count",
+		"az_max_vel", "az_max_acc", "el_max_vel", "el_max_acc",
+		"idle", NULL
+	};
+
+	_DemandRing *ring;
+	Py_ssize_t count;
+	double idle = 1.0;
+	mcs_axis_inputs az = { .jump = AZ_JUMP };
+	mcs_axis_inputs el = { .jump = EL_JUMP };
+	_DoubleBuffer *latency, *part;
+	ring_stats stats;
+	PyObject *ret;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!ndddd|d", kwlist,
+			&_DemandRingType, &ring, &count,
+			&az.maxVel, &az.maxAcc, &el.maxVel, &el.maxAcc, &idle))
+		return NULL;
+
+	if (count < 0) {
+		PyErr_SetString(PyExc_ValueError, "count must be positive");
+		return NULL;
+	}
+	if (_mcs_params_in_use(self))
+		return NULL;
+	if (ring->busy) {
+		PyErr_SetString(PyExc_RuntimeError, "DemandRing is being consumed by followRing");
+		return NULL;
+	}
+
+	if ((latency = _DoubleBuffer_create(count, 0)) == NULL)
+		return NULL;
+
+	self->busy = 1;
+	ring->busy = 1;
+	Py_BEGIN_ALLOW_THREADS
+	ring_follow(&ring->ring, count, idle, &az, &el, &stats, latency->p,
+		    &self->persistent_pars);
+	Py_END_ALLOW_THREADS
+	ring->busy = 0;
+	self->busy = 0;
+
+	// Only the demands that came
+	if (stats.demands < count) {
+		if ((part = _DoubleBuffer_create(stats.demands, 0)) == NULL) {
+			Py_DECREF(latency);
+			return NULL;
+		}
+		memcpy(part->p, latency->p, stats.demands * sizeof(double));
+		Py_DECREF(latency);
+		latency = part;
+	}
+
+	ret = Py_BuildValue("{s:l,s:l,s:l,s:d,s:d,s:d,s:O}",
+			    "demands", stats.demands,
+			    "lost", stats.lost,
+			    "notConnected", stats.notConnected,
+			    "elapsed", stats.elapsed,
+			    "meanLatency", stats.meanLatency,
+			    "maxLatency", stats.maxLatency,
+			    "latency", latency);
+	Py_DECREF(latency);
+
+	return ret;
+}
+
+/*
+ * Sets dict[name] to a DoubleBuffer with one field of each sweep result,
+ * found at offset in it: a double ('d'), long ('l') or unsigned long ('k')
+ */
+
+static int
+_mcs_sweep_column(PyObject *dict, const char *name, const sweep_result *results,
+		  Py_ssize_t m, size_t offset, char type) {
+	_DoubleBuffer *col;
+	const char *p;
+	Py_ssize_t k;
+	int ret;
+
+	if ((col = _DoubleBuffer_create(m, 0)) == NULL)
+		return -1;
+
+	for (k = 0; k < m; k++) {
+		p = (const char *)&results[k] + offset;
+		if (type == 'd')
+			col->p[k] = *(const double *)p;
+		else if (type == 'l')
+			col->p[k] = *(const long *)p;
+		else
+			col->p[k] = *(const unsigned long *)p;
+	}
+
+	ret = PyDict_SetItemString(dict, name, (PyObject *)col);
+	Py_DECREF(col);
+
+	return ret;
+}
+
+/*
+ * Follows a series of demands once per configuration of the limits, on a
+ * pool of threads (see sweep.c), with the GIL released. Each run starts
+ * from the initial state, with the numExtrap, timeInt and localFit of this
+ * instance, whose own state is left alone.
+ *
+ *   demands - buffer of N*3 doubles: (applyTime, az, el) per cycle
+ *   configs - buffer of M*6 doubles: (az_max_vel, az_max_acc, el_max_vel,
+ *             el_max_acc, jump, offset) per run. offset goes from the
+ *             apply time of a demand to the start of its extrapolation
+ *   threads - threads to use (0: one per CPU)
+ *
+ * Returns {'az': {...}, 'el': {...}, 'compared', 'notConnected',
+ * 'threads'}: per axis, the rms and maximum tracking error ('rms',
+ * 'maxError', in degrees) and the counters (as McsParams.counters), each
+ * as a DoubleBuffer of M elements, as are compared (cycles in the errors)
+ * and notConnected. threads is the number of threads that ran
+ */
+
+static PyObject *
+_mcs_McsParams_sweep(_mcs_McsParamsObject *self, PyObject *args, PyObject *kwds) {
+	static char *kwlist[] = {"demands", "configs", "threads", NULL};
+	static const char *axes[] = {"az", "el"};
+
+	PyObject *demands_obj, *configs_obj;
+	Py_buffer demands, configs;
+	Py_ssize_t n, m;
+	sweep_result *results = NULL;
+	mcs_parameters settings;
+	PyObject *ret = NULL, *axis = NULL;
+	int threads = 0, used, i, j;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO|i", kwlist,
+			&demands_obj, &configs_obj, &threads))
+		return NULL;
+	if (_mcs_params_in_use(self))
+		return NULL;
+
+	if (_mcs_get_double_view(demands_obj, &demands, 0, "demands") == -1)
+		return NULL;
+	if (_mcs_get_double_view(configs_obj, &configs, 0, "configs") == -1) {
+		PyBuffer_Release(&demands);
+		return NULL;
+	}
+
+	n = demands.len / sizeof(double);
+	m = configs.len / sizeof(double);
+	if ((n % 3) != 0) {
+		PyErr_SetString(PyExc_ValueError, "demands must hold (applyTime, az, el) per cycle");
+		goto exit;
+	}
+	if ((m % SWEEP_COLUMNS) != 0) {
+		PyErr_SetString(PyExc_ValueError, "configs must hold (az_max_vel, az_max_acc, "
+				"el_max_vel, el_max_acc, jump, offset) per run");
+		goto exit;
+	}
+	n /= 3;
+	m /= SWEEP_COLUMNS;
+	if (m > 0x7fffffff) {
+		PyErr_SetString(PyExc_ValueError, "Too many configurations");
+		goto exit;
+	}
+
+	if ((results = malloc((m > 0 ? m : 1) * sizeof(sweep_result))) == NULL) {
+		PyErr_NoMemory();
+		goto exit;
+	}
+
+	// Taken with the GIL held: the instance can change meanwhile
+	memcpy(&settings, &self->persistent_pars, offsetof(mcs_parameters, events));
+
+	Py_BEGIN_ALLOW_THREADS
+	used = sweep_run(demands.buf, n, configs.buf, m, &settings, threads, results);
+	Py_END_ALLOW_THREADS
+
+	if ((ret = Py_BuildValue("{s:i}", "threads", used)) == NULL)
+		goto exit;
+
+	if ((_mcs_sweep_column(ret, "compared", results, m, offsetof(sweep_result, compared), 'l') == -1) ||
+	    (_mcs_sweep_column(ret, "notConnected", results, m, offsetof(sweep_result, notConnected), 'l') == -1))
+		goto error;
+
+	for (i = 0; i < 2; i++) {
+		if ((axis = PyDict_New()) == NULL)
+			goto error;
+		if (PyDict_SetItemString(ret, axes[i], axis) == -1)
+			goto error;
+
+		if ((_mcs_sweep_column(axis, "rms", results, m,
+				       offsetof(sweep_result, rms) + i * sizeof(double), 'd') == -1) ||
+		    (_mcs_sweep_column(axis, "maxError", results, m,
+				       offsetof(sweep_result, maxError) + i * sizeof(double), 'd') == -1))
+			goto error;
+		for (j = 0; _mcs_counter_fields[j].name != NULL; j++)
+			if (_mcs_sweep_column(axis, _mcs_counter_fields[j].name, results, m,
+					      offsetof(sweep_result, counters) + i * sizeof(mcs_axis_counters) +
+					      _mcs_counter_fields[j].offset, 'k') == -1)
+				goto error;
+		Py_CLEAR(axis);
+	}
+
+	goto exit;
+
+error:
+	Py_XDECREF(axis);
+	Py_CLEAR(ret);
+exit:
+	free(results);
+	PyBuffer_Release(&configs);
+	PyBuffer_Release(&demands);
+
+	return ret;
+}
+
+/*
+ * Returns the counters (as the "counters" attribute) and sets them all
+ * back to zero
+ */
+
+static PyObject *
+_mcs_McsParams_resetCounters(_mcs_McsParamsObject *self, PyObject *unused) {
+	PyObject *ret;
+
+	if (_mcs_params_in_use(self))
+		return NULL;
+	ret = _mcs_counters_dict(&self->persistent_pars);
+	if (ret != NULL)
+		memset(self->persistent_pars.counters, 0, sizeof(self->persistent_pars.counters));
+
+	return ret;
+}
+
+/*
+ * Returns the events recorded by the follow code since the last call, as
+ * a list of (seq, code, axis, time, value0, value1) tuples, oldest first
+ */
+
+static PyObject *
+_mcs_McsParams_drainEvents(_mcs_McsParamsObject *self, PyObject *unused) {
+	mcs_event events[MCS_EVENT_RING];
+	PyObject *ret, *item;
+	int i, n;
+
+	if ((ret = PyList_New(0)) == NULL)
+		return NULL;
+
+	while ((n = mcs_drain_events(&self->persistent_pars, events, MCS_EVENT_RING)) > 0) {
+		for (i = 0; i < n; i++) {
+			item = Py_BuildValue("(kiiddd)", events[i].seq, events[i].code, events[i].axis,
+					     events[i].time, events[i].values[0], events[i].values[1]);
+			if ((item == NULL) || (PyList_Append(ret, item) == -1)) {
+				Py_XDECREF(item);
+				Py_DECREF(ret);
+				return NULL;
+			}
+			Py_DECREF(item);
+		}
+	}
+
+	return ret;
+}
+
+/*
+ * Returns the follow state as bytes (see mcs_snapshot): everything but
+ * the events, in a few hundred bytes that restore() takes back, in this
+ * or another instance of the same build
+ */
+
+static PyObject *
+_mcs_McsParams_snapshot(_mcs_McsParamsObject *self, PyObject *unused) {
+	PyObject *ret;
+
+	if (_mcs_params_in_use(self))
+		return NULL;
+	if ((ret = PyBytes_FromStringAndSize(NULL, mcs_snapshot_size())) == NULL)
+		return NULL;
+	mcs_snapshot(&self->persistent_pars, (unsigned char *)PyBytes_AS_STRING(ret));
+
+	return ret;
+}
+
+/*
+ * Sets the follow state from a snapshot() (bytes or any buffer). The
+ * pending events are dropped. Raises ValueError if it is not a snapshot of
+ * this build
+ */
+
+static PyObject *
+_mcs_McsParams_restore(_mcs_McsParamsObject *self, PyObject *data) {
+	Py_buffer view;
+	int status;
+
+	if (_mcs_params_in_use(self))
+		return NULL;
+	if (PyObject_GetBuffer(data, &view, PyBUF_SIMPLE) == -1)
+		return NULL;
+	status = mcs_restore(&self->persistent_pars, view.buf, view.len);
+	PyBuffer_Release(&view);
+
+	if (status == -1) {
+		PyErr_SetString(PyExc_ValueError, "Not a snapshot of McsParams (or from another build)");
+		return NULL;
+	}
+
+	Py_RETURN_NONE;
+}
+
+/*
+ * Pickling: McsParams() and its snapshot, restored by __setstate__
+ */
+
+static PyObject *
+_mcs_McsParams_reduce(_mcs_McsParamsObject *self, PyObject *unused) {
+	PyObject *state;
+
+	if ((state = _mcs_McsParams_snapshot(self, NULL)) == NULL)
+		return NULL;
+
+	return Py_BuildValue("(O()N)", (PyObject *)Py_TYPE(self), state);
+}
+
+/*
+ * copy.copy and copy.deepcopy: a new instance with the whole state, the
+ * pending events included
+ */
+
+static PyObject *
+_mcs_McsParams_copy(_mcs_McsParamsObject *self, PyObject *unused) {
+	_mcs_McsParamsObject *copy;
+
+	if (_mcs_params_in_use(self))
+		return NULL;
+	copy = (_mcs_McsParamsObject *)Py_TYPE(self)->tp_alloc(Py_TYPE(self), 0);
+	if (copy == NULL)
+		return NULL;
+	copy->persistent_pars = self->persistent_pars;
+
+	return (PyObject *)copy;
+}
+
+static PyMethodDef _mcs_McsParams_methods[] = {
+#ifdef _MCS_FASTCALL
+	{"step", (PyCFunction)(void (*)(void))_mcs_McsParams_step_fast, METH_FASTCALL | METH_KEYWORDS,
+#else
+	{"step", (PyCFunction)_mcs_McsParams_step, METH_VARARGS | METH_KEYWORDS,
+#endif
+	 "Limit, fit and extrapolate a new demand for both axes"},
+	{"limitSeries", (PyCFunction)_mcs_McsParams_limitSeries, METH_VARARGS | METH_KEYWORDS,
+	 "Run the limiters over a series of demands"},
+	{"runPaced", (PyCFunction)_mcs_McsParams_runPaced, METH_VARARGS | METH_KEYWORDS,
+	 "Run step over a series of demands in real time"},
+	{"followRing", (PyCFunction)_mcs_McsParams_followRing, METH_VARARGS | METH_KEYWORDS,
+	 "Run step on the demands coming through a DemandRing"},
+	{"sweep", (PyCFunction)_mcs_McsParams_sweep, METH_VARARGS | METH_KEYWORDS,
+	 "Follow demands with many configurations of the limits, on many threads"},
+	{"resetCounters", (PyCFunction)_mcs_McsParams_resetCounters, METH_NOARGS,
+	 "Return the hot path counters and set them to zero"},
+	{"drainEvents", (PyCFunction)_mcs_McsParams_drainEvents, METH_NOARGS,
+	 "Return the events recorded since the last call"},
+	{"snapshot", (PyCFunction)_mcs_McsParams_snapshot, METH_NOARGS,
+	 "Return the follow state as bytes"},
+	{"restore", (PyCFunction)_mcs_McsParams_restore, METH_O,
+	 "Set the follow state from a snapshot"},
+	{"__reduce__", (PyCFunction)_mcs_McsParams_reduce, METH_NOARGS, NULL},
+	{"__setstate__", (PyCFunction)_mcs_McsParams_restore, METH_O, NULL},
+	{"__copy__", (PyCFunction)_mcs_McsParams_copy, METH_NOARGS, NULL},
+	{"__deepcopy__", (PyCFunction)_mcs_McsParams_copy, METH_O, NULL},
+	{NULL} // Sentinel
+};
+
+static PyTypeObject _mcs_McsParamsType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	"_mcs.McsParams",
+	sizeof(_mcs_McsParamsObject),
+	0,                         /* tp_itemsize */
+	0,                         /* tp_dealloc */
+	0,                         /* tp_print */
+	0,                         /* tp_getattr */
+	0,                         /* tp_setattr */
+	0,                         /* tp_compare */
+	0,                         /* tp_repr */
+	0,                         /* tp_as_number */
+	0,                         /* tp_as_sequence */
+	0,                         /* tp_as_mapping */
+	0,                         /* tp_hash */
+	0,                         /* tp_call */
+	0,                         /* tp_str */
+	0,                         /* tp_getattro */
+	_mcs_McsParams_setattro,   /* tp_setattro */
+	0,                         /* tp_as_buffer */
+	Py_TPFLAGS_DEFAULT,        /* tp_flags */
+	"MCS Calc Simulation Persistent Parameters",           /* tp_doc */
+	0,                         /* tp_traverse */
+	0,                         /* tp_clear */
+	0,                         /* tp_richcompare */
+	0,                         /* tp_weaklistoffset */
+	0,                         /* tp_iter */
+	0,                         /* tp_iternext */
+	_mcs_McsParams_methods,    /* tp_methods */
+	_mcs_McsParams_members,    /* tp_members */
+	_mcs_McsParams_getsetters, /* tp_getset */
+	0,                         /* tp_base */
+	0,                         /* tp_dict */
+	0,                         /* tp_descr_get */
+	0,                         /* tp_descr_set */
+	0,                         /* tp_dictoffset */
+	(initproc)_mcs_McsParams_init, /* tp_init */
+};
+
+/*
+ * Reads one (time, position) demand for fillBuffer. Tuples of floats, the
+ * common case, are read directly
+ */
+
+static int _mcs_get_demand_pair(PyObject *tuple, double arr[2], int i) {
+	PyObject *item;
+	char *message;
+	int j, ret;
+
+	if (PyTuple_CheckExact(tuple) && (PyTuple_GET_SIZE(tuple) == 2) &&
+	    PyFloat_CheckExact(PyTuple_GET_ITEM(tuple, 0)) &&
+	    PyFloat_CheckExact(PyTuple_GET_ITEM(tuple, 1)))
+	{
+		arr[0] = PyFloat_AS_DOUBLE(PyTuple_GET_ITEM(tuple, 0));
+		arr[1] = PyFloat_AS_DOUBLE(PyTuple_GET_ITEM(tuple, 1));
+		return 0;
+	}
+
+	if (!PySequence_Check(tuple) || (PySequence_Length(tuple) != 2)) {
+		if (asprintf(&message, "Demand #%d is not a 2-element sequence", i) != -1) {
+			PyErr_SetString(PyExc_ValueError, message);
+			free(message);
+		} else {
+			PyErr_SetString(PyExc_ValueError, "One of the demands is not a 2-element sequence");
+		}
+		return -1;
+	}
+
+	for (j = 0; j < 2; j++) {
+		item = PySequence_GetItem(tuple, j);
+		if (item == NULL)
+			return -1;
+		ret = _mcs_set_double(&arr[j], item);
+		Py_DECREF(item);
+		if (ret != 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * fillBuffer, once the arguments have been parsed
+ */
+
+static PyObject *
+_mcs_fillBuffer(_mcs_McsParamsObject *mcs_params, PyObject *dem[3], int axis,
+		double offset, double jump, double max_vel, double max_acc,
+		double curr_pos, double curr_vel, int recent,
+		PyObject *storage, PyObject *out) {
+	double AA[2], BB[2], CC[2];
+	PyObject *ret = NULL;
+
+	if (_mcs_params_in_use(mcs_params))
+		return NULL;
+	if (storage == Py_None)
+		storage = NULL;
+	if (out == Py_None)
+		out = NULL;
+
+	if ((storage != NULL) && (!PyClass_Check(storage))) {
+		PyErr_SetString(PyExc_TypeError, "storage must be a class object");
+		return NULL;
+	}
+	if ((storage != NULL) && (out != NULL)) {
+		PyErr_SetString(PyExc_TypeError, "storage and out are mutually exclusive");
+		return NULL;
+	}
+
+	if ((_mcs_get_demand_pair(dem[0], AA, 0) == -1) ||
+	    (_mcs_get_demand_pair(dem[1], BB, 1) == -1) ||
+	    (_mcs_get_demand_pair(dem[2], CC, 2) == -1))
+		return NULL;
+
+	{
+		double local_pos[MAX_EXTRAP];
+		double local_vel[MAX_EXTRAP];
+		int nx = mcs_params->persistent_pars.numExtrap;
+		double *pos = local_pos, *vel = local_vel;
+		double prevDemand;
+		Py_buffer out_views[2];
+		PyObject *demand_tuple;
+		PyObject *item;
+		unsigned long long t0;
+		int i;
+
+		/* With out=(pos, vel) the extrapolated demands are written
+		 * straight into the caller's buffers and no per-point objects
+		 * are created at all */
+		if (out != NULL) {
+			if (_mcs_get_out_views(out, out_views, 2, nx) == -1)
+				return NULL;
+			pos = out_views[0].buf;
+			vel = out_views[1].buf;
+		}
+
+		if (fillBuffer(AA, BB, CC, pos, vel, offset, axis, &prevDemand, jump,
+			   max_vel, max_acc, curr_pos, curr_vel, 0, recent,
+			   &mcs_params->persistent_pars) == 1)
+		{
 			PyErr_SetString(PyExc_RuntimeError, "TCS has not connected");
+		}
+		else if (out != NULL) {
+			t0 = MCS_HIST_START();
+			ret = Py_BuildValue("(dO)", prevDemand, out);
+			MCS_HIST_STOP(MCS_HIST_PACK, t0);
+		}
+
+		if (out != NULL) {
+			_mcs_release_out_views(out_views, 2);
+			return ret;
+		}
+		if (PyErr_Occurred())
+			return NULL;
+
+		t0 = MCS_HIST_START();
+
+		if ((demand_tuple = PyTuple_New(nx)) == NULL)
+			return NULL;
+		if ((ret = Py_BuildValue("(dN)", prevDemand, demand_tuple)) == NULL) {
+			Py_DECREF(demand_tuple);
+			return NULL;
+		}
+		for (i = 0; i < nx; i++) {
+			if (storage != NULL) {
+				PyObject *args = Py_BuildValue("dd", pos[i], vel[i]);
+
+				item = (args != NULL) ? PyObject_CallObject(storage, args) : NULL;
+				Py_XDECREF(args);
+			}
+			else {
+				item = Py_BuildValue("(dd)", pos[i], vel[i]);
+			}
+			if (item == NULL) {
+				Py_DECREF(ret);
+				return NULL;
+			}
+			PyTuple_SET_ITEM(demand_tuple, i, item);
+		}
+		MCS_HIST_STOP(MCS_HIST_PACK, t0);
+	}
+
+	return ret;
+}
+
+static char *_mcs_fillBuffer_kwlist[] = {
+	"params", "demands", "axis", "offset", "jump", "max_vel", "max_acc",
+	"curr_pos", "curr_vel", "recent", "storage", "out", NULL
+};
+
+static PyObject *
+iface_mcs_sim_fillBuffer(PyObject *self, PyObject *args, PyObject *kwds) {
+	_mcs_McsParamsObject *mcs_params;
+	PyObject *dem[3];
+	int axis;
+	int recent;
+	double offset;
+	double jump;
+	double max_vel, max_acc;
+	double curr_pos, curr_vel;
+	PyObject *storage = NULL;
+	PyObject *out = NULL;
+	PyObject *ret;
+	unsigned long long t0 = MCS_HIST_START();
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!(OOO)iddddddi|OO", _mcs_fillBuffer_kwlist,
+			&_mcs_McsParamsType, &mcs_params,
+			&dem[0], &dem[1], &dem[2],
+			&axis, &offset, &jump,
+			&max_vel, &max_acc,
+			&curr_pos, &curr_vel,
+			&recent, &storage, &out))
+		return NULL;
+
+	ret = _mcs_fillBuffer(mcs_params, dem, axis, offset, jump, max_vel, max_acc,
+			      curr_pos, curr_vel, recent, storage, out);
+	MCS_HIST_STOP(MCS_HIST_FILLBUFFER, t0);
+
+	return ret;
+}
+
+#ifdef _MCS_FASTCALL
+#define _MCS_FILLBUFFER_SLOTS 12
+
+static PyObject *
+iface_mcs_sim_fillBuffer_fast(PyObject *self, PyObject *const *args, Py_ssize_t nargs,
+			      PyObject *kwnames) {
+	PyObject *slot[_MCS_FILLBUFFER_SLOTS];
+	PyObject *dem[3];
+	PyObject *ret;
+	double num[6];
+	int axis, recent;
+	int i;
+	unsigned long long t0 = MCS_HIST_START();
+
+	if (!_mcs_fast_bind(args, nargs, kwnames, _mcs_fillBuffer_kwlist, slot, _MCS_FILLBUFFER_SLOTS))
+		goto fallback;
+
+	// params, demands, axis, the six numbers and recent are required
+	for (i = 0; i < 10; i++)
+		if (slot[i] == NULL)
+			goto fallback;
+
+	if (!PyObject_TypeCheck(slot[0], &_mcs_McsParamsType))
+		goto fallback;
+	if (PyTuple_CheckExact(slot[1]) && (PyTuple_GET_SIZE(slot[1]) == 3)) {
+		for (i = 0; i < 3; i++)
+			dem[i] = PyTuple_GET_ITEM(slot[1], i);
+	}
+	else if (PyList_CheckExact(slot[1]) && (PyList_GET_SIZE(slot[1]) == 3)) {
+		for (i = 0; i < 3; i++)
+			dem[i] = PyList_GET_ITEM(slot[1], i);
+	}
+	else
+		goto fallback;
+
+	if (!_mcs_fast_int(slot[2], &axis) || !_mcs_fast_int(slot[9], &recent))
+		goto fallback;
+	for (i = 0; i < 6; i++)
+		if (!_mcs_fast_double(slot[3 + i], &num[i]))
+			goto fallback;
+
+	ret = _mcs_fillBuffer((_mcs_McsParamsObject *)slot[0], dem, axis,
+			      num[0], num[1], num[2], num[3], num[4], num[5],
+			      recent, slot[10], slot[11]);
+	MCS_HIST_STOP(MCS_HIST_FILLBUFFER, t0);
+
+	return ret;
+
+	// The slow path times the call itself
+fallback:
+	return _mcs_fastcall_fallback(iface_mcs_sim_fillBuffer, self, args, nargs, kwnames);
+}
+#endif // _MCS_FASTCALL
+
+/*
+ * Batch version of fillBuffer. Runs the extrapolation for a whole series of
+ * demand triples in one call, carrying the persistent parameters from one
+ * cycle to the next, exactly as the same number of calls to fillBuffer
+ * would do.
+ *
+ *   demands - buffer of N*6 doubles: (tA, pA, tB, pB, tC, pC) per cycle
+ *   offset, jump, max_vel, max_acc, curr_pos, curr_vel
+ *           - either a number or a buffer of N doubles
+ *
+ * Returns a (pos, vel) tuple of DoubleBuffer objects, shaped N x numExtrap,
+ * or fills the writable (pos, vel) buffers passed as out=, and returns it.
+ * If the TCS has not connected at some cycle, RuntimeError is raised and
+ * the state is left as it was before the call (as limitSeries does)
+ */
+
+#define _MCS_BATCH_COLUMNS 6
+
+static PyObject *
+iface_mcs_sim_fillBufferBatch(PyObject *self, PyObject *args, PyObject *kwds) {
+	static char *kwlist[] = {
+		"params", "demands", "axis", "offset", "jump", "max_vel", "max_acc",
+		"curr_pos", "curr_vel", "recent", "out", NULL
+	};
+	static const char *colnames[_MCS_BATCH_COLUMNS] = {
+		"offset", "jump", "max_vel", "max_acc", "curr_pos", "curr_vel"
+	};
+
+	_mcs_McsParamsObject *mcs_params;
+	PyObject *demands_obj;
+	PyObject *colobj[_MCS_BATCH_COLUMNS];
+	_mcs_column col[_MCS_BATCH_COLUMNS];
+	Py_buffer demands;
+	Py_buffer out_views[2];
+	PyObject *out = NULL;
+	_DoubleBuffer *pos = NULL, *vel = NULL;
+	double *pos_p, *vel_p;
+	mcs_parameters saved;
+	PyObject *ret = NULL;
+	Py_ssize_t n, i;
+	int axis;
+	int recent;
+	int c, ncols = 0;
+	int have_out = 0;
+	int nx;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!OiOOOOOOi|O", kwlist,
+			&_mcs_McsParamsType, &mcs_params,
+			&demands_obj, &axis,
+			&colobj[0], &colobj[1], &colobj[2],
+			&colobj[3], &colobj[4], &colobj[5],
+			&recent, &out))
+		return NULL;
+
+	if (_mcs_params_in_use(mcs_params))
+		return NULL;
+	if (out == Py_None)
+		out = NULL;
+
+	nx = mcs_params->persistent_pars.numExtrap;
+	if (_mcs_get_double_view(demands_obj, &demands, 0, "demands") == -1)
+		return NULL;
+
+	n = demands.len / sizeof(double);
+	if ((n % 6) != 0) {
+		PyErr_SetString(PyExc_ValueError, "demands must hold (time, pos) pairs for 3 demands per cycle");
+		goto exit;
+	}
+	n /= 6;
+
+	for (ncols = 0; ncols < _MCS_BATCH_COLUMNS; ncols++) {
+		if (_mcs_column_init(&col[ncols], colobj[ncols], n, colnames[ncols]) == -1)
+			goto exit;
+	}
+
+	if (out != NULL) {
+		if (_mcs_get_out_views(out, out_views, 2, n * nx) == -1)
+			goto exit;
+		have_out = 1;
+		pos_p = out_views[0].buf;
+		vel_p = out_views[1].buf;
+	}
+	else {
+		if (((pos = _DoubleBuffer_create(n, nx)) == NULL) ||
+		    ((vel = _DoubleBuffer_create(n, nx)) == NULL))
+			goto exit;
+		pos_p = pos->p;
+		vel_p = vel->p;
+	}
+
+	// Everything but the events, to roll back to on failure
+	memcpy(&saved, &mcs_params->persistent_pars, offsetof(mcs_parameters, events));
+
+	for (i = 0; i < n; i++) {
+		double *dem = (double *)demands.buf + i * 6;
+		double prevDemand;
+
+		if (fillBuffer(&dem[0], &dem[2], &dem[4],
+			       &pos_p[i * nx], &vel_p[i * nx],
+			       _MCS_COLUMN_AT(col[0], i), axis, &prevDemand,
+			       _MCS_COLUMN_AT(col[1], i),
+			       _MCS_COLUMN_AT(col[2], i), _MCS_COLUMN_AT(col[3], i),
+			       _MCS_COLUMN_AT(col[4], i), _MCS_COLUMN_AT(col[5], i),
+			       0, recent, &mcs_params->persistent_pars) == 1)
+		{
+			memcpy(&mcs_params->persistent_pars, &saved, offsetof(mcs_parameters, events));
+			PyErr_Format(PyExc_RuntimeError, "TCS has not connected (cycle %zd)", i);
+			goto exit;
+		}
+	}
+
+	if (have_out) {
+		Py_INCREF(out);
+		ret = out;
+	}
+	else
+		ret = Py_BuildValue("(OO)", pos, vel);
+
+exit:
+	if (have_out)
+		_mcs_release_out_views(out_views, 2);
+	Py_XDECREF(pos);
+	Py_XDECREF(vel);
+	for (c = 0; c < ncols; c++)
+		_mcs_column_release(&col[c]);
+	PyBuffer_Release(&demands);
+
+	return ret;
+}
+
+/*
+ * Evaluates the coefficients currently stored in params for both axes in
+ * a single pass of the extrapolation kernel (in the frame of azOrigin and
+ * elOrigin; offset is an absolute time).
+ *
+ * Returns (azPos, azVel, elPos, elVel) as DoubleBuffer objects, or fills the
+ * four writable buffers passed as out=, and returns it
+ */
+
+static PyObject *
+iface_mcs_sim_extrapolate(PyObject *self, PyObject *args, PyObject *kwds) {
+	static char *kwlist[] = { "params", "offset", "out", NULL };
+
+	_mcs_McsParamsObject *mcs_params;
+	mcs_parameters *p;
+	double offset;
+	double *bufs[4];
+	_DoubleBuffer *res[4] = { NULL, NULL, NULL, NULL };
+	Py_buffer out_views[4];
+	PyObject *out = NULL;
+	PyObject *ret = NULL;
+	int i;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!d|O", kwlist,
+			&_mcs_McsParamsType, &mcs_params, &offset, &out))
+		return NULL;
+
+	if (_mcs_params_in_use(mcs_params))
+		return NULL;
+	if (out == Py_None)
+		out = NULL;
+
+	p = &mcs_params->persistent_pars;
+	if (out != NULL) {
+		if (_mcs_get_out_views(out, out_views, 4, p->numExtrap) == -1)
+			return NULL;
+		for (i = 0; i < 4; i++)
+			bufs[i] = out_views[i].buf;
+	}
+	else {
+		for (i = 0; i < 4; i++) {
+			if ((res[i] = _DoubleBuffer_create(p->numExtrap, 0)) == NULL)
+				goto exit;
+			bufs[i] = res[i]->p;
+		}
+	}
+
+	mcs_extrapolate(offset, bufs[0], bufs[1], bufs[2], bufs[3], p);
+
+	if (out != NULL) {
+		_mcs_release_out_views(out_views, 4);
+		Py_INCREF(out);
+		return out;
+	}
+
+	ret = Py_BuildValue("(OOOO)", res[0], res[1], res[2], res[3]);
+
+exit:
+	for (i = 0; i < 4; i++)
+		Py_XDECREF(res[i]);
+
+	return ret;
+}
+
+/*
+ * Returns the name of the extrapolation kernel in use ("scalar", "sse2",
+ * "avx2"). If a name is passed, that kernel is selected first (or the best
+ * one below it that the CPU supports)
+ */
+
+static PyObject *
+iface_mcs_sim_extrapolationKernel(PyObject *self, PyObject *args) {
+	const char *name = NULL;
+	int level;
+
+	if (!PyArg_ParseTuple(args, "|s", &name))
+		return NULL;
+
+	if (name != NULL) {
+		for (level = EXTRAP_SCALAR; level <= EXTRAP_AVX2; level++)
+			if (strcmp(name, extrapolate_level_name(level)) == 0)
+				break;
+		if (level > EXTRAP_AVX2) {
+			PyErr_Format(PyExc_ValueError, "Unknown kernel '%s'", name);
+			return NULL;
+		}
+		extrapolate_set_level(level);
+	}
+
+	return PyString_FromString(extrapolate_level_name(extrapolate_level()));
+}
+
+/*
+ * Limiter state for n independent scenarios, as used by limitDemands: a
+ * 5 x n DoubleBuffer holding prevDemandA, prevDemandB, prevDemandC, prevVel
+ * and first (non zero until the first demand) for each scenario
+ */
+
+#define _MCS_LIMIT_STATE_ROWS 5
+
+static PyObject *
+iface_mcs_sim_limiterState(PyObject *self, PyObject *args) {
+	_DoubleBuffer *state;
+	Py_ssize_t n, i;
+
+	if (!PyArg_ParseTuple(args, "n", &n))
+		return NULL;
+
+	if (n < 0) {
+		PyErr_SetString(PyExc_ValueError, "The number of scenarios can't be negative");
+		return NULL;
+	}
+
+	if ((state = _DoubleBuffer_create(_MCS_LIMIT_STATE_ROWS, n)) == NULL)
+		return NULL;
+
+	memset(state->p, 0, _MCS_LIMIT_STATE_ROWS * n * sizeof(double));
+	for (i = 0; i < n; i++)
+		state->p[(_MCS_LIMIT_STATE_ROWS - 1) * n + i] = 1.0;
+
+	return (PyObject *)state;
+}
+
+/*
+ * Runs the velocity/acceleration limiter (fit_new_AZ_demand) for one cycle
+ * of n independent scenarios, several of them at once (see limit.c).
+ *
+ *   times     - buffer of 3*n doubles: timeA, timeB and timeC rows
+ *   positions - writable buffer of 3*n doubles, same layout. The demands
+ *               are limited in place
+ *   max_vel, max_acc, curr_pos
+ *             - either a number or a buffer of n doubles
+ *   state     - writable buffer of 5*n doubles (see limiterState)
+ *   status    - optional writable buffer of n doubles, set to 0 or -1 (as
+ *               returned by fit_new_AZ_demand) for each scenario
+ *
+ * Returns the number of scenarios with a -1 status
+ */
+
+#define _MCS_LIMIT_COLUMNS 3
+
+static PyObject *
+iface_mcs_sim_limitDemands(PyObject *self, PyObject *args, PyObject *kwds) {
+	static char *kwlist[] = {
+		"times", "positions", "max_vel", "max_acc", "curr_pos", "state",
+		"status", NULL
+	};
+	static const char *colnames[_MCS_LIMIT_COLUMNS] = {
+		"max_vel", "max_acc", "curr_pos"
+	};
+
+	PyObject *times_obj, *positions_obj, *state_obj;
+	PyObject *status_obj = NULL;
+	PyObject *colobj[_MCS_LIMIT_COLUMNS];
+	_mcs_column col[_MCS_LIMIT_COLUMNS];
+	double *colp[_MCS_LIMIT_COLUMNS] = { NULL, NULL, NULL };
+	double *filled[_MCS_LIMIT_COLUMNS] = { NULL, NULL, NULL };
+	Py_buffer times, positions, state, status;
+	int have_positions = 0, have_state = 0, have_status = 0;
+	limit_state ls;
+	limit_inputs in;
+	PyObject *ret = NULL;
+	Py_ssize_t n;
+	int c, k, ncols = 0;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "OOOOOO|O", kwlist,
+			&times_obj, &positions_obj,
+			&colobj[0], &colobj[1], &colobj[2],
+			&state_obj, &status_obj))
+		return NULL;
+
+	if (status_obj == Py_None)
+		status_obj = NULL;
+
+	if (_mcs_get_double_view(times_obj, &times, 0, "times") == -1)
+		return NULL;
+
+	n = times.len / sizeof(double);
+	if ((n % 3) != 0) {
+		PyErr_SetString(PyExc_ValueError, "times must hold 3 rows of demand times");
+		goto exit;
+	}
+	n /= 3;
+	if (n > INT_MAX) {
+		PyErr_SetString(PyExc_ValueError, "Too many scenarios");
+		goto exit;
+	}
+
+	if (_mcs_get_double_view(positions_obj, &positions, 1, "positions") == -1)
+		goto exit;
+	have_positions = 1;
+	if ((positions.len / (Py_ssize_t)sizeof(double)) != 3 * n) {
+		PyErr_Format(PyExc_ValueError, "positions must have exactly %zd elements", 3 * n);
+		goto exit;
+	}
+
+	if (_mcs_get_double_view(state_obj, &state, 1, "state") == -1)
+		goto exit;
+	have_state = 1;
+	if ((state.len / (Py_ssize_t)sizeof(double)) != _MCS_LIMIT_STATE_ROWS * n) {
+		PyErr_Format(PyExc_ValueError, "state must have exactly %zd elements",
+			     _MCS_LIMIT_STATE_ROWS * n);
+		goto exit;
+	}
+
+	if (status_obj != NULL) {
+		if (_mcs_get_double_view(status_obj, &status, 1, "status") == -1)
+			goto exit;
+		have_status = 1;
+		if ((status.len / (Py_ssize_t)sizeof(double)) != n) {
+			PyErr_Format(PyExc_ValueError, "status must have exactly %zd elements", n);
+			goto exit;
+		}
+	}
+
+	// The kernels want one element per scenario: numbers are repeated
+	for (ncols = 0; ncols < _MCS_LIMIT_COLUMNS; ncols++)
+		if ((colp[ncols] = _mcs_column_array(&col[ncols], colobj[ncols], n,
+						     colnames[ncols], &filled[ncols])) == NULL)
+			goto exit;
+
+	for (k = 0; k < 3; k++) {
+		in.time[k] = (double *)times.buf + k * n;
+		in.pos[k] = (double *)positions.buf + k * n;
+		ls.prevDemand[k] = (double *)state.buf + k * n;
+	}
+	in.maxVel = colp[0];
+	in.maxAcc = colp[1];
+	in.currentPos = colp[2];
+	ls.prevVel = (double *)state.buf + 3 * n;
+	ls.first = (double *)state.buf + 4 * n;
+
+	ret = PyInt_FromLong(limit_demands(&ls, &in, (int)n,
+					   have_status ? (double *)status.buf : NULL));
+
+exit:
+	for (c = 0; c < ncols; c++) {
+		_mcs_column_release(&col[c]);
+		free(filled[c]);
+	}
+	if (have_status)
+		PyBuffer_Release(&status);
+	if (have_state)
+		PyBuffer_Release(&state);
+	if (have_positions)
+		PyBuffer_Release(&positions);
+	PyBuffer_Release(&times);
+
+	return ret;
+}
+
+/*
+ * Returns the name of the limiter kernel in use ("scalar", "avx2",
+ * "avx512"). If a name is passed, that kernel is selected first (or the
+ * best one below it that the CPU supports)
+ */
+
+static PyObject *
+iface_mcs_sim_limiterKernel(PyObject *self, PyObject *args) {
+	const char *name = NULL;
+	int level;
+
+	if (!PyArg_ParseTuple(args, "|s", &name))
+		return NULL;
+
+	if (name != NULL) {
+		for (level = LIMIT_SCALAR; level <= LIMIT_AVX512; level++)
+			if (strcmp(name, limit_level_name(level)) == 0)
+				break;
+		if (level > LIMIT_AVX512) {
+			PyErr_Format(PyExc_ValueError, "Unknown kernel '%s'", name);
+			return NULL;
+		}
+		limit_set_level(level);
+	}
+
+	return PyString_FromString(limit_level_name(limit_level()));
+}
+
+/*
+ * Fits calc_quadratic (or calc_linear) to N demand triples at once (see
+ * coeffs.c). The GIL is released during the fits.
+ *
+ *   ta, pa, tb, pb, tc, pc
+ *           - buffers of N doubles: the times and positions of the triples
+ *
+ * Returns (c0, c1, c2, status) as DoubleBuffer objects with N elements.
+ * status is 0, or -1 for the singular cases (two or more equal times),
+ * whose coefficients are NaN. The four writable buffers can be passed as
+ * out= instead, and are returned; the coefficients of the singular cases
+ * are left untouched there
+ */
+
+static PyObject *
+_mcs_calc_coeffs(PyObject *args, PyObject *kwds, int linear) {
+	static char *kwlist[] = { "ta", "pa", "tb", "pb", "tc", "pc", "out", NULL };
+
+	PyObject *obj[6];
+	PyObject *out = NULL;
+	Py_buffer views[6];
+	Py_buffer out_views[4];
+	_DoubleBuffer *res[4] = { NULL, NULL, NULL, NULL };
+	double *bufs[4];
+	coeffs_inputs in;
+	coeffs_outputs co;
+	PyObject *ret = NULL;
+	Py_ssize_t n = 0, i;
+	int c, nviews = 0;
+	int have_out = 0;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "OOOOOO|O", kwlist,
+			&obj[0], &obj[1], &obj[2], &obj[3], &obj[4], &obj[5], &out))
+		return NULL;
+
+	if (out == Py_None)
+		out = NULL;
+
+	for (nviews = 0; nviews < 6; nviews++) {
+		if (_mcs_get_double_view(obj[nviews], &views[nviews], 0, kwlist[nviews]) == -1)
+			goto exit;
+		if (nviews == 0)
+			n = views[0].len / sizeof(double);
+		else if ((views[nviews].len / (Py_ssize_t)sizeof(double)) != n) {
+			PyErr_Format(PyExc_ValueError, "%s must have exactly %zd elements", kwlist[nviews], n);
+			nviews++;
+			goto exit;
+		}
+	}
+
+	if (out != NULL) {
+		if (_mcs_get_out_views(out, out_views, 4, n) == -1)
+			goto exit;
+		have_out = 1;
+		for (c = 0; c < 4; c++)
+			bufs[c] = out_views[c].buf;
+	}
+	else {
+		for (c = 0; c < 4; c++) {
+			if ((res[c] = _DoubleBuffer_create(n, 0)) == NULL)
+				goto exit;
+			bufs[c] = res[c]->p;
+		}
+		for (c = 0; c < 3; c++)
+			for (i = 0; i < n; i++)
+				bufs[c][i] = Py_NAN;
+	}
+
+	for (c = 0; c < 3; c++) {
+		in.time[c] = views[2 * c].buf;
+		in.pos[c] = views[2 * c + 1].buf;
+		co.c[c] = bufs[c];
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	if (linear)
+		coeffs_linear(&in, n, &co, bufs[3]);
+	else
+		coeffs_quadratic(&in, n, &co, bufs[3]);
+	Py_END_ALLOW_THREADS
+
+	if (have_out) {
+		Py_INCREF(out);
+		ret = out;
+	}
+	else
+		ret = Py_BuildValue("(OOOO)", res[0], res[1], res[2], res[3]);
+
+exit:
+	if (have_out)
+		_mcs_release_out_views(out_views, 4);
+	for (c = 0; c < 4; c++)
+		Py_XDECREF(res[c]);
+	for (c = 0; c < nviews; c++)
+		PyBuffer_Release(&views[c]);
+
+	return ret;
+}
+
+static PyObject *
+iface_mcs_sim_calcQuadratic(PyObject *self, PyObject *args, PyObject *kwds) {
+	return _mcs_calc_coeffs(args, kwds, 0);
+}
+
+static PyObject *
+iface_mcs_sim_calcLinear(PyObject *self, PyObject *args, PyObject *kwds) {
+	return _mcs_calc_coeffs(args, kwds, 1);
+}
+
+/*
+ * Returns the name of the fit kernel in use (calcQuadratic, calcLinear):
+ * "scalar", "avx2", "avx512". If a name is passed, that kernel is selected
+ * first (or the best one below it that the CPU supports)
+ */
+
+static PyObject *
+iface_mcs_sim_fitKernel(PyObject *self, PyObject *args) {
+	const char *name = NULL;
+	int level;
+
+	if (!PyArg_ParseTuple(args, "|s", &name))
+		return NULL;
+
+	if (name != NULL) {
+		for (level = COEFFS_SCALAR; level <= COEFFS_AVX512; level++)
+			if (strcmp(name, coeffs_level_name(level)) == 0)
+				break;
+		if (level > COEFFS_AVX512) {
+			PyErr_Format(PyExc_ValueError, "Unknown kernel '%s'", name);
+			return NULL;
+		}
+		coeffs_set_level(level);
+	}
+
+	return PyString_FromString(coeffs_level_name(coeffs_level()));
+}
+
+/*
+ * Generates a synthetic stream of TCS demands (see traj.c), ready for
+ * limitSeries and runPaced. The GIL is released meanwhile.
+ *
+ *   kind     - "sidereal", "slew" or "zenith"
+ *   count    - cycles, at rate demands per second from applyTime start
+ *   latitude, dec, hour_angle (hours), miss
+ *            - the star, and its zenith distance at transit ("zenith").
+ *              NaN leaves the default of the kind
+ *   slew, dwell
+ *            - size of the hops, and seconds between them ("slew")
+ *   duplicates, reorder, dropouts
+ *            - probability per demand of a repeated apply time, of a swap
+ *              with the previous demand and of a dropout starting
+ *   dropout_length
+ *            - mean length of the dropouts, in seconds
+ *   seed     - of the glitches and hops
+ *
+ * Returns an N x 3 DoubleBuffer of (applyTime, az, el), N being count less
+ * the demands lost in dropouts
+ */
+
+static PyObject *
+iface_mcs_sim_generateDemands(PyObject *self, PyObject *args, PyObject *kwds) {
+	static char *kwlist[] = {
+		"kind", "count", "rate", "start",
+		"latitude", "dec", "hour_angle", "miss", "slew", "dwell",
+		"duplicates", "reorder", "dropouts", "dropout_length", "seed", NULL
+	};
+
+	const char *name;
+	Py_ssize_t count;
+	traj_config cfg;
+	_DoubleBuffer *res;
+	long n;
+	int kind;
+
+	traj_defaults(&cfg, TRAJ_SIDEREAL);
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "sn|ddddddddddddK", kwlist,
+			&name, &count, &cfg.rate, &cfg.start,
+			&cfg.latitude, &cfg.dec, &cfg.hourAngle, &cfg.miss,
+			&cfg.slew, &cfg.dwell,
+			&cfg.duplicates, &cfg.reorder, &cfg.dropouts, &cfg.dropLength,
+			&cfg.seed))
+		return NULL;
+
+	for (kind = 0; kind < TRAJ_KINDS; kind++)
+		if (strcmp(name, traj_kind_name(kind)) == 0)
+			break;
+	if (kind == TRAJ_KINDS) {
+		PyErr_Format(PyExc_ValueError, "Unknown trajectory '%s'", name);
+		return NULL;
+	}
+	cfg.kind = kind;
+
+	if (count < 0) {
+		PyErr_SetString(PyExc_ValueError, "count must be positive");
+		return NULL;
+	}
+	if (!(cfg.rate > 0.0) || !(cfg.dwell >= 0.0) || !(cfg.dropLength >= 0.0)) {
+		PyErr_SetString(PyExc_ValueError, "rate, dwell and dropout_length must be positive");
+		return NULL;
+	}
+	if (!((cfg.duplicates >= 0.0) && (cfg.duplicates <= 1.0)) ||
+	    !((cfg.reorder >= 0.0) && (cfg.reorder <= 1.0)) ||
+	    !((cfg.dropouts >= 0.0) && (cfg.dropouts <= 1.0))) {
+		PyErr_SetString(PyExc_ValueError, "probabilities must be between 0 and 1");
+		return NULL;
+	}
+
+	if ((res = _DoubleBuffer_create(count, 3)) == NULL)
+		return NULL;
+
+	Py_BEGIN_ALLOW_THREADS
+	n = traj_generate(&cfg, count, res->p);
+	Py_END_ALLOW_THREADS
+
+	// The rows after n are not exposed
+	res->shape[0] = n;
+
+	return (PyObject *)res;
+}
+
+/*
+ * Returns whether the hot calls are being timed into the latency
+ * histograms. If a value is passed, timing is first turned on or off
+ */
+
+static PyObject *
+iface_mcs_sim_timeLatencies(PyObject *self, PyObject *args) {
+	PyObject *enable = NULL;
+	int on;
+
+	if (!PyArg_ParseTuple(args, "|O", &enable))
+		return NULL;
+
+	if (enable != NULL) {
+		if ((on = PyObject_IsTrue(enable)) == -1)
+			return NULL;
+		mcs_hist_enabled = on;
+	}
+
+	return PyBool_FromLong(mcs_hist_enabled);
+}
+
+/*
+ * Finds a histogram by name. Sets an exception if there is none
+ */
+
+static int _mcs_hist_lookup(const char *name) {
+	int id;
+
+	for (id = 0; id < MCS_HIST_COUNT; id++)
+		if (strcmp(name, mcs_hist_name(id)) == 0)
+			return id;
+
+	PyErr_Format(PyExc_ValueError, "Unknown histogram '%s'", name);
+	return -1;
+}
+
+/*
+ * Returns the latency summary of every timed call, as a dictionary of
+ * {name: {'count', 'min', 'mean', 'max', 'p50', 'p99', 'p99.9'}}, with
+ * the times in seconds (within 1/64 for the percentiles). The names are
+ * fillBuffer, step (the whole calls), limit, fit, extrap (their stages)
+ * and pack (building the results)
+ */
+
+static PyObject *
+iface_mcs_sim_latencies(PyObject *self, PyObject *unused) {
+	static mcs_hist h;
+	PyObject *ret, *item;
+	int id;
+
+	if ((ret = PyDict_New()) == NULL)
+		return NULL;
+
+	for (id = 0; id < MCS_HIST_COUNT; id++) {
+		mcs_hist_snapshot(id, &h);
+		item = Py_BuildValue("{s:K,s:d,s:d,s:d,s:d,s:d,s:d}",
+				     "count", h.count,
+				     "min", (h.count > 0) ? h.min * 1e-9 : 0.0,
+				     "mean", (h.count > 0) ? (double)h.sum / h.count * 1e-9 : 0.0,
+				     "max", h.max * 1e-9,
+				     "p50", mcs_hist_percentile(&h, 50.0) * 1e-9,
+				     "p99", mcs_hist_percentile(&h, 99.0) * 1e-9,
+				     "p99.9", mcs_hist_percentile(&h, 99.9) * 1e-9);
+		if ((item == NULL) || (PyDict_SetItemString(ret, mcs_hist_name(id), item) == -1)) {
+			Py_XDECREF(item);
+			Py_DECREF(ret);
+			return NULL;
+		}
+		Py_DECREF(item);
+	}
+
+	return ret;
+}
+
+/*
+ * Returns the histogram of one timed call (see latencies), as a list of
+ * (seconds, count) for the non empty buckets, seconds being the highest
+ * latency that goes to the bucket
+ */
+
+static PyObject *
+iface_mcs_sim_latencyHistogram(PyObject *self, PyObject *args) {
+	static mcs_hist h;
+	const char *name;
+	PyObject *ret, *item;
+	int id, i;
+
+	if (!PyArg_ParseTuple(args, "s", &name))
+		return NULL;
+	if ((id = _mcs_hist_lookup(name)) == -1)
+		return NULL;
+
+	if ((ret = PyList_New(0)) == NULL)
+		return NULL;
+
+	mcs_hist_snapshot(id, &h);
+	for (i = 0; i < MCS_HIST_BUCKETS; i++) {
+		if (h.bucket[i] == 0)
+			continue;
+		item = Py_BuildValue("(dK)", mcs_hist_bucket_value(i) * 1e-9, h.bucket[i]);
+		if ((item == NULL) || (PyList_Append(ret, item) == -1)) {
+			Py_XDECREF(item);
+			Py_DECREF(ret);
 			return NULL;
 		}
+		Py_DECREF(item);
+	}
 
-		/* TODO: Check for errors in the following code... */
-		ret = PyTuple_New(2);
-		demand_tuple = PyTuple_New(NUM_EXTRAP);
-		PyTuple_SET_ITEM(ret, 0, Py_BuildValue("d", prevDemand));
-		PyTuple_SET_ITEM(ret, 1, demand_tuple);
-		for (i = 0; i < NUM_EXTRAP; i++) {
-			if (storage != NULL) {
-				PyObject *args = Py_BuildValue("dd", pos[i], vel[i]);
-				item = PyObject_CallObject(storage, args);
-				Py_DECREF(args);
-			}
-			else {
-				item = Py_BuildValue("(dd)", pos[i], vel[i]);
+	return ret;
+}
+
+/*
+ * Empties the latency histograms: all of them, or the one named
+ */
+
+static PyObject *
+iface_mcs_sim_resetLatencies(PyObject *self, PyObject *args) {
+	const char *name = NULL;
+	int id;
+
+	if (!PyArg_ParseTuple(args, "|s", &name))
+		return NULL;
+
+	if (name != NULL) {
+		if ((id = _mcs_hist_lookup(name)) == -1)
+			return NULL;
+		mcs_hist_reset(id);
+	}
+	else {
+		for (id = 0; id < MCS_HIST_COUNT; id++)
+			mcs_hist_reset(id);
+	}
+
+	Py_RETURN_NONE;
+}
+
+/*
+ * Streaming reader for the telemetry logs: parses the lines coming from
+ * an iterable and expands the "Repeat N" lines (see logrows.c), yielding
+ * (microseconds, value, ...) tuples
+ */
+
+typedef struct {
+	PyObject_HEAD
+	PyObject *source;
+	int finished;
+	repeat_expander exp;
+} _LogReader;
+
+static PyObject *
+_LogReader_new(PyTypeObject *type, PyObject *args, PyObject *kwds) {
+	static char *kwlist[] = {"lines", "cols", "period", "periods", NULL};
+	PyObject *lines;
+	int cols;
+	double period = 0.0;
+	long long periods = 0;
+	_LogReader *self;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "Oi|dL", kwlist, &lines, &cols,
+			&period, &periods))
+		return NULL;
+
+	if ((cols < 0) || (cols > MAX_LOG_COLS)) {
+		PyErr_Format(PyExc_ValueError, "cols must be between 0 and %d", MAX_LOG_COLS);
+		return NULL;
+	}
+
+	self = (_LogReader *)type->tp_alloc(type, 0);
+	if (self == NULL)
+		return NULL;
+
+	self->source = PyObject_GetIter(lines);
+	if (self->source == NULL) {
+		Py_DECREF(self);
+		return NULL;
+	}
+	self->finished = 0;
+	repeat_init(&self->exp, cols);
+	self->exp.cma_avg = period;
+	self->exp.cma_n = (long)periods;
+
+	return (PyObject *)self;
+}
+
+static void
+_LogReader_dealloc(_LogReader *self) {
+	Py_XDECREF(self->source);
+	Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+/* Text of a line. Files opened in text mode give str lines on both
+ * Pythons, binary ones give bytes on Python 3
+ */
+static int
+_mcs_line_text(PyObject *line, const char **text, Py_ssize_t *len) {
+#if PY_MAJOR_VERSION >= 3
+	if (PyBytes_Check(line))
+		return PyBytes_AsStringAndSize(line, (char **)text, len);
+
+	*text = PyUnicode_AsUTF8AndSize(line, len);
+	return (*text != NULL) ? 0 : -1;
+#else
+	return PyString_AsStringAndSize(line, (char **)text, len);
+#endif
+}
+
+/* Feeds lines to the expander until it has a row ready. Returns 1 if
+ * there is one, 0 at the end of the log, -1 on error
+ */
+static int
+_LogReader_fill(_LogReader *self, long long *t, const double **values) {
+	PyObject *line;
+	const char *text;
+	Py_ssize_t len;
+	log_row row;
+	int status;
+
+	while (!repeat_next(&self->exp, t, values)) {
+		if (self->finished)
+			return 0;
+
+		line = PyIter_Next(self->source);
+		if (line == NULL) {
+			if (PyErr_Occurred())
+				return -1;
+			self->finished = 1;
+			repeat_finish(&self->exp);
+			continue;
+		}
+
+		if (_mcs_line_text(line, &text, &len) == -1) {
+			Py_DECREF(line);
+			return -1;
+		}
+		status = parse_log_line(text, (size_t)len, self->exp.ncols, &row);
+		if (status == -1) {
+			char stamp[64];
+
+			snprintf(stamp, sizeof(stamp), "%.*s", (int)strcspn(text, "\t\r\n"), text);
+			PyErr_Format(PyExc_ValueError, "Corrupt data at %s", stamp);
+			Py_DECREF(line);
+			return -1;
+		}
+		Py_DECREF(line);
+
+		repeat_push(&self->exp, &row);
+	}
+
+	return 1;
+}
+
+static PyObject *
+_LogReader_iternext(_LogReader *self) {
+	PyObject *ret, *item;
+	long long t;
+	const double *values;
+	int i;
+
+	if (_LogReader_fill(self, &t, &values) != 1)
+		return NULL;
+
+	ret = PyTuple_New(self->exp.ncols + 1);
+	if (ret == NULL)
+		return NULL;
+
+	item = PyLong_FromLongLong(t);
+	if (item == NULL)
+		goto error;
+	PyTuple_SET_ITEM(ret, 0, item);
+	for (i = 0; i < self->exp.ncols; i++) {
+		item = PyFloat_FromDouble(values[i]);
+		if (item == NULL)
+			goto error;
+		PyTuple_SET_ITEM(ret, i + 1, item);
+	}
+
+	return ret;
+
+error:
+	Py_DECREF(ret);
+	return NULL;
+}
+
+static PyTypeObject _LogReaderType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	"_mcs.LogReader",
+	sizeof(_LogReader),
+	0,                               /* tp_itemsize */
+	(destructor)_LogReader_dealloc,  /* tp_dealloc */
+	0,                               /* tp_print */
+	0,                               /* tp_getattr */
+	0,                               /* tp_setattr */
+	0,                               /* tp_compare */
+	0,                               /* tp_repr */
+	0,                               /* tp_as_number */
+	0,                               /* tp_as_sequence */
+	0,                               /* tp_as_mapping */
+	0,                               /* tp_hash */
+	0,                               /* tp_call */
+	0,                               /* tp_str */
+	0,                               /* tp_getattro */
+	0,                               /* tp_setattro */
+	0,                               /* tp_as_buffer */
+	Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_ITER, /* tp_flags */
+	"LogReader(lines, cols, period=0.0, periods=0)\n\n"
+	"Iterates over the rows of a log, expanding the Repeat lines. period and\n"
+	"periods are the average sample period of the Repeat runs before the lines\n"
+	"and their number, when starting in the middle of a log (see indexLog)", /* tp_doc */
+	0,                               /* tp_traverse */
+	0,                               /* tp_clear */
+	0,                               /* tp_richcompare */
+	0,                               /* tp_weaklistoffset */
+	PyObject_SelfIter,               /* tp_iter */
+	(iternextfunc)_LogReader_iternext, /* tp_iternext */
+	0,                               /* tp_methods */
+	0,                               /* tp_members */
+	0,                               /* tp_getset */
+	0,                               /* tp_base */
+	0,                               /* tp_dict */
+	0,                               /* tp_descr_get */
+	0,                               /* tp_descr_set */
+	0,                               /* tp_dictoffset */
+	0,                               /* tp_init */
+	0,                               /* tp_alloc */
+	_LogReader_new,                  /* tp_new */
+};
+
+/*
+ * Streaming join of the telemetry logs by time, with sample and hold
+ * semantics (see join.c): yields the joined rows in batches, as
+ * DoubleBuffers of rows x (1 + columns), the time of each row first
+ * (integer microseconds, as a double). A LogReader source is read
+ * natively; any other iterable must give (microseconds, value, ...) rows
+ */
+
+typedef struct {
+	_LogReader *reader;
+	PyObject *iter;
+	PyObject *peeked;	/* first row, read to count its columns */
+	int ncols;
+	double values[MAX_LOG_COLS];
+} _LogJoinSource;
+
+typedef struct {
+	PyObject_HEAD
+	_LogJoinSource *ctx;
+	join_source *sources;
+	Py_ssize_t n;
+	log_join join;
+	int ready;
+	int finished;
+	Py_ssize_t batch;
+} _LogJoin;
+
+static int
+_LogJoin_next(void *arg, long long *t, const double **values) {
+	_LogJoinSource *src = arg;
+	PyObject *row, *seq = NULL;
+	Py_ssize_t i;
+	int ret = -1;
+
+	if (src->reader != NULL)
+		return _LogReader_fill(src->reader, t, values);
+
+	if (src->peeked != NULL) {
+		row = src->peeked;
+		src->peeked = NULL;
+	}
+	else if ((row = PyIter_Next(src->iter)) == NULL)
+		return PyErr_Occurred() ? -1 : 0;
+
+	if ((seq = PySequence_Fast(row, "the rows must be sequences")) == NULL)
+		goto exit;
+	if (PySequence_Fast_GET_SIZE(seq) != src->ncols + 1) {
+		PyErr_Format(PyExc_ValueError, "expected rows of %d values, got %zd",
+			     src->ncols + 1, PySequence_Fast_GET_SIZE(seq));
+		goto exit;
+	}
+	*t = PyLong_AsLongLong(PySequence_Fast_GET_ITEM(seq, 0));
+	if ((*t == -1) && PyErr_Occurred()) {
+		PyErr_SetString(PyExc_TypeError, "the times must be integer microseconds");
+		goto exit;
+	}
+	for (i = 0; i < src->ncols; i++) {
+		src->values[i] = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(seq, i + 1));
+		if ((src->values[i] == -1.0) && PyErr_Occurred())
+			goto exit;
+	}
+	*values = src->values;
+	ret = 1;
+
+exit:
+	Py_XDECREF(seq);
+	Py_DECREF(row);
+
+	return ret;
+}
+
+static void
+_LogJoin_dealloc(_LogJoin *self) {
+	Py_ssize_t i;
+
+	if (self->ready)
+		join_free(&self->join);
+	if (self->ctx != NULL)
+		for (i = 0; i < self->n; i++) {
+			Py_XDECREF(self->ctx[i].reader);
+			Py_XDECREF(self->ctx[i].iter);
+			Py_XDECREF(self->ctx[i].peeked);
+		}
+	free(self->ctx);
+	free(self->sources);
+	Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+/* Sets up source i from obj, with ncols columns (< 0: those of its first
+ * row)
+ */
+static int
+_LogJoin_source(_LogJoin *self, Py_ssize_t i, PyObject *obj, long ncols) {
+	_LogJoinSource *src = &self->ctx[i];
+
+	if (PyObject_TypeCheck(obj, &_LogReaderType)) {
+		Py_INCREF(obj);
+		src->reader = (_LogReader *)obj;
+		src->ncols = src->reader->exp.ncols;
+		if ((ncols >= 0) && (ncols != src->ncols)) {
+			PyErr_Format(PyExc_ValueError, "source %zd has %d columns, not %ld", i, src->ncols, ncols);
+			return -1;
+		}
+		return 0;
+	}
+
+	if ((src->iter = PyObject_GetIter(obj)) == NULL)
+		return -1;
+	if (ncols < 0) {
+		if ((src->peeked = PyIter_Next(src->iter)) == NULL) {
+			if (!PyErr_Occurred())
+				PyErr_Format(PyExc_ValueError, "source %zd is empty: give its cols", i);
+			return -1;
+		}
+		if ((ncols = (long)PyObject_Length(src->peeked) - 1) < -1)
+			return -1;
+	}
+	if ((ncols < 0) || (ncols > MAX_LOG_COLS)) {
+		PyErr_Format(PyExc_ValueError, "source %zd must have between 0 and %d columns", i, MAX_LOG_COLS);
+		return -1;
+	}
+	src->ncols = (int)ncols;
+
+	return 0;
+}
+
+static PyObject *
+_LogJoin_new(PyTypeObject *type, PyObject *args, PyObject *kwds) {
+	static char *kwlist[] = {"sources", "driver", "complete", "batch", "cols", NULL};
+	PyObject *sources_obj, *driver_obj = Py_None, *cols_obj = Py_None;
+	PyObject *seq = NULL, *cols = NULL;
+	int complete = 0, driver = -1;
+	Py_ssize_t batch = 4096, i;
+	long ncols;
+	_LogJoin *self = NULL;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|OinO", kwlist,
+			&sources_obj, &driver_obj, &complete, &batch, &cols_obj))
+		return NULL;
+
+	if ((seq = PySequence_Fast(sources_obj, "sources must be a sequence")) == NULL)
+		return NULL;
+	if (cols_obj != Py_None) {
+		if ((cols = PySequence_Fast(cols_obj, "cols must be a sequence")) == NULL)
+			goto error;
+		if (PySequence_Fast_GET_SIZE(cols) != PySequence_Fast_GET_SIZE(seq)) {
+			PyErr_SetString(PyExc_ValueError, "cols must give the columns of every source");
+			goto error;
+		}
+	}
+	if (driver_obj != Py_None) {
+		driver = (int)PyLong_AsLong(driver_obj);
+		if ((driver == -1) && PyErr_Occurred())
+			goto error;
+		if ((driver < 0) || (driver >= PySequence_Fast_GET_SIZE(seq))) {
+			PyErr_SetString(PyExc_ValueError, "driver must be the index of a source");
+			goto error;
+		}
+	}
+	if (batch < 1) {
+		PyErr_SetString(PyExc_ValueError, "batch must be positive");
+		goto error;
+	}
+
+	self = (_LogJoin *)type->tp_alloc(type, 0);
+	if (self == NULL)
+		goto error;
+	self->n = PySequence_Fast_GET_SIZE(seq);
+	self->batch = batch;
+	self->ctx = calloc(self->n > 0 ? self->n : 1, sizeof(_LogJoinSource));
+	self->sources = calloc(self->n > 0 ? self->n : 1, sizeof(join_source));
+	if ((self->ctx == NULL) || (self->sources == NULL)) {
+		PyErr_NoMemory();
+		goto error;
+	}
+
+	for (i = 0; i < self->n; i++) {
+		ncols = -1;
+		if (cols != NULL) {
+			ncols = PyLong_AsLong(PySequence_Fast_GET_ITEM(cols, i));
+			if ((ncols == -1) && PyErr_Occurred())
+				goto error;
+			if (ncols < 0) {
+				PyErr_SetString(PyExc_ValueError, "cols can't be negative");
+				goto error;
 			}
-			PyTuple_SET_ITEM(demand_tuple, i, item);
 		}
+		if (_LogJoin_source(self, i, PySequence_Fast_GET_ITEM(seq, i), ncols) == -1)
+			goto error;
+		self->sources[i].next = _LogJoin_next;
+		self->sources[i].ctx = &self->ctx[i];
+		self->sources[i].ncols = self->ctx[i].ncols;
+	}
+
+	if (join_init(&self->join, self->sources, (int)self->n, driver, complete) == -1) {
+		if (!PyErr_Occurred())
+			PyErr_NoMemory();
+		goto error;
+	}
+	self->ready = 1;
+
+	Py_DECREF(seq);
+	Py_XDECREF(cols);
+
+	return (PyObject *)self;
+
+error:
+	Py_XDECREF(self);
+	Py_XDECREF(seq);
+	Py_XDECREF(cols);
+
+	return NULL;
+}
+
+static PyObject *
+_LogJoin_iternext(_LogJoin *self) {
+	_DoubleBuffer *res;
+	long n;
+
+	if (self->finished)
+		return NULL;
+
+	if ((res = _DoubleBuffer_create(self->batch, 1 + self->join.ncols)) == NULL)
+		return NULL;
+
+	n = join_fill(&self->join, res->p, (long)self->batch);
+	if (n <= 0) {
+		Py_DECREF(res);
+		self->finished = (n == 0);
+		return NULL;
+	}
+	res->shape[0] = n;
+
+	return (PyObject *)res;
+}
+
+static PyObject *
+_LogJoin_columns_getter(_LogJoin *self, void *closure) {
+	return PyLong_FromLong(self->join.ncols);
+}
+
+static PyGetSetDef _LogJoin_getsetters[] = {
+	{"columns", (getter)_LogJoin_columns_getter, NULL,
+	 "Data columns of the joined rows (without the time)"},
+	{NULL} // Sentinel
+};
+
+static PyTypeObject _LogJoinType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	"_mcs.LogJoin",
+	sizeof(_LogJoin),
+	0,                               /* tp_itemsize */
+	(destructor)_LogJoin_dealloc,    /* tp_dealloc */
+	0,                               /* tp_print */
+	0,                               /* tp_getattr */
+	0,                               /* tp_setattr */
+	0,                               /* tp_compare */
+	0,                               /* tp_repr */
+	0,                               /* tp_as_number */
+	0,                               /* tp_as_sequence */
+	0,                               /* tp_as_mapping */
+	0,                               /* tp_hash */
+	0,                               /* tp_call */
+	0,                               /* tp_str */
+	0,                               /* tp_getattro */
+	0,                               /* tp_setattro */
+	0,                               /* tp_as_buffer */
+	Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_ITER, /* tp_flags */
+	"LogJoin(sources, driver=None, complete=False, batch=4096, cols=None)\n\n"
+	"Joins logs by time, each signal held at its last sample. sources are\n"
+	"LogReaders, or iterables of (microseconds, value, ...) rows. With a driver\n"
+	"(index of a source) there is a row per sample of it, otherwise one per\n"
+	"time in any source. complete leaves out the rows before every signal has\n"
+	"a sample; before that, the values are NaN. cols gives the columns of each\n"
+	"source, needed for an empty one that is not a LogReader.\n\n"
+	"Yields DoubleBuffers of up to batch rows: time, then the columns of the\n"
+	"sources in order", /* tp_doc */
+	0,                               /* tp_traverse */
+	0,                               /* tp_clear */
+	0,                               /* tp_richcompare */
+	0,                               /* tp_weaklistoffset */
+	PyObject_SelfIter,               /* tp_iter */
+	(iternextfunc)_LogJoin_iternext, /* tp_iternext */
+	0,                               /* tp_methods */
+	0,                               /* tp_members */
+	_LogJoin_getsetters,             /* tp_getset */
+	0,                               /* tp_base */
+	0,                               /* tp_dict */
+	0,                               /* tp_descr_get */
+	0,                               /* tp_descr_set */
+	0,                               /* tp_dictoffset */
+	0,                               /* tp_init */
+	0,                               /* tp_alloc */
+	_LogJoin_new,                    /* tp_new */
+};
+
+/*
+ * Decodes a log timestamp ("%m/%d/%Y %H:%M:%S.%f", with 6 or 9 digits in
+ * the fraction) into integer microseconds since the epoch. No timezone
+ * conversion is applied
+ */
+
+static PyObject *
+iface_mcs_parseTimestamp(PyObject *self, PyObject *args) {
+	const char *text;
+	Py_ssize_t len;
+	long long usec;
+
+	if (!PyArg_ParseTuple(args, "s#", &text, &len))
+		return NULL;
+
+	if (parse_timestamp(text, (size_t)len, &usec) == -1) {
+		PyErr_Format(PyExc_ValueError, "Invalid timestamp '%s'", text);
+		return NULL;
+	}
+
+	return PyLong_FromLongLong(usec);
+}
+
+/*
+ * Writes a log in the format read by LogReader: four header lines, then
+ * one tab separated line per sample, with its timestamp and values. The
+ * GIL is released while writing.
+ *
+ *   path    - file to (over)write
+ *   origin  - integer microseconds since the epoch, of time 0
+ *   times   - buffer of N doubles: seconds from origin of each sample
+ *   values  - buffer of N*k doubles: the k values of each sample
+ *   title   - first header line (default: the path)
+ *
+ * Returns the number of lines written. Raises OSError if the file can't
+ * be written
+ */
+
+static PyObject *
+iface_mcs_writeLog(PyObject *self, PyObject *args, PyObject *kwds) {
+	static char *kwlist[] = {"path", "origin", "times", "values", "title", NULL};
+
+	const char *path, *title = NULL;
+	long long origin;
+	PyObject *times_obj, *values_obj;
+	Py_buffer times, values;
+	Py_ssize_t n, k, i, c;
+	const double *t, *v;
+	char stamp[32];
+	FILE *f;
+	int err = 0;
+	PyObject *ret = NULL;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "sLOO|z", kwlist,
+			&path, &origin, &times_obj, &values_obj, &title))
+		return NULL;
+
+	if (_mcs_get_double_view(times_obj, &times, 0, "times") == -1)
+		return NULL;
+	if (_mcs_get_double_view(values_obj, &values, 0, "values") == -1) {
+		PyBuffer_Release(&times);
+		return NULL;
+	}
+
+	n = times.len / sizeof(double);
+	k = (n > 0) ? values.len / sizeof(double) / n : 0;
+	if ((k * n * (Py_ssize_t)sizeof(double) != values.len) || ((n > 0) && (k == 0))) {
+		PyErr_SetString(PyExc_ValueError, "values must hold the same number of values per time");
+		goto exit;
+	}
+	if (title == NULL)
+		title = path;
+
+	t = times.buf;
+	v = values.buf;
+	Py_BEGIN_ALLOW_THREADS
+	if ((f = fopen(path, "w")) == NULL)
+		err = errno;
+	else {
+		fprintf(f, "%s\n#\n#\n#\n", title);
+		for (i = 0; i < n; i++) {
+			format_timestamp(origin + llround(t[i] * 1e6), stamp);
+			fputs(stamp, f);
+			for (c = 0; c < k; c++)
+				fprintf(f, "\t%.17g", v[i * k + c]);
+			fputc('\n', f);
+		}
+		if (ferror(f))
+			err = errno ? errno : EIO;
+		if ((fclose(f) != 0) && (err == 0))
+			err = errno;
+	}
+	Py_END_ALLOW_THREADS
+
+	if (err != 0) {
+		errno = err;
+		PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+		goto exit;
+	}
+
+	ret = PyLong_FromSsize_t(n);
+
+exit:
+	PyBuffer_Release(&values);
+	PyBuffer_Release(&times);
+
+	return ret;
+}
+
+/*
+ * Scans a log and makes a sparse index of it, for reading it from an
+ * arbitrary point (see log_index in logrows.c). The GIL is released
+ * while scanning.
+ *
+ *   path    - the log
+ *   cols    - data columns
+ *   every   - lines per entry
+ *   skip    - header lines
+ *
+ * Returns the entries as bytes: an array of log_index_entry, eight 64 bit
+ * fields each (offset, line, row, maxBefore, minTime, maxTime: integers,
+ * cmaAvg: double, cmaN: integer), in the byte order of the machine.
+ * Raises OSError if the log can't be read, ValueError if a line is corrupt
+ */
+
+static PyObject *
+iface_mcs_indexLog(PyObject *self, PyObject *args, PyObject *kwds) {
+	static char *kwlist[] = {"path", "cols", "every", "skip", NULL};
+
+	const char *path;
+	int cols, skip = 4;
+	long every = 1024, n = -1;
+	long long badLine = 0;
+	log_index_entry *entries = NULL;
+	FILE *f;
+	int err = 0;
+	PyObject *ret;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "si|li", kwlist,
+			&path, &cols, &every, &skip))
+		return NULL;
+
+	if ((cols < 0) || (cols > MAX_LOG_COLS)) {
+		PyErr_Format(PyExc_ValueError, "cols must be between 0 and %d", MAX_LOG_COLS);
+		return NULL;
+	}
+	if ((every < 1) || (skip < 0)) {
+		PyErr_SetString(PyExc_ValueError, "every must be positive, and skip not negative");
+		return NULL;
 	}
 
+	Py_BEGIN_ALLOW_THREADS
+	if ((f = fopen(path, "rb")) == NULL)
+		err = errno;
+	else {
+		n = log_index(f, cols, skip, every, &entries, &badLine);
+		if (n == -1)
+			err = errno ? errno : EIO;
+		fclose(f);
+	}
+	Py_END_ALLOW_THREADS
+
+	if (err != 0) {
+		errno = err;
+		return PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+	}
+	if (n == -2) {
+		PyErr_Format(PyExc_ValueError, "Corrupt data at line %lld of %s",
+			     badLine + skip + 1, path);
+		return NULL;
+	}
+
+	ret = PyBytes_FromStringAndSize((const char *)entries, n * sizeof(log_index_entry));
+	free(entries);
+
 	return ret;
 }
 
 static PyMethodDef McsMethods[] = {
-	{"fillBuffer", (PyCFunction)iface_mcs_sim_fillBuffer, METH_KEYWORDS,
+#ifdef _MCS_FASTCALL
+	{"fillBuffer", (PyCFunction)(void (*)(void))iface_mcs_sim_fillBuffer_fast, METH_FASTCALL | METH_KEYWORDS,
+#else
+	{"fillBuffer", (PyCFunction)iface_mcs_sim_fillBuffer, METH_VARARGS | METH_KEYWORDS,
+#endif
 	 "Extrapolate demands"},
+	{"fillBufferBatch", (PyCFunction)iface_mcs_sim_fillBufferBatch, METH_VARARGS | METH_KEYWORDS,
+	 "Extrapolate demands for a whole series of cycles"},
+	{"extrapolate", (PyCFunction)iface_mcs_sim_extrapolate, METH_VARARGS | METH_KEYWORDS,
+	 "Extrapolate both axes from the stored coefficients"},
+	{"extrapolationKernel", (PyCFunction)iface_mcs_sim_extrapolationKernel, METH_VARARGS,
+	 "Get (or select) the extrapolation kernel"},
+	{"limiterState", (PyCFunction)iface_mcs_sim_limiterState, METH_VARARGS,
+	 "Create the limiter state for a number of scenarios"},
+	{"limitDemands", (PyCFunction)iface_mcs_sim_limitDemands, METH_VARARGS | METH_KEYWORDS,
+	 "Limit the demands of many independent scenarios"},
+	{"limiterKernel", (PyCFunction)iface_mcs_sim_limiterKernel, METH_VARARGS,
+	 "Get (or select) the limiter kernel"},
+	{"calcQuadratic", (PyCFunction)iface_mcs_sim_calcQuadratic, METH_VARARGS | METH_KEYWORDS,
+	 "Fit parabolas to many demand triples"},
+	{"calcLinear", (PyCFunction)iface_mcs_sim_calcLinear, METH_VARARGS | METH_KEYWORDS,
+	 "Fit straight lines to many demand triples"},
+	{"fitKernel", (PyCFunction)iface_mcs_sim_fitKernel, METH_VARARGS,
+	 "Get (or select) the fit kernel"},
+	{"timeLatencies", (PyCFunction)iface_mcs_sim_timeLatencies, METH_VARARGS,
+	 "Get (or turn on/off) the timing of the hot calls"},
+	{"latencies", (PyCFunction)iface_mcs_sim_latencies, METH_NOARGS,
+	 "Latency percentiles of the timed calls"},
+	{"latencyHistogram", (PyCFunction)iface_mcs_sim_latencyHistogram, METH_VARARGS,
+	 "Latency histogram of one timed call"},
+	{"resetLatencies", (PyCFunction)iface_mcs_sim_resetLatencies, METH_VARARGS,
+	 "Empty the latency histograms"},
+	{"generateDemands", (PyCFunction)iface_mcs_sim_generateDemands, METH_VARARGS | METH_KEYWORDS,
+	 "Generate a synthetic stream of TCS demands"},
+	{"parseTimestamp", (PyCFunction)iface_mcs_parseTimestamp, METH_VARARGS,
+	 "Decode a log timestamp into epoch microseconds"},
+	{"writeLog", (PyCFunction)iface_mcs_writeLog, METH_VARARGS | METH_KEYWORDS,
+	 "Write samples as a log"},
+	{"indexLog", (PyCFunction)iface_mcs_indexLog, METH_VARARGS | METH_KEYWORDS,
+	 "Make a sparse index of a log"},
 	{NULL, NULL, 0, NULL} // Sentinel
 };
 
+#if PY_MAJOR_VERSION >= 3
+static struct PyModuleDef McsModule = {
+	PyModuleDef_HEAD_INIT,
+	"_mcs",
+	NULL,
+	-1,
+	McsMethods,
+};
+
+#define _MCS_INIT_ERROR NULL
+
+PyMODINIT_FUNC
+PyInit__mcs(void)
+#else
+#define _MCS_INIT_ERROR
+
 PyMODINIT_FUNC
 init_mcs(void)
+#endif
 {
 	PyObject *mod;
 
+	mcs_hist_init();
+
+	// Pick the kernels now: the threads that run them never do
+	extrapolate_set_level(-1);
+	limit_set_level(-1);
+	coeffs_set_level(-1);
+
 	// Add extras...
 	_mcs_McsParamsType.tp_new = PyType_GenericNew;
 	if (PyType_Ready(&_mcs_McsParamsType) < 0)
-		return;
-
+		return _MCS_INIT_ERROR;
+	if (PyType_Ready(&_DoubleArrayProxyType) < 0)
+		return _MCS_INIT_ERROR;
+	if (PyType_Ready(&_DoubleBufferType) < 0)
+		return _MCS_INIT_ERROR;
+	if (PyType_Ready(&_LogReaderType) < 0)
+		return _MCS_INIT_ERROR;
+	if (PyType_Ready(&_LogJoinType) < 0)
+		return _MCS_INIT_ERROR;
+	if (PyType_Ready(&_DemandRingType) < 0)
+		return _MCS_INIT_ERROR;
+
+#if PY_MAJOR_VERSION >= 3
+	mod = PyModule_Create(&McsModule);
+#else
 	mod = Py_InitModule("_mcs", McsMethods);
+#endif
 	if (mod == NULL)
-		return;
+		return _MCS_INIT_ERROR;
 
 	Py_INCREF(&_mcs_McsParamsType);
 	PyModule_AddObject(mod, "McsParams", (PyObject *)&_mcs_McsParamsType);
+	Py_INCREF(&_DoubleBufferType);
+	PyModule_AddObject(mod, "DoubleBuffer", (PyObject *)&_DoubleBufferType);
+	Py_INCREF(&_LogReaderType);
+	PyModule_AddObject(mod, "LogReader", (PyObject *)&_LogReaderType);
+	Py_INCREF(&_LogJoinType);
+	PyModule_AddObject(mod, "LogJoin", (PyObject *)&_LogJoinType);
+	Py_INCREF(&_DemandRingType);
+	PyModule_AddObject(mod, "DemandRing", (PyObject *)&_DemandRingType);
+
+	PyModule_AddIntConstant(mod, "EV_NOT_CONNECTED", MCS_EV_NOT_CONNECTED);
+	PyModule_AddIntConstant(mod, "EV_FIT_FAILED", MCS_EV_FIT_FAILED);
+	PyModule_AddIntConstant(mod, "EV_FIRST_FIT", MCS_EV_FIRST_FIT);
+	PyModule_AddIntConstant(mod, "EV_BAD_INDEX", MCS_EV_BAD_INDEX);
+	PyModule_AddIntConstant(mod, "AXIS_AZ", MCS_AZ);
+	PyModule_AddIntConstant(mod, "AXIS_EL", MCS_EL);
+	PyModule_AddObject(mod, "TRIGGER_LATENCY", PyFloat_FromDouble(TRIGGER_LATENCY));
+
+#if PY_MAJOR_VERSION >= 3
+	return mod;
+#endif
 }
@@ -1,7 +1,14 @@
 # vim: ai:sw=4:sts=4:expandtab
 
+import os
+import sys
+import time
+import struct
 from collections import namedtuple
+from datetime import datetime
+import numpy as np
 import _mcs
+import util
 
 az_jump = 0.1
 el_jump = 0.1
@@ -22,43 +29,736 @@ el_jump = 0.1
 #                  for the most recent calculation
 #   prevXXDemand - Demand calculated in the previous iteration
 #   prevXXVel    - Velocity calculated in the previous iteration
+#   demandTime   - Apply times of the last three demands passed to step()
+#   nextDemand   - Index in demandTime that the next step() will replace
+#   numExtrap    - Number of points to extrapolate (default 20, can be
+#                  passed as McsParams(num_extrap=...))
+#   timeInt      - Cycle period in seconds (default 0.005, can be
+#                  passed as McsParams(time_int=...))
+#   localFit     - Fit the parabolas on times rebased to the newest
+#                  demand, with the work on the times shared by both axes
+#                  and kept from one cycle to the next (off by default,
+#                  can be passed as McsParams(local_fit=True)). Same
+#                  results to rounding, that doesn't grow with the
+#                  magnitude of the times (eg. epoch seconds)
+#   xxOrigin     - Time origin of the coefficients azA..C/elA..C: 0, or
+#                  the time of the newest demand with localFit
+#
+#   counters     - Per-axis counters of the branches taken by the follow
+#                  code, as {'az': {...}, 'el': {...}}: fits, fitFailures
+#                  (previous coefficients used), demands (through the
+#                  limiter), slews (maxAcc doubled), velLimited, accLimited
+#                  and nearTarget (velocity overridden close to the target)
+#   resetCounters()
+#                - Returns the counters and sets them back to zero
+#
+#   snapshot()   - The follow state (everything but the events) as a few
+#                  hundred bytes, that restore(data) sets back, in this or
+#                  another instance of the same build. copy.copy,
+#                  copy.deepcopy and pickle are supported too
+#
+#   drainEvents()
+#                - Returns the events recorded by the follow code (fits
+#                  failing on equal times, TCS not connected, ...) since
+#                  the last call, as Event-like tuples. Only the last 64
+#                  are kept; eventsLost counts the overwritten ones
+#
+#   step(demand, offset, az_pos, az_vel, az_max_vel, az_max_acc,
+#        el_pos, el_vel, el_max_vel, el_max_acc)
+#                - Limits, fits and extrapolates a new Demand for both
+#                  axes in one call. Returns (azPos, azVel, elPos, elVel)
+#   limitSeries(demands, az_pos, az_max_vel, az_max_acc,
+#               el_pos, el_max_vel, el_max_acc)
+#                - Runs only the limiters of step over N demands at once
+#                  (an N x 3 buffer of applyTime, az, el), with the GIL
+#                  released. Returns the limited demands and velocities as
+#                  (azPos, azVel, elPos, elVel), N elements each
+#   runPaced(demands, az_pos, az_max_vel, az_max_acc,
+#            el_pos, el_max_vel, el_max_acc, latency=TRIGGER_LATENCY,
+#            priority=0, lock=False, cpu=-1)
+#                - Runs step over N demands (as limitSeries) in real time,
+#                  one cycle every timeInt seconds, latency seconds ahead
+#                  of the trigger. priority > 0 runs it as SCHED_FIFO,
+#                  lock locks the memory and cpu pins the thread (OSError
+#                  if not permitted). Returns the timings as a dictionary
+#                  (see PacedStats)
+#   followRing(ring, count, az_max_vel, az_max_acc, el_max_vel, el_max_acc,
+#              idle=1.0)
+#                - Runs step on the demands coming through a DemandRing, as
+#                  another process publishes them, until count demands,
+#                  the producer finishing, or idle seconds without
+#                  demands. The GIL is released meanwhile. Returns the
+#                  counts and latencies as a dictionary (see RingStats)
+#   sweep(demands, configs, threads=0)
+#                - Runs step over N demands (as limitSeries) once per row
+#                  of configs, an M x 6 buffer of (az_max_vel, az_max_acc,
+#                  el_max_vel, el_max_acc, jump, offset) (see sweep_grid),
+#                  on a pool of threads (one per CPU by default) with the
+#                  GIL released. Each run has a state of its own, starting
+#                  from scratch with the numExtrap, timeInt and localFit of
+#                  this instance, and follows perfectly. Returns
+#                  {'az': {...}, 'el': {...}, 'compared', 'notConnected',
+#                  'threads'}: the rms and maximum tracking error of each
+#                  axis (first extrapolated point against the demands,
+#                  degrees) and its counters, M values each
+#
+##################################################################
+# Demands from another process (_mcs.DemandRing)
+#
+# A single producer/single consumer ring of demands in POSIX shared memory,
+# that carries them without locks or system calls, as the TCS would send
+# them. tcsring (make tcsring) plays the TCS: it publishes a sidereal track
+# at a given rate, eg. "./tcsring -n /mcs-demands -r 200 -c 2000".
+#
+#   DemandRing(name, capacity=0)
+#                - Creates the ring (capacity slots, a power of 2), or
+#                  attaches to an existing one when capacity is 0
+#   push(apply_time, az, el)
+#                - Publishes a demand. False if the ring was full (the
+#                  demand is then counted as dropped)
+#   pop()        - (seq, applyTime, az, el, sent) of the oldest demand, or
+#                  None. sent is the CLOCK_MONOTONIC time of publishing
+#   finish()     - Tells the consumer there are no more demands
+#   unlink()     - Removes the name of the ring
+#   pending, dropped, done, capacity, name
+#
+##################################################################
+# Limiter for many independent scenarios
+#
+# _mcs.limitDemands(times, positions, max_vel, max_acc, curr_pos, state,
+#                   status=None)
+#   runs the velocity/acceleration limiter of the follow code for one
+#   cycle of N scenarios at a time, with the same results as calling
+#   fit_new_AZ_demand for each of them (counters and events aside). times
+#   and positions hold 3 rows of N doubles (demands A, B and C); positions
+#   are limited in place. The limits and current positions are numbers or
+#   N doubles. state comes from _mcs.limiterState(N), and is carried from
+#   one cycle to the next. Returns how many scenarios had tB == tC
+#
+# _mcs.limiterKernel([name]) gets or selects the kernel ("scalar", "avx2",
+# "avx512"); MCS_SIMD can also lower it
+#
+##################################################################
+# Fits of many demand triples
+#
+# _mcs.calcQuadratic(ta, pa, tb, pb, tc, pc, out=None)
+# _mcs.calcLinear(ta, pa, tb, pb, tc, pc, out=None)
+#   fit N (time, position) triples at once, each given as a buffer of N
+#   doubles, exactly as calc_quadratic and calc_linear would do one by one.
+#   Return (c0, c1, c2, status), N elements each: p = c0 + c1*t + c2*t*t,
+#   and status -1 where the fit is singular (two or more equal times),
+#   with NaN coefficients
+#
+# _mcs.fitKernel([name]) gets or selects their kernel, as limiterKernel
+#
+##################################################################
+# Latency histograms
+#
+# The extension can time its hot calls into HDR-style histograms (within
+# 1/64 from nanoseconds up), one per entry point or stage: fillBuffer and
+# step (the whole calls), limit, fit and extrap (their stages, also when
+# run by the batch functions) and pack (building the Python results).
+# Timing is off by default, and then costs nothing measurable.
+#
+# _mcs.timeLatencies([on])  gets or turns on/off the timing. MCS_HIST=1 in
+#                           the environment turns it on at import time
+# _mcs.latencies()          {name: {'count', 'min', 'mean', 'max', 'p50',
+#                           'p99', 'p99.9'}}, in seconds
+# _mcs.latencyHistogram(name)
+#                           [(seconds, count), ...] for the non empty
+#                           buckets, seconds being their upper bounds
+# _mcs.resetLatencies([name])
+#                           empties all the histograms, or the one named
+#
+##################################################################
+# Synthetic demands
+#
+# _mcs.generateDemands(kind, count, rate=200., start=1., ...)
+#   makes count cycles of TCS demands natively (hours of them in a
+#   fraction of a second) as an N x 3 buffer of (applyTime, az, el), that
+#   limitSeries and runPaced take as they come. kind is "sidereal" (a star
+#   tracked), "slew" (hops of slew degrees every dwell seconds, over the
+#   AZ_JUMP/EL_JUMP thresholds) or "zenith" (a transit miss degrees from the
+#   zenith, where the azimuth sweeps half a turn). duplicates, reorder and
+#   dropouts add the TCS glitches at random (repeated and out of order apply
+#   times, missing demands), the same for the same seed. See the arguments
+#   in mcs.c
+#
+# _mcs.writeLog(path, origin, times, values, title=None)
+#   writes samples as a log that util.CsvFile reads back (see
+#   write_demand_logs)
+#
 
 # All values for Demand are doubles
 Demand    = namedtuple('Demand', "applyTime az el")
 
+# Event recorded by the follow code (see McsParams.drainEvents). axis is
+# AXIS_AZ, AXIS_EL or -1 for both
+Event     = namedtuple('Event', "seq code axis time value0 value1")
+
+EVENT_NAMES = {
+    _mcs.EV_NOT_CONNECTED: "TCS has not connected",
+    _mcs.EV_FIT_FAILED:    "Time's Equal",
+    _mcs.EV_FIRST_FIT:     "First fit",
+    _mcs.EV_BAD_INDEX:     "Incorrect value of index",
+}
+
+def drain_events(params):
+    """
+    The events pending in a McsParams, as Event objects
+    """
+    return [Event(*ev) for ev in params.drainEvents()]
+
+def latency_report():
+    """
+    The latency percentiles of the timed calls (see _mcs.latencies) as a
+    table, in microseconds
+    """
+    lines = ["{0:<12}{1:>10}{2:>10}{3:>10}{4:>10}{5:>10}".format(
+                "", "count", "p50", "p99", "p99.9", "max")]
+    for name, lat in sorted(_mcs.latencies().items()):
+        if lat['count']:
+            lines.append("{0:<12}{1:>10}{2:>10.2f}{3:>10.2f}{4:>10.2f}{5:>10.2f}".format(
+                name, lat['count'], lat['p50'] * 1e6, lat['p99'] * 1e6,
+                lat['p99.9'] * 1e6, lat['max'] * 1e6))
+
+    return '\n'.join(lines)
+
+# Current state and limits of one axis, as read from the telemetry
+AxisState = namedtuple('AxisState', "pos vel max_vel max_acc")
+
+# One replayed cycle: the time (integer microseconds, as in the logs), the
+# Demand fed to the follow code (times relative to the replay origin), the
+# extrapolated buffers and the recorded PMAC demands one period later
+# (None if not logged)
+Cycle     = namedtuple('Cycle', "time demand azPos azVel elPos elVel azPmac elPmac")
+
+##################################################################
+# Log replay
+#
+# The telemetry of a night is kept as one log per signal (see
+# util.CsvFile), named after it. The demand logs drive the replay: every
+# azDemand sample is one cycle. For the rest of the signals, the last
+# sample at or before the cycle time is used.
+
+DEMAND_SIGNALS = ('azDemand', 'elDemand')
+AXIS_SIGNALS   = ('azCurrentPos', 'azCurrentVel', 'azCurrentMaxVel', 'azCurrentMaxAcc',
+                  'elCurrentPos', 'elCurrentVel', 'elCurrentMaxVel', 'elCurrentMaxAcc')
+PMAC_SIGNALS   = ('azPmacDemand', 'elPmacDemand')
+
+def open_logs(directory):
+    """
+    Opens the per-signal logs found in directory. The PMAC demands are
+    optional; every other signal is required
+    """
+    logs = {}
+    for name in DEMAND_SIGNALS + AXIS_SIGNALS + PMAC_SIGNALS:
+        path = os.path.join(directory, name)
+        if os.path.isfile(path):
+            logs[name] = util.CsvFile(open(path), 1, timestamps='us')
+
+    missing = [name for name in DEMAND_SIGNALS + AXIS_SIGNALS if name not in logs]
+    if missing:
+        raise IOError("Missing logs in {0}: {1}".format(directory, ', '.join(missing)))
+
+    return logs
+
+# Time 0 of the synthetic logs, in microseconds since the epoch
+SYNTHETIC_ORIGIN = util.datetime_to_us(datetime(2019, 1, 1))
+
+def write_demand_logs(directory, demands, az_limits=(2.0, 0.5), el_limits=(2.0, 0.5),
+                      origin=SYNTHETIC_ORIGIN):
+    """
+    Writes demands (from _mcs.generateDemands, or any N x 3 array of
+    applyTime, az, el) as the logs that open_logs reads, so that they can
+    be replayed. The axes follow the demands perfectly: their current
+    position is the previous demand, sampled in time order. The limits are
+    (max_vel, max_acc), constant for the whole log
+    """
+    demands = np.asarray(demands, dtype=np.float64).reshape(-1, 3)
+    if not len(demands):
+        raise ValueError("No demands to write")
+    if not os.path.isdir(directory):
+        os.makedirs(directory)
+
+    times = np.ascontiguousarray(demands[:, 0])
+    for col, name in enumerate(DEMAND_SIGNALS, 1):
+        _mcs.writeLog(os.path.join(directory, name), origin, times,
+                      np.ascontiguousarray(demands[:, col]), title=name)
+
+    ordered = demands[np.argsort(times, kind='stable')]
+    first = ordered[:1, 0]
+    for axis, limits in ((1, az_limits), (2, el_limits)):
+        prefix = DEMAND_SIGNALS[axis - 1][:2]
+        pos = np.concatenate((ordered[:1, axis], ordered[:-1, axis]))
+        dt = np.diff(ordered[:, 0], prepend=ordered[0, 0])
+        vel = np.divide(np.diff(pos, prepend=pos[0]), dt, out=np.zeros(len(pos)), where=dt > 0)
+        signals = (('CurrentPos', ordered[:, 0], pos), ('CurrentVel', ordered[:, 0], vel),
+                   ('CurrentMaxVel', first, np.array(limits[:1], dtype=np.float64)),
+                   ('CurrentMaxAcc', first, np.array(limits[1:], dtype=np.float64)))
+        for suffix, t, values in signals:
+            name = prefix + suffix
+            _mcs.writeLog(os.path.join(directory, name), origin, np.ascontiguousarray(t),
+                          np.ascontiguousarray(values), title=name)
+
+def sweep_grid(az_max_vel, az_max_acc, el_max_vel, el_max_acc, jump=az_jump, offset=0.):
+    """
+    Configurations for McsParams.sweep: every combination of the values
+    given (numbers or sequences), as an M x 6 array
+    """
+    axes = [np.atleast_1d(np.asarray(v, dtype=np.float64))
+            for v in (az_max_vel, az_max_acc, el_max_vel, el_max_acc, jump, offset)]
+
+    return np.stack([a.ravel() for a in np.meshgrid(*axes, indexing='ij')], axis=1)
+
+##################################################################
+# Replay checkpoints
+#
+# A checkpoint file keeps the state of a replay every so many cycles, so
+# that the events late in a night can be looked into by replaying from
+# the checkpoint before them instead of from the start (see
+# McsCalcSimulator.replay). It holds a header (CHECKPOINT_MAGIC, the
+# replay origin and the size of the snapshots) and fixed size records:
+# the time of the cycle (integer microseconds, as in the logs), the demand
+# rows read up to it, the cycles and skipped counts, and the
+# McsParams.snapshot() after the cycle.
+
+CHECKPOINT_MAGIC = b'MCSCKPT1'
+_CHECKPOINT_HEADER = struct.Struct('<8sqq')
+_CHECKPOINT_RECORD = struct.Struct('<qqqq')
+
+# One checkpoint. Replaying from it gives the same cycles as the original
+# replay did after it
+Checkpoint = namedtuple('Checkpoint', "time origin row cycles skipped state")
+
+class CheckpointWriter(object):
+    """
+    Writes the checkpoints of a replay to path, which is overwritten
+    """
+    def __init__(self, path, origin, params):
+        self.fobj = open(path, 'wb')
+        self.size = len(params.snapshot())
+        self.fobj.write(_CHECKPOINT_HEADER.pack(CHECKPOINT_MAGIC, origin, self.size))
+
+    def write(self, t, row, cycles, skipped, params):
+        self.fobj.write(_CHECKPOINT_RECORD.pack(t, row, cycles, skipped))
+        self.fobj.write(params.snapshot())
+
+    def close(self):
+        self.fobj.close()
+
+class CheckpointFile(object):
+    """
+    The checkpoints in a file written by CheckpointWriter, read as they
+    are needed
+    """
+    def __init__(self, path):
+        self.fobj = open(path, 'rb')
+        header = self.fobj.read(_CHECKPOINT_HEADER.size)
+        if len(header) < _CHECKPOINT_HEADER.size:
+            raise ValueError("{0} is not a checkpoint file".format(path))
+        magic, self.origin, self.size = _CHECKPOINT_HEADER.unpack(header)
+        if magic != CHECKPOINT_MAGIC:
+            raise ValueError("{0} is not a checkpoint file".format(path))
+        self.record = _CHECKPOINT_RECORD.size + self.size
+        self.fobj.seek(0, os.SEEK_END)
+        self.count = (self.fobj.tell() - _CHECKPOINT_HEADER.size) // self.record
+
+    def __len__(self):
+        return self.count
+
+    def __getitem__(self, i):
+        if i < 0:
+            i += self.count
+        if not 0 <= i < self.count:
+            raise IndexError("checkpoint index out of range")
+        self.fobj.seek(_CHECKPOINT_HEADER.size + i * self.record)
+        data = self.fobj.read(self.record)
+        t, row, cycles, skipped = _CHECKPOINT_RECORD.unpack(data[:_CHECKPOINT_RECORD.size])
+
+        return Checkpoint(t, self.origin, row, cycles, skipped, data[_CHECKPOINT_RECORD.size:])
+
+    def _time(self, i):
+        self.fobj.seek(_CHECKPOINT_HEADER.size + i * self.record)
+        return _CHECKPOINT_RECORD.unpack(self.fobj.read(_CHECKPOINT_RECORD.size))[0]
+
+    def before(self, t):
+        """
+        The last checkpoint at or before time t (integer microseconds, or
+        datetime), or None. Found by bisection, reading a few records
+        """
+        if isinstance(t, datetime):
+            t = util.datetime_to_us(t)
+        lo, hi = 0, self.count
+        while lo < hi:
+            mid = (lo + hi) // 2
+            if self._time(mid) <= t:
+                lo = mid + 1
+            else:
+                hi = mid
+        return self[lo - 1] if lo else None
+
+    def close(self):
+        self.fobj.close()
+
+class ReplayStats(object):
+    """
+    Counters for a replay. The rate is the sustained number of cycles per
+    second of wall clock time, for the whole pipeline (reading the logs
+    included). A resumed replay counts from the start of the logs, and
+    resumed is the cycle it started after
+    """
+    def __init__(self, period):
+        self.period = period
+        self.cycles = 0
+        self.skipped = 0
+        self.resumed = 0
+        self.elapsed = 0.
+        self.compared = [0, 0]
+        self.sum_sq = [0., 0.]
+        self.max_err = [0., 0.]
+
+    def compare(self, axis, pos, recorded):
+        err = abs(pos - recorded)
+        self.compared[axis] += 1
+        self.sum_sq[axis] += err * err
+        self.max_err[axis] = max(self.max_err[axis], err)
+
+    @property
+    def rate(self):
+        return (self.cycles - self.resumed) / self.elapsed if self.elapsed > 0 else 0.
+
+    @property
+    def speedup(self):
+        "Replay speed relative to real time"
+        return self.rate * self.period
+
+    def rms(self, axis):
+        n = self.compared[axis]
+        return (self.sum_sq[axis] / n) ** 0.5 if n else None
+
+    def __str__(self):
+        lines = ["{0} cycles ({1} skipped) in {2:.3f} s: {3:.0f} cycles/s, {4:.1f}x real time".format(
+                    self.cycles, self.skipped, self.elapsed, self.rate, self.speedup)]
+        if self.resumed:
+            lines[0] += " (from cycle {0})".format(self.resumed)
+        for axis, name in enumerate(('Az', 'El')):
+            if self.compared[axis]:
+                lines.append("{0}: {1} PMAC demands compared, rms error {2:.3g}, max {3:.3g}".format(
+                    name, self.compared[axis], self.rms(axis), self.max_err[axis]))
+
+        return '\n'.join(lines)
+
+class PacedStats(object):
+    """
+    Timings of a paced run (see McsParams.runPaced). A cycle misses its
+    deadline when it ends after the wakeup of the next one. The jitter is
+    how late the cycles woke up; compute, how long they took
+    """
+    def __init__(self, period, result):
+        self.period = period
+        self.cycles = result['cycles']
+        self.misses = result['misses']
+        self.not_connected = result['notConnected']
+        self.max_lateness = result['maxLateness']
+        self.jitter = np.frombuffer(result['jitter'], dtype=np.float64)
+        self.compute = np.frombuffer(result['compute'], dtype=np.float64)
+
+    @staticmethod
+    def percentiles(values):
+        "p50, p99 and max of values, in microseconds"
+        if not len(values):
+            return (0., 0., 0.)
+        p50, p99 = np.percentile(values, (50, 99))
+        return (p50 * 1e6, p99 * 1e6, values.max() * 1e6)
+
+    def __str__(self):
+        lines = ["{0} cycles paced at {1:g} ms: {2} missed deadlines, {3} with the TCS not connected".format(
+                    self.cycles, self.period * 1000, self.misses, self.not_connected)]
+        for name, values in (('Jitter', self.jitter), ('Compute', self.compute)):
+            lines.append("{0}: p50 {1:.1f} us, p99 {2:.1f} us, max {3:.1f} us".format(
+                name, *self.percentiles(values)))
+        if self.cycles:
+            lines.append("Worst margin to the deadline: {0:.1f} us".format(-self.max_lateness * 1e6))
+
+        return '\n'.join(lines)
+
+class RingStats(object):
+    """
+    Result of following a DemandRing (see McsParams.followRing). The
+    latency of a demand goes from its publishing, in the producer, to its
+    buffers being filled
+    """
+    def __init__(self, result):
+        self.demands = result['demands']
+        self.lost = result['lost']
+        self.not_connected = result['notConnected']
+        self.elapsed = result['elapsed']
+        self.latency = np.frombuffer(result['latency'], dtype=np.float64)
+
+    @property
+    def rate(self):
+        "Demands per second"
+        return self.demands / self.elapsed if self.elapsed > 0 else 0.
+
+    def __str__(self):
+        lines = ["{0} demands followed in {1:.3f} s ({2:.0f}/s): {3} lost, {4} with the TCS not connected".format(
+                    self.demands, self.elapsed, self.rate, self.lost, self.not_connected)]
+        lines.append("Latency: p50 {0:.1f} us, p99 {1:.1f} us, max {2:.1f} us".format(
+            *PacedStats.percentiles(self.latency)))
+
+        return '\n'.join(lines)
+
 class McsCalcSimulator(object):
-    def __init__(self):
-        self.params = _mcs.McsParams()
+    def __init__(self, **kwargs):
+        # kwargs are passed to _mcs.McsParams (num_extrap, time_int)
+        self.params = _mcs.McsParams(**kwargs)
+        self.stats = None
 
-    def extrapolate(self, prevDemands):
+    def extrapolate(self, prevDemands, offset, az, el, recent=0):
         """
         Function that calls the MCS follow "fillBuffer" function to extrapolate
         future PMAC demands based on the internal state and inputs:
 
           prevDemands: sequence of exactly 3 Demand objects, from the previous
                        iteration
+          offset:      time of the first extrapolated point, minus one period
+          az, el:      AxisState for each axis
+
+        Returns the (prevDemand, ((pos, vel), ...)) results for Azimuth and
+        Elevation
         """
 
         # Extrapolate demands for Azimuth
-        ret = _mcs.fillBuffer(
+        azRet = _mcs.fillBuffer(
                         self.params,
                         [(dem.applyTime, dem.az) for dem in prevDemands],
-                        axis = 1
+                        axis = 1,
                         offset = offset,
                         jump = az_jump,
-                        max_vel = azCurrentMaxVel,
-                        max_acc = azCurrentMaxAcc,
-                        curr_pos = azCurrentPos,
-                        curr_vel = azCurrentVel)
+                        max_vel = az.max_vel,
+                        max_acc = az.max_acc,
+                        curr_pos = az.pos,
+                        curr_vel = az.vel,
+                        recent = recent)
 
         # Extrapolate demands for Elevation
-        ret = _mcs.fillBuffer(
+        elRet = _mcs.fillBuffer(
                         self.params,
-                        [(dem.applyTime, dem.al) for dem in prevDemands],
-                        axis = 2
+                        [(dem.applyTime, dem.el) for dem in prevDemands],
+                        axis = 2,
                         offset = offset,
                         jump = el_jump,
-                        max_vel = elCurrentMaxVel,
-                        max_acc = elCurrentMaxAcc,
-                        curr_pos = elCurrentPos,
-                        curr_vel = elCurrentVel)
+                        max_vel = el.max_vel,
+                        max_acc = el.max_acc,
+                        curr_pos = el.pos,
+                        curr_vel = el.vel,
+                        recent = recent)
+
+        return azRet, elRet
+
+    def step(self, demand, offset, az, el, recent=0):
+        """
+        One complete control cycle (see McsParams.step) for a new Demand and
+        the current AxisState of both axes. Returns (azPos, azVel, elPos, elVel)
+        """
+        return self.params.step(demand, offset,
+                                az.pos, az.vel, az.max_vel, az.max_acc,
+                                el.pos, el.vel, el.max_vel, el.max_acc,
+                                az_jump = az_jump, el_jump = el_jump,
+                                recent = recent)
+
+    def replay(self, logs, origin=None, checkpoints=None, every=10000, resume=None):
+        """
+        Replays the logs (as returned by open_logs) cycle by cycle through
+        the follow code, yielding a Cycle for each of them. Cycles before
+        every signal has a sample are skipped.
+
+        The follow code works best with times close to zero, so the times are
+        reckoned in seconds from origin (integer microseconds), by default
+        one second before the first demand.
+
+        The counters are kept in self.stats, which is updated as the cycles
+        are yielded.
+
+        With checkpoints (a path), the state is written there every so many
+        cycles (see CheckpointWriter). With resume (a Checkpoint), the replay
+        starts after the cycle it was taken at, with its state and origin;
+        the counts go on from there, the errors only cover the cycles
+        replayed
+        """
+        period = self.params.timeInt
+        period_us = int(round(period * 1000000))
+        stats = self.stats = ReplayStats(period)
+        # Resuming, the logs are read from about the checkpoint on (see
+        # util.CsvFile.from_time and from_row)
+        if resume is not None:
+            signal = lambda name: util.AsOf(logs[name].from_time(resume.time))
+            rows = logs['azDemand'].from_row(resume.row)
+        else:
+            signal = lambda name: util.AsOf(logs[name])
+            rows = iter(logs['azDemand'])
+        el_demand = signal('elDemand')
+        inputs = [signal(name) for name in AXIS_SIGNALS]
+        pmac = [signal(name) if name in logs else None for name in PMAC_SIGNALS]
+
+        row_no = 0
+        if resume is not None:
+            self.params.restore(resume.state)
+            origin = resume.origin
+            stats.cycles, stats.skipped = resume.cycles, resume.skipped
+            stats.resumed = resume.cycles
+            row_no = resume.row
+        writer = None
+
+        start = time.time()
+        try:
+            for row in rows:
+                row_no += 1
+                t = row[0]
+                el = el_demand.value(t)
+                values = [signal.value(t) for signal in inputs]
+                if el is None or None in values:
+                    stats.skipped += 1
+                    continue
+                if origin is None:
+                    origin = t - 1000000
+
+                rel = (t - origin) / 1000000.
+                demand = Demand(rel, row[1], el)
+                azPos, azVel, elPos, elVel = self.step(demand, rel,
+                                                       AxisState(*values[:4]), AxisState(*values[4:]))
+
+                # The first extrapolated point is the demand for the next period.
+                # The first two cycles don't have three demands to fit yet, so
+                # they are left out of the comparison
+                recorded = [signal.value(t + period_us) if signal else None for signal in pmac]
+                for axis, pos in enumerate((azPos, elPos)):
+                    if recorded[axis] is not None and stats.cycles >= 2:
+                        stats.compare(axis, pos[0], recorded[axis])
+
+                stats.cycles += 1
+                if checkpoints is not None and stats.cycles % every == 0:
+                    if writer is None:
+                        writer = CheckpointWriter(checkpoints, origin, self.params)
+                    writer.write(t, row_no, stats.cycles, stats.skipped, self.params)
+
+                stats.elapsed = time.time() - start
+                yield Cycle(t, demand, azPos, azVel, elPos, elVel, recorded[0], recorded[1])
+        finally:
+            if writer is not None:
+                writer.close()
+
+        stats.elapsed = time.time() - start
+
+    def run(self, logs, origin=None, **options):
+        """
+        Replays the logs discarding the output. options are passed to
+        replay (checkpoints, every, resume). Returns the ReplayStats
+        """
+        for cycle in self.replay(logs, origin, **options):
+            pass
+
+        return self.stats
+
+    def run_paced(self, logs, origin=None, **options):
+        """
+        Replays the logs in real time (see McsParams.runPaced): the inputs
+        are gathered as replay does, and then fed to the follow code one
+        cycle per period. options are passed to runPaced (latency,
+        priority, lock, cpu). Returns the PacedStats
+        """
+        # One row per azDemand sample: its time and value, then elDemand
+        # and the axis signals as of that time
+        files = [logs[name] for name in DEMAND_SIGNALS + AXIS_SIGNALS]
+        rows = list(util.join(files, driver=0, complete=True))
+        rows = np.concatenate(rows) if rows else np.empty((0, 2 + len(AXIS_SIGNALS)))
+        if origin is None and len(rows):
+            origin = int(rows[0, 0]) - 1000000
+
+        demands = rows[:, :3].copy()
+        demands[:, 0] = (demands[:, 0] - origin) / 1000000.
+        axes = rows[:, 3:].T.copy()
+        result = self.params.runPaced(demands,
+                                      axes[0], axes[2], axes[3],
+                                      axes[4], axes[6], axes[7],
+                                      **options)
+
+        return PacedStats(self.params.timeInt, result)
+
+    def follow_ring(self, ring, count, az_limits, el_limits, idle=1.0):
+        """
+        Follows the demands published on a DemandRing (or the name of an
+        existing one) by another process, eg. tcsring, until count of them
+        arrived, the producer finished or idle seconds without demands.
+        az_limits and el_limits are (max_vel, max_acc). Returns the
+        RingStats
+        """
+        if not isinstance(ring, _mcs.DemandRing):
+            ring = _mcs.DemandRing(ring)
+        result = self.params.followRing(ring, count, az_limits[0], az_limits[1],
+                                        el_limits[0], el_limits[1], idle=idle)
+
+        return RingStats(result)
+
+if __name__ == '__main__':
+    import argparse
+
+    parser = argparse.ArgumentParser(description="Replays the logs in LOGDIR through the MCS follow code")
+    parser.add_argument('logdir', metavar='LOGDIR')
+    parser.add_argument('--paced', action='store_true',
+                        help="run in real time, one cycle per period, and report the timings")
+    parser.add_argument('--latency', type=float, default=_mcs.TRIGGER_LATENCY, metavar='SECONDS',
+                        help="calculation ahead of the trigger (paced, default %(default)g)")
+    parser.add_argument('--fifo', type=int, default=0, metavar='PRIO',
+                        help="run as SCHED_FIFO with this priority (paced)")
+    parser.add_argument('--lock', action='store_true',
+                        help="lock the memory during the run (paced)")
+    parser.add_argument('--cpu', type=int, default=-1, metavar='N',
+                        help="pin the run to CPU N (paced)")
+    parser.add_argument('--latencies', action='store_true',
+                        help="time the hot calls and print their latency percentiles")
+    parser.add_argument('--generate', choices=('sidereal', 'slew', 'zenith'), metavar='KIND',
+                        help="write a synthetic trajectory (sidereal, slew or zenith) to LOGDIR first")
+    parser.add_argument('--seconds', type=float, default=60., metavar='S',
+                        help="length of the synthetic trajectory (default %(default)g)")
+    parser.add_argument('--glitches', type=float, default=0., metavar='P',
+                        help="probability of each TCS glitch per synthetic demand (default 0)")
+    parser.add_argument('--seed', type=int, default=1,
+                        help="seed of the synthetic glitches and hops")
+    parser.add_argument('--checkpoints', metavar='FILE',
+                        help="write the state of the replay to FILE every --every cycles")
+    parser.add_argument('--every', type=int, default=10000, metavar='N',
+                        help="cycles between checkpoints (default %(default)d)")
+    parser.add_argument('--resume', metavar='TIME',
+                        help="start from the checkpoint in --resume-from before TIME ('%%m/%%d/%%Y %%H:%%M:%%S.%%f')")
+    parser.add_argument('--resume-from', metavar='FILE',
+                        help="checkpoint file to resume from (default: --checkpoints)")
+    args = parser.parse_args()
+
+    if args.latencies:
+        _mcs.timeLatencies(True)
+    if args.generate:
+        p = args.glitches
+        write_demand_logs(args.logdir, _mcs.generateDemands(args.generate, int(args.seconds * 200),
+                                                            duplicates=p, reorder=p, dropouts=p / 10,
+                                                            seed=args.seed))
+    logs = open_logs(args.logdir)
+    if args.paced:
+        try:
+            print(McsCalcSimulator().run_paced(logs, latency = args.latency, priority = args.fifo,
+                                               lock = args.lock, cpu = args.cpu))
+        except OSError as e:
+            sys.exit("Can't set up the paced run: {0}".format(e))
+    else:
+        resume = None
+        if args.resume:
+            checkpoints = CheckpointFile(args.resume_from or args.checkpoints)
+            resume = checkpoints.before(util.get_timestamp(args.resume))
+            if resume is None:
+                sys.exit("No checkpoint before {0}".format(args.resume))
+            print("Resuming from {0} (cycle {1})".format(util.datetime_from_us(resume.time), resume.cycles))
+        print(McsCalcSimulator().run(logs, checkpoints = None if args.resume else args.checkpoints,
+                                     every = args.every, resume = resume))
+    if args.latencies:
+        print(latency_report())
@@ -0,0 +1,199 @@
+#define _GNU_SOURCE /* pthread_{get,set}affinity_np */
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "pace.h"
+
+/*
+**  - - - - - - - - -
+**   p a c e _ r u n
+**  - - - - - - - - -
+**
+**  Runs the follow loop (mcs_step) in real time, one cycle every
+**  timeInt seconds, and measures how well it keeps the schedule.
+**
+**  Given:
+**    demands   double[n][3]      (applyTime, azDemand, elDemand) per cycle
+**    n         long              number of cycles
+**    az, el    mcs_axis_series*  current positions and limits per cycle
+**    config    pace_config*      latency and real-time settings
+**
+**  Returned:
+**    stats     pace_stats*       timings (jitter and compute are filled
+**                                if they are not NULL)
+**    internal_params             as left by n calls to mcs_step
+**
+**  Status:
+**            int       0 = OK
+**                      else the errno of the real-time setup that
+**                      failed (mlockall, affinity or SCHED_FIFO), in
+**                      which case nothing is run
+**
+**  Notes:
+**
+**  1)  Cycle k is scheduled at T0 + k*timeInt on CLOCK_MONOTONIC (T0 is
+**      one period after the call), and waited for with an absolute
+**      clock_nanosleep, so that the errors don't accumulate. Late cycles
+**      are not skipped: the loop catches up after an overrun.
+**
+**  2)  The calculation runs latency seconds before the Bancomm trigger,
+**      so the extrapolation starts at the wakeup time plus latency. The
+**      wakeup times are reckoned on the time line of the demands, the
+**      first cycle being at the time of the first demand.
+**
+**  3)  The deadline of a cycle is the scheduled wakeup of the next one.
+**
+**  4)  The scheduling policy and the CPU affinity of the calling thread
+**      are restored at the end. The memory is unlocked if it was locked
+**      here.
+*/
+
+#define NSEC 1000000000LL
+
+static long long ts_to_ns (const struct timespec *ts)
+{
+    return (long long)ts->tv_sec * NSEC + ts->tv_nsec;
+}
+
+static void ns_to_ts (long long ns, struct timespec *ts)
+{
+    ts->tv_sec  = ns / NSEC;
+    ts->tv_nsec = ns % NSEC;
+}
+
+static long long now_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts_to_ns (&ts);
+}
+
+int pace_run (const double *demands, long n, const mcs_axis_series *az,
+              const mcs_axis_series *el, const pace_config *config,
+              pace_stats *stats, mcs_parameters *internal_params)
+{
+    double azPos[MAX_EXTRAP], azVel[MAX_EXTRAP];
+    double elPos[MAX_EXTRAP], elVel[MAX_EXTRAP];
+    mcs_axis_inputs azIn = { .jump = AZ_JUMP };
+    mcs_axis_inputs elIn = { .jump = EL_JUMP };
+    pthread_t  self = pthread_self ();
+    struct sched_param param, oldParam;
+    struct timespec ts;
+    cpu_set_t  oldSet, set;
+    long long  period, base, sched, wake, end;
+    double     origin, jitter, compute, lateness;
+    const double *dem;
+    int        oldPolicy;
+    int        locked = 0, pinned = 0, fifo = 0;
+    int        err = 0;
+    long       k;
+
+    memset (stats, 0, offsetof (pace_stats, jitter));
+
+    /* Real-time setup */
+    if (config->lock)
+    {
+        if (mlockall (MCL_CURRENT | MCL_FUTURE) == -1)
+        {
+            err = errno;
+            goto restore;
+        }
+        locked = 1;
+    }
+    if (config->cpu >= 0)
+    {
+        CPU_ZERO (&set);
+        CPU_SET (config->cpu, &set);
+        if (((err = pthread_getaffinity_np (self, sizeof (oldSet), &oldSet)) != 0) ||
+            ((err = pthread_setaffinity_np (self, sizeof (set), &set)) != 0))
+            goto restore;
+        pinned = 1;
+    }
+    if (config->priority > 0)
+    {
+        if ((err = pthread_getschedparam (self, &oldPolicy, &oldParam)) != 0)
+            goto restore;
+        memset (&param, 0, sizeof (param));
+        param.sched_priority = config->priority;
+        if ((err = pthread_setschedparam (self, SCHED_FIFO, &param)) != 0)
+            goto restore;
+        fifo = 1;
+    }
+
+    /* Touch the stack used by the cycles before the first one */
+    memset (azPos, 0, sizeof (azPos));
+    memset (azVel, 0, sizeof (azVel));
+    memset (elPos, 0, sizeof (elPos));
+    memset (elVel, 0, sizeof (elVel));
+
+    period = (long long)(internal_params->timeInt * NSEC + 0.5);
+    origin = (n > 0) ? demands[0] : 0.0;
+    base   = now_ns () + period;
+
+    for (k = 0, dem = demands; k < n; k++, dem += 3)
+    {
+        sched = base + k * period;
+        ns_to_ts (sched, &ts);
+        while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+            ;
+        wake = now_ns ();
+
+        azIn.currentPos = az->currentPos[k];
+        azIn.maxVel     = az->maxVel[k];
+        azIn.maxAcc     = az->maxAcc[k];
+        elIn.currentPos = el->currentPos[k];
+        elIn.maxVel     = el->maxVel[k];
+        elIn.maxAcc     = el->maxAcc[k];
+
+        if (mcs_step (dem[0], dem[1], dem[2],
+                      origin + (wake - base) * 1e-9 + config->latency,
+                      &azIn, &elIn, 0, azPos, azVel, elPos, elVel,
+                      internal_params) == 1)
+            stats->notConnected++;
+
+        end = now_ns ();
+
+        jitter   = (wake - sched) * 1e-9;
+        compute  = (end - wake) * 1e-9;
+        lateness = (end - (sched + period)) * 1e-9;
+
+        if (stats->jitter != NULL)
+            stats->jitter[k] = jitter;
+        if (stats->compute != NULL)
+            stats->compute[k] = compute;
+
+        stats->meanJitter  += jitter;
+        stats->meanCompute += compute;
+        if ((k == 0) || (jitter > stats->maxJitter))
+            stats->maxJitter = jitter;
+        if ((k == 0) || (compute > stats->maxCompute))
+            stats->maxCompute = compute;
+        if ((k == 0) || (lateness > stats->maxLateness))
+            stats->maxLateness = lateness;
+        if (lateness > 0.0)
+            stats->misses++;
+        stats->cycles++;
+    }
+
+    if (stats->cycles > 0)
+    {
+        stats->meanJitter  /= stats->cycles;
+        stats->meanCompute /= stats->cycles;
+    }
+
+restore:
+    if (fifo)
+        pthread_setschedparam (self, oldPolicy, &oldParam);
+    if (pinned)
+        pthread_setaffinity_np (self, sizeof (oldSet), &oldSet);
+    if (locked)
+        munlockall ();
+
+    return err;
+}
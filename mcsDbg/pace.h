@@ -0,0 +1,32 @@
+#ifndef __PACE_H__
+#define __PACE_H__
+
+#include "follow.h"
+
+/* How to run the paced loop */
+typedef struct {
+	double latency;		/* calculation ahead of the trigger (TRIGGER_LATENCY) */
+	int    priority;	/* SCHED_FIFO priority, 0 to keep the current policy  */
+	int    lock;		/* non zero to mlockall during the run                */
+	int    cpu;		/* CPU to pin to, -1 not to pin                       */
+} pace_config;
+
+/* What happened in the paced loop. Times in seconds */
+typedef struct {
+	long   cycles;		/* cycles run                                   */
+	long   misses;		/* cycles that ended after the next wakeup time */
+	long   notConnected;	/* cycles where the TCS had not connected       */
+	double maxJitter;	/* wakeup time minus scheduled time             */
+	double meanJitter;
+	double maxCompute;	/* from the wakeup to the end of the cycle      */
+	double meanCompute;
+	double maxLateness;	/* worst end of a cycle past its deadline       */
+	double *jitter;		/* per cycle, n elements (can be NULL)          */
+	double *compute;	/* per cycle, n elements (can be NULL)          */
+} pace_stats;
+
+int pace_run	(const double *, long, const mcs_axis_series *,
+		 const mcs_axis_series *, const pace_config *, pace_stats *,
+		 mcs_parameters *);
+
+#endif // __PACE_H__
@@ -0,0 +1,362 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ring.h"
+
+/*
+**  Demand transport between processes
+**
+**  A single producer (the TCS, or tcsring standing in for it) and a
+**  single consumer (the follow loop, ring_follow) share a ring of
+**  demands in a POSIX shared memory object. Neither side ever blocks the
+**  other, and no system calls are made to pass a demand.
+**
+**  Notes:
+**
+**  1)  head and tail only grow (they wrap at 2^64); the slot of a demand
+**      is its index masked with capacity - 1. The producer fills the slot
+**      and then publishes head with a release store; the consumer reads
+**      head with an acquire load before the slot, and gives the slot back
+**      by publishing tail the same way.
+**
+**  2)  Each side keeps the last value it read of the other side's index,
+**      and only reads the shared one again when that says the ring is
+**      full (producer) or empty (consumer), so that the cache lines don't
+**      bounce between cores on every demand.
+**
+**  3)  The TCS doesn't wait for the MCS: a demand that finds the ring
+**      full is dropped and counted. The consumer sees the gap in the
+**      sequence numbers.
+**
+**  4)  Times are CLOCK_MONOTONIC seconds, which are the same for every
+**      process on the host.
+*/
+
+#define RING_SPINS	20000		/* polls before napping, when empty */
+#define RING_NAP_NS	10000		/* nap between polls, then          */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax()	__builtin_ia32_pause()
+#else
+#define cpu_relax()	do { } while (0)
+#endif
+
+static size_t ring_size (unsigned long capacity)
+{
+    return sizeof (ring_shared) + capacity * sizeof (ring_demand);
+}
+
+static int ring_map (demand_ring *r, int fd, size_t size)
+{
+    void *p = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (p == MAP_FAILED)
+        return -1;
+
+    r->shm  = p;
+    r->size = size;
+
+    return 0;
+}
+
+/* ring_create - Create (or replace) the ring called name, with capacity
+ * slots (a power of 2). Returns 0, or -1 with errno set
+ */
+int ring_create (demand_ring *r, const char *name, unsigned long capacity)
+{
+    size_t size = ring_size (capacity);
+    int    fd, err;
+
+    if ((capacity < 2) || (capacity > RING_MAX_SLOTS) ||
+        ((capacity & (capacity - 1)) != 0))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if ((fd = shm_open (name, O_RDWR | O_CREAT | O_TRUNC, 0600)) == -1)
+        return -1;
+    if ((ftruncate (fd, size) == -1) || (ring_map (r, fd, size) == -1))
+    {
+        err = errno;
+        close (fd);
+        shm_unlink (name);
+        errno = err;
+        return -1;
+    }
+    close (fd);
+
+    /* The object comes zeroed; the magic number goes last */
+    r->shm->version  = RING_VERSION;
+    r->shm->capacity = capacity;
+    __atomic_store_n (&r->shm->magic, RING_MAGIC, __ATOMIC_RELEASE);
+
+    r->mask     = capacity - 1;
+    r->seenHead = 0;
+    r->seenTail = 0;
+
+    return 0;
+}
+
+/* ring_open - Attach to an existing ring. Returns 0, or -1 with errno set
+ * (EINVAL if name is not a ring)
+ */
+int ring_open (demand_ring *r, const char *name)
+{
+    struct stat st;
+    unsigned long capacity;
+    int    fd, err;
+
+    if ((fd = shm_open (name, O_RDWR, 0)) == -1)
+        return -1;
+    if (fstat (fd, &st) == -1)
+        goto error;
+    if ((size_t)st.st_size < sizeof (ring_shared))
+    {
+        errno = EINVAL;
+        goto error;
+    }
+    if (ring_map (r, fd, st.st_size) == -1)
+        goto error;
+    close (fd);
+
+    /* The magic number first: the rest is only meaningful once it is set
+     * (ring_create stores it last, with release)
+     */
+    if (__atomic_load_n (&r->shm->magic, __ATOMIC_ACQUIRE) != RING_MAGIC)
+        goto invalid;
+    capacity = r->shm->capacity;
+    if ((r->shm->version != RING_VERSION) ||
+        (capacity < 2) || (capacity > RING_MAX_SLOTS) ||
+        ((capacity & (capacity - 1)) != 0) ||
+        (ring_size (capacity) > r->size))
+        goto invalid;
+
+    r->mask     = capacity - 1;
+    r->seenHead = __atomic_load_n (&r->shm->head, __ATOMIC_ACQUIRE);
+    r->seenTail = __atomic_load_n (&r->shm->tail, __ATOMIC_ACQUIRE);
+
+    return 0;
+
+invalid:
+    munmap (r->shm, r->size);
+    r->shm = NULL;
+    errno = EINVAL;
+    return -1;
+
+error:
+    err = errno;
+    close (fd);
+    errno = err;
+    return -1;
+}
+
+void ring_close (demand_ring *r)
+{
+    if (r->shm != NULL)
+    {
+        munmap (r->shm, r->size);
+        r->shm = NULL;
+    }
+}
+
+/* ring_unlink - Remove the name of a ring. Those attached to it keep it
+ * until they close it
+ */
+int ring_unlink (const char *name)
+{
+    return shm_unlink (name);
+}
+
+/* ring_push - Publish a demand (producer). Returns 0, or -1 if the ring
+ * is full, in which case the demand is counted as dropped
+ */
+int ring_push (demand_ring *r, const ring_demand *d)
+{
+    ring_shared  *s = r->shm;
+    unsigned long head = __atomic_load_n (&s->head, __ATOMIC_RELAXED);
+
+    if (head - r->seenTail > r->mask)
+    {
+        r->seenTail = __atomic_load_n (&s->tail, __ATOMIC_ACQUIRE);
+        if (head - r->seenTail > r->mask)
+        {
+            __atomic_store_n (&s->dropped, s->dropped + 1, __ATOMIC_RELAXED);
+            return -1;
+        }
+    }
+
+    s->slots[head & r->mask] = *d;
+    __atomic_store_n (&s->head, head + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+/* ring_pop - Take the oldest demand (consumer). Returns 1, or 0 if the
+ * ring is empty
+ */
+int ring_pop (demand_ring *r, ring_demand *d)
+{
+    ring_shared  *s = r->shm;
+    unsigned long tail = __atomic_load_n (&s->tail, __ATOMIC_RELAXED);
+
+    if (tail == r->seenHead)
+    {
+        r->seenHead = __atomic_load_n (&s->head, __ATOMIC_ACQUIRE);
+        if (tail == r->seenHead)
+            return 0;
+    }
+
+    *d = s->slots[tail & r->mask];
+    __atomic_store_n (&s->tail, tail + 1, __ATOMIC_RELEASE);
+
+    return 1;
+}
+
+/* ring_finish - Tell the consumer there are no more demands (producer)
+ */
+void ring_finish (demand_ring *r)
+{
+    __atomic_store_n (&r->shm->done, 1, __ATOMIC_RELEASE);
+}
+
+/* ring_pending - Demands published and not consumed yet
+ */
+unsigned long ring_pending (demand_ring *r)
+{
+    return __atomic_load_n (&r->shm->head, __ATOMIC_ACQUIRE) -
+           __atomic_load_n (&r->shm->tail, __ATOMIC_ACQUIRE);
+}
+
+double ring_now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+**  - - - - - - - - - - - - -
+**   r i n g _ f o l l o w
+**  - - - - - - - - - - - - -
+**
+**  Runs the follow loop (mcs_step) on the demands coming through a ring,
+**  as they arrive.
+**
+**  Given:
+**    r         demand_ring*      ring, attached as its consumer
+**    count     long              demands to consume (< 0 for no limit)
+**    idle      double            seconds without demands to give up
+**    az, el    mcs_axis_inputs*  limits of each axis
+**
+**  Returned:
+**    stats     ring_stats*       counts and latencies
+**    latency   double[count]     latency of each demand (can be NULL)
+**    internal_params             as left by the mcs_step calls
+**
+**  Status:
+**            long      demands consumed
+**
+**  Notes:
+**
+**  1)  The loop stops after count demands, when the producer has
+**      finished (ring_finish) and the ring is empty, or after idle
+**      seconds without demands. A producer clears the finished flag
+**      before its first demand, so the one left by a previous producer
+**      is ignored until a demand arrives.
+**
+**  2)  The latency of a demand goes from the moment it was published to
+**      the moment its buffers are filled, across the processes.
+**
+**  3)  The mount is taken to follow perfectly: the current position of
+**      each axis is the first extrapolated point of the previous cycle
+**      (the first demand, at the start).
+**
+**  4)  While the ring is empty the loop polls it, spinning at first and
+**      then with short naps, which bounds the latency it adds after a
+**      quiet spell to RING_NAP_NS.
+*/
+long ring_follow (demand_ring *r, long count, double idle,
+                  const mcs_axis_inputs *az, const mcs_axis_inputs *el,
+                  ring_stats *stats, double *latency,
+                  mcs_parameters *internal_params)
+{
+    double azPos[MAX_EXTRAP], azVel[MAX_EXTRAP];
+    double elPos[MAX_EXTRAP], elVel[MAX_EXTRAP];
+    mcs_axis_inputs azIn = *az, elIn = *el;
+    struct timespec nap = { 0, RING_NAP_NS };
+    ring_demand d;
+    unsigned long nextSeq = 0;
+    double start = 0.0, last, lat;
+    long   spins = 0;
+
+    memset (stats, 0, sizeof (*stats));
+    last = ring_now ();
+
+    while ((count < 0) || (stats->demands < count))
+    {
+        if (!ring_pop (r, &d))
+        {
+            /* A finished producer from before doesn't count */
+            if ((stats->demands == 0) ||
+                !__atomic_load_n (&r->shm->done, __ATOMIC_ACQUIRE))
+            {
+                if (++spins < RING_SPINS)
+                    cpu_relax ();
+                else if (ring_now () - last > idle)
+                    break;
+                else
+                    nanosleep (&nap, NULL);
+                continue;
+            }
+
+            /* Every demand is visible once done is */
+            if (!ring_pop (r, &d))
+                break;
+        }
+        spins = 0;
+
+        if (stats->demands == 0)
+        {
+            start = d.sent;
+            azIn.currentPos = d.az;
+            elIn.currentPos = d.el;
+        }
+        else if (d.seq != nextSeq)
+            stats->lost += (long)(d.seq - nextSeq);
+        nextSeq = d.seq + 1;
+
+        if (mcs_step (d.applyTime, d.az, d.el, d.applyTime, &azIn, &elIn, 0,
+                      azPos, azVel, elPos, elVel, internal_params) == 1)
+            stats->notConnected++;
+        else
+        {
+            azIn.currentPos = azPos[0];
+            elIn.currentPos = elPos[0];
+        }
+
+        last = ring_now ();
+        lat  = last - d.sent;
+        if (latency != NULL)
+            latency[stats->demands] = lat;
+        stats->meanLatency += lat;
+        if (lat > stats->maxLatency)
+            stats->maxLatency = lat;
+        stats->demands++;
+    }
+
+    if (stats->demands > 0)
+    {
+        stats->meanLatency /= stats->demands;
+        stats->elapsed = last - start;
+    }
+
+    return stats->demands;
+}
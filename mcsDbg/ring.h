@@ -0,0 +1,68 @@
+#ifndef __RING_H__
+#define __RING_H__
+
+#include <stddef.h>
+
+#include "follow.h"
+
+#define RING_MAGIC	0x5253434dU	/* "MCSR" */
+#define RING_VERSION	1
+#define RING_MAX_SLOTS	(1UL << 24)
+
+/* One demand from the TCS */
+typedef struct {
+	double applyTime;
+	double az;
+	double el;
+	double sent;		/* ring_now() when it was published     */
+	unsigned long seq;	/* number of the demand, from 0          */
+} ring_demand;
+
+/* The shared memory object: this header, then the slots. What each side
+ * writes is on a cache line of its own */
+typedef struct {
+	unsigned int  magic;	/* RING_MAGIC, once initialized          */
+	unsigned int  version;
+	unsigned long capacity;	/* slots, a power of 2                   */
+	/* Written by the producer */
+	unsigned long head __attribute__((aligned(64)));	/* demands published */
+	unsigned long dropped;	/* demands not published, ring full     */
+	unsigned long done;	/* non zero after the last demand        */
+	/* Written by the consumer */
+	unsigned long tail __attribute__((aligned(64)));	/* demands consumed  */
+	ring_demand   slots[] __attribute__((aligned(64)));
+} ring_shared;
+
+/* A process' handle on a ring */
+typedef struct {
+	ring_shared  *shm;
+	size_t        size;		/* bytes mapped             */
+	unsigned long mask;		/* capacity - 1             */
+	unsigned long seenHead;		/* last head read (consumer) */
+	unsigned long seenTail;		/* last tail read (producer) */
+} demand_ring;
+
+/* What ring_follow did. Times in seconds */
+typedef struct {
+	long   demands;		/* demands consumed                        */
+	long   lost;		/* gaps in the sequence numbers            */
+	long   notConnected;	/* cycles where the TCS had not connected  */
+	double elapsed;		/* from the first demand to the last       */
+	double meanLatency;	/* from publishing to the buffers filled   */
+	double maxLatency;
+} ring_stats;
+
+int    ring_create	(demand_ring *, const char *, unsigned long);
+int    ring_open	(demand_ring *, const char *);
+void   ring_close	(demand_ring *);
+int    ring_unlink	(const char *);
+int    ring_push	(demand_ring *, const ring_demand *);
+int    ring_pop		(demand_ring *, ring_demand *);
+void   ring_finish	(demand_ring *);
+unsigned long ring_pending	(demand_ring *);
+double ring_now		(void);
+long   ring_follow	(demand_ring *, long, double, const mcs_axis_inputs *,
+			 const mcs_axis_inputs *, ring_stats *, double *,
+			 mcs_parameters *);
+
+#endif // __RING_H__
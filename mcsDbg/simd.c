@@ -0,0 +1,51 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "simd.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_X86
+#endif
+
+static const char *level_names[] = { "scalar", "sse2", "avx2", "avx512" };
+
+/*
+**  - - - - - - - - - - - - - - - -
+**   s i m d _ b e s t _ l e v e l
+**  - - - - - - - - - - - - - - - -
+**
+**  Highest instruction set (SIMD_xxx) the CPU supports, lowered to the
+**  one named by MCS_SIMD if that is set to a lower one.
+**
+**  Notes:
+**
+**  1)  The kernels of extrap.c, limit.c and coeffs.c each take the
+**      highest level of their own at or below this one.
+**
+**  2)  AVX-512 means AVX512F: it is all the kernels use.
+*/
+int simd_best_level (void)
+{
+    int         level = SIMD_SCALAR;
+    int         i;
+    const char *env;
+
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        level = SIMD_SSE2;
+    if (__builtin_cpu_supports("avx2"))
+        level = SIMD_AVX2;
+    if (__builtin_cpu_supports("avx512f"))
+        level = SIMD_AVX512;
+#endif
+
+    if ((env = getenv("MCS_SIMD")) != NULL)
+    {
+        for (i = SIMD_SCALAR; i <= SIMD_AVX512; i++)
+            if ((strcmp(env, level_names[i]) == 0) && (i < level))
+                level = i;
+    }
+
+    return level;
+}
@@ -0,0 +1,12 @@
+#ifndef __SIMD_H__
+#define __SIMD_H__
+
+/* Instruction sets the kernels are written for, from slowest to fastest */
+#define SIMD_SCALAR	0
+#define SIMD_SSE2	1
+#define SIMD_AVX2	2
+#define SIMD_AVX512	3
+
+int simd_best_level	(void);
+
+#endif // __SIMD_H__
@@ -0,0 +1,290 @@
+#include <math.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "sweep.h"
+
+/*
+**  Parameter sweeps
+**
+**  Runs the follow loop (mcs_step) over one series of demands once per
+**  configuration of the limits (maxVel, maxAcc, jump) and of the
+**  extrapolation offset, each configuration with an mcs_parameters of its
+**  own, on a pool of threads. The demands are shared, and only read.
+**
+**  Notes:
+**
+**  1)  Each thread starts with a contiguous block of the configurations,
+**      that it takes from the front. A thread that runs out steals the
+**      back half of the largest block left, so that the threads stay
+**      busy to the end whatever the cost of each configuration. A block
+**      is a pair of 32 bit indices in one word, and both the owner and
+**      the thieves move it with a single compare and swap.
+**
+**  2)  The calling thread is one of the workers.
+**
+**  3)  Nothing is shared between the threads while they run but the
+**      blocks, and the latency histograms if timing (see hist.c).
+*/
+
+#define SWEEP_MAX_THREADS	256
+
+#define RANGE(next, end)	(((unsigned long long)(next) << 32) | (unsigned long long)(end))
+#define RANGE_NEXT(r)		((long)((r) >> 32))
+#define RANGE_END(r)		((long)((r) & 0xffffffffULL))
+
+/* The configurations left to a thread: [next, end) */
+typedef struct {
+    unsigned long long range __attribute__((aligned(64)));
+} sweep_block;
+
+typedef struct {
+    const double         *demands;
+    long                  n;
+    const double         *configs;
+    const mcs_parameters *initial;
+    sweep_result         *results;
+    sweep_block          *blocks;
+    int                   nthreads;
+} sweep_job;
+
+typedef struct {
+    sweep_job *job;
+    int        id;
+} sweep_worker;
+
+/* take - Next configuration of a block (its owner), or -1 if empty
+ */
+static long take (sweep_block *b)
+{
+    unsigned long long r = __atomic_load_n (&b->range, __ATOMIC_ACQUIRE);
+
+    while (RANGE_NEXT(r) < RANGE_END(r))
+        if (__atomic_compare_exchange_n (&b->range, &r,
+                                         RANGE(RANGE_NEXT(r) + 1, RANGE_END(r)), 1,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return RANGE_NEXT(r);
+
+    return -1;
+}
+
+/* steal - Move the back half of the largest block left to the (empty)
+ * block of thread self. Returns 0 if there was nothing left
+ */
+static int steal (sweep_job *job, int self)
+{
+    unsigned long long r;
+    long   left, most, half;
+    int    i, victim;
+
+    for (;;)
+    {
+        for (i = 0, victim = -1, most = 0; i < job->nthreads; i++)
+        {
+            if (i == self)
+                continue;
+            r    = __atomic_load_n (&job->blocks[i].range, __ATOMIC_RELAXED);
+            left = RANGE_END(r) - RANGE_NEXT(r);
+            if (left > most)
+            {
+                most   = left;
+                victim = i;
+            }
+        }
+        if (victim < 0)
+            return 0;
+
+        r    = __atomic_load_n (&job->blocks[victim].range, __ATOMIC_ACQUIRE);
+        left = RANGE_END(r) - RANGE_NEXT(r);
+        if (left <= 0)
+            continue;
+        half = (left + 1) / 2;
+        if (__atomic_compare_exchange_n (&job->blocks[victim].range, &r,
+                                         RANGE(RANGE_NEXT(r), RANGE_END(r) - half), 0,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        {
+            __atomic_store_n (&job->blocks[self].range,
+                              RANGE(RANGE_END(r) - half, RANGE_END(r)), __ATOMIC_RELEASE);
+            return 1;
+        }
+    }
+}
+
+/* run_config - Follow the demands with configuration k, and measure how
+ * well the first extrapolated point of each cycle tracks them (see
+ * sweep_run)
+ */
+static void run_config (const sweep_job *job, long k)
+{
+    const double *cfg = &job->configs[k * SWEEP_COLUMNS];
+    const double *dem = job->demands, *d;
+    sweep_result *res = &job->results[k];
+    mcs_parameters params = *job->initial;
+    mcs_axis_inputs az = { 0.0, 0.0, cfg[SWEEP_AZ_MAX_VEL], cfg[SWEEP_AZ_MAX_ACC], cfg[SWEEP_JUMP] };
+    mcs_axis_inputs el = { 0.0, 0.0, cfg[SWEEP_EL_MAX_VEL], cfg[SWEEP_EL_MAX_ACC], cfg[SWEEP_JUMP] };
+    double azPos[MAX_EXTRAP], azVel[MAX_EXTRAP];
+    double elPos[MAX_EXTRAP], elVel[MAX_EXTRAP];
+    double sum[2] = { 0.0, 0.0 };
+    double offset, target, f, err[2];
+    long   i, j = 0;
+    int    axis;
+
+    memset (res, 0, sizeof (*res));
+
+    for (i = 0, d = dem; i < job->n; i++, d += 3)
+    {
+        if (i == 0)
+        {
+            az.currentPos = d[1];
+            el.currentPos = d[2];
+        }
+
+        offset = d[0] + cfg[SWEEP_OFFSET];
+        if (mcs_step (d[0], d[1], d[2], offset, &az, &el, 0,
+                      azPos, azVel, elPos, elVel, &params) == 1)
+        {
+            res->notConnected++;
+            continue;
+        }
+        az.currentPos = azPos[0];
+        el.currentPos = elPos[0];
+
+        /* The first two cycles don't have three demands to fit */
+        if (i < 2)
+            continue;
+
+        /* The demands on each side of the time of the first point */
+        target = offset + params.timeInt;
+        while ((j + 1 < job->n) && (dem[3 * (j + 1)] <= target))
+            j++;
+        if ((j + 1 >= job->n) || (dem[3 * j] > target))
+            continue;
+
+        f = (dem[3 * (j + 1)] > dem[3 * j]) ?
+                (target - dem[3 * j]) / (dem[3 * (j + 1)] - dem[3 * j]) : 0.0;
+        err[MCS_AZ] = azPos[0] - (dem[3 * j + 1] + f * (dem[3 * (j + 1) + 1] - dem[3 * j + 1]));
+        err[MCS_EL] = elPos[0] - (dem[3 * j + 2] + f * (dem[3 * (j + 1) + 2] - dem[3 * j + 2]));
+
+        for (axis = MCS_AZ; axis <= MCS_EL; axis++)
+        {
+            sum[axis] += err[axis] * err[axis];
+            if (fabs (err[axis]) > res->maxError[axis])
+                res->maxError[axis] = fabs (err[axis]);
+        }
+        res->compared++;
+    }
+
+    for (axis = MCS_AZ; axis <= MCS_EL; axis++)
+    {
+        if (res->compared > 0)
+            res->rms[axis] = sqrt (sum[axis] / res->compared);
+        res->counters[axis] = params.counters[axis];
+    }
+}
+
+static void *worker (void *arg)
+{
+    sweep_worker *w = arg;
+    long k;
+
+    do
+    {
+        while ((k = take (&w->job->blocks[w->id])) >= 0)
+            run_config (w->job, k);
+    }
+    while (steal (w->job, w->id));
+
+    return NULL;
+}
+
+/*
+**  - - - - - - - - - -
+**   s w e e p _ r u n
+**  - - - - - - - - - -
+**
+**  Follows a series of demands with each of m configurations, on a pool
+**  of threads.
+**
+**  Given:
+**    demands   double[n][3]      (applyTime, azDemand, elDemand) per cycle
+**    n         long              number of cycles
+**    configs   double[m][SWEEP_COLUMNS]
+**                                limits, jump and offset of each run
+**    m         long              number of configurations (< 2^31)
+**    settings  mcs_parameters*   numExtrap, timeInt and localFit of the
+**                                runs (only those are used)
+**    threads   int               threads to use (<= 0: one per CPU)
+**
+**  Returned:
+**    results   sweep_result[m]   how each configuration did
+**
+**  Status:
+**            int       threads that ran
+**
+**  Notes:
+**
+**  1)  Each run starts from the initial state (mcs_init_parameters), and
+**      calls mcs_step once per demand, with the extrapolation starting
+**      offset seconds after the apply time. The mount is taken to follow
+**      perfectly, as in ring_follow.
+**
+**  2)  The tracking error of a cycle is the first extrapolated point
+**      (offset + timeInt) minus the demands interpolated at that time,
+**      from the third cycle on, while there are demands after it.
+**
+**  3)  If a thread can't be started, the others take its share.
+*/
+int sweep_run (const double *demands, long n, const double *configs, long m,
+               const mcs_parameters *settings, int threads,
+               sweep_result *results)
+{
+    pthread_t      tids[SWEEP_MAX_THREADS];
+    sweep_worker   workers[SWEEP_MAX_THREADS];
+    sweep_block    blocks[SWEEP_MAX_THREADS];
+    mcs_parameters initial;
+    sweep_job      job;
+    int            i, started = 1;
+
+    if (threads <= 0)
+        threads = (int)sysconf (_SC_NPROCESSORS_ONLN);
+    if (threads > SWEEP_MAX_THREADS)
+        threads = SWEEP_MAX_THREADS;
+    if (threads > m)
+        threads = (int)m;
+    if (threads < 1)
+        threads = 1;
+
+    mcs_init_parameters (&initial);
+    initial.numExtrap = settings->numExtrap;
+    initial.timeInt   = settings->timeInt;
+    initial.localFit  = settings->localFit;
+
+    /* Each thread starts with 1/threads of the configurations */
+    for (i = 0; i < threads; i++)
+        blocks[i].range = RANGE(m * i / threads, m * (i + 1) / threads);
+
+    job.demands  = demands;
+    job.n        = n;
+    job.configs  = configs;
+    job.initial  = &initial;
+    job.results  = results;
+    job.blocks   = blocks;
+    job.nthreads = threads;
+
+    for (i = 0; i < threads; i++)
+    {
+        workers[i].job = &job;
+        workers[i].id  = i;
+    }
+    for (i = 1; i < threads; i++)
+        if (pthread_create (&tids[started], NULL, worker, &workers[i]) == 0)
+            started++;
+
+    worker (&workers[0]);
+
+    for (i = 1; i < started; i++)
+        pthread_join (tids[i], NULL);
+
+    return started;
+}
@@ -0,0 +1,27 @@
+#ifndef __SWEEP_H__
+#define __SWEEP_H__
+
+#include "follow.h"
+
+/* Columns of a configuration of the sweep */
+#define SWEEP_AZ_MAX_VEL	0
+#define SWEEP_AZ_MAX_ACC	1
+#define SWEEP_EL_MAX_VEL	2
+#define SWEEP_EL_MAX_ACC	3
+#define SWEEP_JUMP		4	/* slew threshold, both axes       */
+#define SWEEP_OFFSET		5	/* extrapolation start - applyTime */
+#define SWEEP_COLUMNS		6
+
+/* How one configuration did. Errors in degrees */
+typedef struct {
+	double rms[2];			/* tracking error, MCS_AZ, MCS_EL */
+	double maxError[2];
+	long   compared;		/* cycles in the errors           */
+	long   notConnected;		/* cycles where the TCS had not connected */
+	mcs_axis_counters counters[2];
+} sweep_result;
+
+int sweep_run	(const double *, long, const double *, long,
+		 const mcs_parameters *, int, sweep_result *);
+
+#endif // __SWEEP_H__
@@ -0,0 +1,127 @@
+/* tcsring.c - Stand-in for the TCS, feeding demands through a ring
+ *
+ *   tcsring [-n name] [-r rate] [-c count] [-s slots] [-l lead]
+ *
+ * Publishes count demands (default 2000) to the shared memory ring called
+ * name (default /mcs-demands, see ring.c) at rate demands per second
+ * (default 200, the TCS rate; 0 sends them as fast as the ring takes
+ * them), and marks the ring finished. With -s, a ring of that many slots
+ * is created first; otherwise the ring must exist (eg. made by
+ * _mcs.DemandRing).
+ *
+ * The demands track a star at the sidereal rate: the apply time is the
+ * time of sending, in seconds from one second before the first demand,
+ * plus lead seconds (default 0). A summary is printed as JSON on stdout:
+ *
+ *   sent     demands published
+ *   dropped  demands that found the ring full (the TCS doesn't wait)
+ *   elapsed  seconds from the first demand to the last
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ring.h"
+#include "extrap.h"
+
+#define DEFAULT_NAME    "/mcs-demands"
+#define AZ_START        120.0           /* degrees               */
+#define EL_START        45.0
+#define AZ_RATE         0.0041780       /* degrees per second    */
+#define EL_RATE         0.0025000
+
+static void usage (const char *prog)
+{
+    fprintf (stderr, "Usage: %s [-n name] [-r rate] [-c count] [-s slots] [-l lead]\n", prog);
+    exit (2);
+}
+
+int main (int argc, char **argv)
+{
+    const char     *name = DEFAULT_NAME;
+    demand_ring     ring;
+    ring_demand     d;
+    struct timespec next;
+    double          rate = 200.0, lead = 0.0, start, t;
+    long            count = 2000, sent = 0, k;
+    long long       period = 0, at;
+    unsigned long   slots = 0, dropped;
+    int             opt;
+
+    while ((opt = getopt (argc, argv, "n:r:c:s:l:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                name = optarg;
+                break;
+            case 'r':
+                rate = atof (optarg);
+                break;
+            case 'c':
+                count = atol (optarg);
+                break;
+            case 's':
+                slots = strtoul (optarg, NULL, 0);
+                break;
+            case 'l':
+                lead = atof (optarg);
+                break;
+            default:
+                usage (argv[0]);
+        }
+    }
+    if ((optind != argc) || (rate < 0.0) || (count < 0))
+        usage (argv[0]);
+
+    /* The best kernel for the follow code linked in, as for _mcs */
+    extrapolate_set_level (-1);
+
+    if (((slots > 0) ? ring_create (&ring, name, slots) : ring_open (&ring, name)) == -1)
+    {
+        fprintf (stderr, "%s: %s: %s\n", argv[0], name, strerror (errno));
+        return 1;
+    }
+    dropped = ring.shm->dropped;
+    __atomic_store_n (&ring.shm->done, 0, __ATOMIC_RELAXED);
+
+    if (rate > 0.0)
+        period = (long long)(1e9 / rate + 0.5);
+    clock_gettime (CLOCK_MONOTONIC, &next);
+    at = (long long)next.tv_sec * 1000000000LL + next.tv_nsec;
+    start = ring_now ();
+
+    for (k = 0; k < count; k++)
+    {
+        if (period > 0)
+        {
+            at += period;
+            next.tv_sec  = at / 1000000000LL;
+            next.tv_nsec = at % 1000000000LL;
+            while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR)
+                ;
+        }
+
+        d.sent      = ring_now ();
+        t           = d.sent - start + 1.0;
+        d.applyTime = t + lead;
+        d.az        = AZ_START + AZ_RATE * t;
+        d.el        = EL_START + EL_RATE * t;
+        d.seq       = k;
+
+        if (ring_push (&ring, &d) == 0)
+            sent++;
+    }
+    ring_finish (&ring);
+
+    printf ("{\"name\": \"%s\", \"sent\": %ld, \"dropped\": %lu, \"elapsed\": %.6f}\n",
+            name, sent, ring.shm->dropped - dropped, ring_now () - start);
+    ring_close (&ring);
+
+    return 0;
+}
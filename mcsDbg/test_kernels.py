@@ -0,0 +1,124 @@
+# vim: ai:sw=4:sts=4:expandtab
+#
+# The vector kernels of the limiter and of the fits must give the same
+# bits as the scalar ones, which are fit_new_AZ_demand (see limit.c) and
+# calc_quadratic, calc_linear (see coeffs.c). Each kernel runs the same
+# scenarios, and the results are compared bit by bit.
+#
+#   python test_kernels.py
+
+import unittest
+import numpy as np
+import _mcs
+
+KERNELS = ('scalar', 'avx2', 'avx512')
+
+def bits(a):
+    return np.ascontiguousarray(a, dtype=np.float64).view(np.uint64)
+
+def available(select, name):
+    # The kernels the CPU can run (selecting one it can't gives a lower one)
+    previous = select()
+    try:
+        return select(name) == name
+    finally:
+        select(previous)
+
+class KernelTest(unittest.TestCase):
+    def assertSameBits(self, a, b, what):
+        a, b = bits(a), bits(b)
+        diff = np.flatnonzero(a != b)
+        self.assertEqual(len(diff), 0, "{0}: {1} elements differ, first at {2}".format(
+                         what, len(diff), diff[:1].tolist()))
+
+class LimiterTest(KernelTest):
+    N = 1003        # not a multiple of the vector width: the tail is scalar
+    CYCLES = 200
+
+    def scenarios(self, seed):
+        rng = np.random.RandomState(seed)
+        n = self.N
+        max_vel = rng.choice([0.0, 0.5, 2.0, 1e9], n)
+        max_acc = rng.choice([0.0, 0.25, 0.5, 1e9], n)
+        curr_pos = rng.choice([0.0, -0.0, 10.0, -170.0], n)
+        cycles = []
+        for c in range(self.CYCLES):
+            t = c * 0.005 + np.array([[-0.01], [-0.005], [0.0]]) + np.zeros((3, n))
+            # Ties, out of order and repeated times, jumps and zeros
+            shuffle = rng.rand(n) < 0.1
+            t[:, shuffle] = t[rng.permutation(3)][:, shuffle]
+            tie = rng.rand(n) < 0.05
+            t[1, tie] = t[2, tie]
+            pos = curr_pos + 0.4 * t + rng.choice([0.0, 0.0, 0.05, 5.0], (3, n))
+            pos[:, rng.rand(n) < 0.05] = 0.0
+            pos[:, rng.rand(n) < 0.02] = -0.0
+            cycles.append((t, pos))
+        return max_vel, max_acc, curr_pos, cycles
+
+    def run_kernel(self, name, scenarios):
+        max_vel, max_acc, curr_pos, cycles = scenarios
+        previous = _mcs.limiterKernel()
+        _mcs.limiterKernel(name)
+        try:
+            state = _mcs.limiterState(self.N)
+            out = []
+            for t, pos in cycles:
+                pos = pos.copy()
+                status = np.zeros(self.N)
+                _mcs.limitDemands(t, pos, max_vel, max_acc, curr_pos, state, status=status)
+                out.append((pos, status, np.array(state)))
+            return out
+        finally:
+            _mcs.limiterKernel(previous)
+
+    def test_kernels(self):
+        for seed in range(3):
+            scenarios = self.scenarios(seed)
+            expected = self.run_kernel('scalar', scenarios)
+            for name in KERNELS[1:]:
+                if not available(_mcs.limiterKernel, name):
+                    continue
+                got = self.run_kernel(name, scenarios)
+                for c, (a, b) in enumerate(zip(expected, got)):
+                    for what, x, y in zip(('positions', 'status', 'state'), a, b):
+                        self.assertSameBits(x, y, "{0} {1}, seed {2} cycle {3}".format(
+                                            name, what, seed, c))
+
+class FitTest(KernelTest):
+    N = 4099        # not a multiple of the vector width: the tail is scalar
+
+    def scenarios(self, seed):
+        rng = np.random.RandomState(seed)
+        n = self.N
+        ta = rng.choice([0.0, -0.0, 1.0, 2.5, 1e9 + 0.005], n)
+        tb = ta + rng.choice([0.0, -0.0, 0.005, -0.005, 0.25], n)
+        tc = tb + rng.choice([0.0, -0.0, 0.005, 0.01, -1.0], n)
+        # Mostly zeros of either sign, where only the signs tell the
+        # kernels apart, and some ordinary positions
+        pos = [rng.choice([0.0, -0.0, 0.0, -0.0, 1.5, -170.0, 1e-300], n) for k in range(3)]
+        # ta, pa, tb, pb, tc, pc
+        return ta, pos[0], tb, pos[1], tc, pos[2]
+
+    def run_kernel(self, name, calc, inputs):
+        previous = _mcs.fitKernel()
+        _mcs.fitKernel(name)
+        try:
+            return calc(*inputs)
+        finally:
+            _mcs.fitKernel(previous)
+
+    def test_kernels(self):
+        for seed in range(3):
+            inputs = self.scenarios(seed)
+            for calc in (_mcs.calcQuadratic, _mcs.calcLinear):
+                expected = self.run_kernel('scalar', calc, inputs)
+                for name in KERNELS[1:]:
+                    if not available(_mcs.fitKernel, name):
+                        continue
+                    got = self.run_kernel(name, calc, inputs)
+                    for what, x, y in zip(('c0', 'c1', 'c2', 'status'), expected, got):
+                        self.assertSameBits(x, y, "{0} {1} {2}, seed {3}".format(
+                                            name, calc.__name__, what, seed))
+
+if __name__ == '__main__':
+    unittest.main()
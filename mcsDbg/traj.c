@@ -0,0 +1,212 @@
+#include <math.h>
+#include <string.h>
+
+#include "traj.h"
+
+/*
+**  Synthetic TCS demands
+**
+**  Demand streams of any rate and length, to push the follow code harder
+**  than the recorded logs can: a star tracked across the sky, hops
+**  between stars (slews the follow code has to spot), and transits close
+**  to the zenith, where the azimuth sweeps half a turn in minutes. On top
+**  of that, the glitches seen from the real TCS can be added at random:
+**  repeated and out of order apply times, and dropouts.
+**
+**  Notes:
+**
+**  1)  The positions are the horizon coordinates of the star at the
+**      apply time of each demand, with the azimuth from the north through
+**      the east, unwrapped so that it never jumps by a turn.
+**
+**  2)  The glitches come from a generator seeded by the configuration,
+**      so the same configuration always gives the same demands. Without
+**      glitches, no random numbers are drawn.
+**
+**  3)  A repeated apply time keeps the position of the demand (the TCS
+**      sent a new position with a stale time); a reordered demand swaps
+**      places with the one before it.
+*/
+
+#define DEG2RAD		(M_PI / 180.0)
+#define SIDEREAL_RATE	7.2921158553e-5	/* radians per second      */
+#define GEMINI_NORTH	19.8238		/* latitude, degrees       */
+#define EL_LOW		20.0		/* hops stay between these */
+#define EL_HIGH		85.0
+
+static const char *kind_names[TRAJ_KINDS] = { "sidereal", "slew", "zenith" };
+
+/* next_random - Uniform double in [0, 1) (splitmix64)
+ */
+static double next_random (unsigned long long *state)
+{
+    unsigned long long z = (*state += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+
+    return (z >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* horizon - Azimuth and elevation (degrees) of a star at hour angle ha
+ * (radians), unwrapping the azimuth around prevAz unless first
+ */
+static void horizon (double sinLat, double cosLat, double sinDec, double cosDec,
+                     double ha, double prevAz, int first, double *az, double *el)
+{
+    double a;
+
+    *el = asin(sinLat * sinDec + cosLat * cosDec * cos(ha)) / DEG2RAD;
+
+    a = atan2(-cosDec * sin(ha), sinDec * cosLat - cosDec * cos(ha) * sinLat) / DEG2RAD;
+    if (first)
+        a = (a < 0.0) ? a + 360.0 : a;
+    else
+        a += 360.0 * floor((prevAz - a) / 360.0 + 0.5);
+    *az = a;
+}
+
+/* traj_defaults - Configuration for a kind of trajectory: a star 30
+ * degrees south of the zenith at Gemini North, an hour before transit
+ * (or centred on the transit, half a degree from the zenith), 200 demands
+ * per second from applyTime 1.0, 5 degree hops every 30 s, no glitches
+ */
+void traj_defaults (traj_config *cfg, int kind)
+{
+    memset(cfg, 0, sizeof(*cfg));
+
+    cfg->kind       = kind;
+    cfg->rate       = 200.0;
+    cfg->start      = 1.0;
+    cfg->latitude   = GEMINI_NORTH;
+    cfg->dec        = NAN;
+    cfg->hourAngle  = NAN;
+    cfg->miss       = NAN;
+    cfg->slew       = 5.0;
+    cfg->dwell      = 30.0;
+    cfg->dropLength = 0.05;
+    cfg->seed       = 1;
+}
+
+const char *traj_kind_name (int kind)
+{
+    if ((kind < 0) || (kind >= TRAJ_KINDS))
+        return "unknown";
+
+    return kind_names[kind];
+}
+
+/*
+**  - - - - - - - - - - - - - - -
+**   t r a j _ g e n e r a t e
+**  - - - - - - - - - - - - - - -
+**
+**  Generates the demands of count cycles, at cfg->rate per second.
+**
+**  Given:
+**    cfg       traj_config*  what to generate (see traj_defaults)
+**    count     long          cycles
+**
+**  Returned:
+**    demands   double[]      (applyTime, az, el) per demand, room for
+**                            count of them
+**
+**  Status:
+**            long      demands generated: count, less those lost in
+**                      dropouts
+**
+**  Notes:
+**
+**  1)  The defaults left as NaN are: dec, latitude - 30 (latitude - miss
+**      for ZENITH); hourAngle, -1 h (half the run before transit for
+**      ZENITH); miss, 0.5.
+**
+**  2)  A hop (SLEW) moves the target by 0.5 to 1 times slew in each
+**      axis, in random directions, keeping the elevation between EL_LOW
+**      and EL_HIGH. The hops are drawn from their own generator, so
+**      adding glitches doesn't change them.
+*/
+long traj_generate (const traj_config *cfg, long count, double *demands)
+{
+    unsigned long long glitch = cfg->seed, hops = ~cfg->seed;
+    double miss = isnan(cfg->miss) ? 0.5 : cfg->miss;
+    double dec, ha0, sinLat, cosLat, sinDec, cosDec;
+    double t, az = 0.0, el, offAz = 0.0, offEl = 0.0, nextHop, hop, tmp;
+    double *d;
+    long   k, n = 0, drop = 0;
+    int    i;
+
+    if (!isnan(cfg->dec))
+        dec = cfg->dec;
+    else
+        dec = cfg->latitude - ((cfg->kind == TRAJ_ZENITH) ? miss : 30.0);
+
+    if (!isnan(cfg->hourAngle))
+        ha0 = cfg->hourAngle * 15.0 * DEG2RAD;
+    else if (cfg->kind == TRAJ_ZENITH)
+        ha0 = -0.5 * count / cfg->rate * SIDEREAL_RATE;
+    else
+        ha0 = -15.0 * DEG2RAD;
+
+    sinLat = sin(cfg->latitude * DEG2RAD);
+    cosLat = cos(cfg->latitude * DEG2RAD);
+    sinDec = sin(dec * DEG2RAD);
+    cosDec = cos(dec * DEG2RAD);
+    nextHop = cfg->dwell;
+
+    for (k = 0; k < count; k++)
+    {
+        t = k / cfg->rate;
+
+        if (drop > 0)
+        {
+            drop--;
+            continue;
+        }
+        if ((cfg->dropouts > 0.0) && (next_random(&glitch) < cfg->dropouts))
+        {
+            /* This one and the next drop - 1 */
+            drop = (long)(-log(1.0 - next_random(&glitch)) * cfg->dropLength * cfg->rate);
+            continue;
+        }
+
+        horizon(sinLat, cosLat, sinDec, cosDec, ha0 + SIDEREAL_RATE * t,
+                az - offAz, (n == 0), &az, &el);
+
+        if ((cfg->kind == TRAJ_SLEW) && (cfg->dwell > 0.0) && (t >= nextHop))
+        {
+            hop = cfg->slew * (0.5 + 0.5 * next_random(&hops));
+            offAz += (next_random(&hops) < 0.5) ? -hop : hop;
+            hop = cfg->slew * (0.5 + 0.5 * next_random(&hops));
+            if (next_random(&hops) < 0.5)
+                hop = -hop;
+            if ((el + offEl + hop < EL_LOW) || (el + offEl + hop > EL_HIGH))
+                hop = -hop;
+            offEl += hop;
+            nextHop += cfg->dwell;
+        }
+        az += offAz;
+
+        d    = &demands[3 * n];
+        d[0] = cfg->start + t;
+        d[1] = az;
+        d[2] = el + offEl;
+
+        if (n > 0)
+        {
+            if ((cfg->duplicates > 0.0) && (next_random(&glitch) < cfg->duplicates))
+                d[0] = d[-3];
+            if ((cfg->reorder > 0.0) && (next_random(&glitch) < cfg->reorder))
+                for (i = 0; i < 3; i++)
+                {
+                    tmp      = d[i];
+                    d[i]     = d[i - 3];
+                    d[i - 3] = tmp;
+                }
+        }
+        n++;
+    }
+
+    return n;
+}
@@ -0,0 +1,34 @@
+#ifndef __TRAJ_H__
+#define __TRAJ_H__
+
+/* Kinds of trajectory */
+#define TRAJ_SIDEREAL	0	/* one star, tracked                    */
+#define TRAJ_SLEW	1	/* hops between stars, over the jumps   */
+#define TRAJ_ZENITH	2	/* a star transiting close to the zenith */
+#define TRAJ_KINDS	3
+
+/* What traj_generate makes. Angles in degrees, times in seconds. NaN
+ * in dec, hourAngle or miss leaves the default of the kind */
+typedef struct {
+	int    kind;
+	double rate;		/* demands per second                   */
+	double start;		/* applyTime of the first demand         */
+	double latitude;	/* of the telescope                      */
+	double dec;		/* declination of the star               */
+	double hourAngle;	/* hour angle of the star at start (h)   */
+	double miss;		/* zenith distance at transit (ZENITH)   */
+	double slew;		/* size of the hops (SLEW)               */
+	double dwell;		/* time between hops (SLEW)              */
+	/* Glitches: probability per demand, and mean length of a dropout */
+	double duplicates;	/* same applyTime as the previous demand */
+	double reorder;		/* swapped with the previous demand      */
+	double dropouts;	/* demands missing from here             */
+	double dropLength;
+	unsigned long long seed;
+} traj_config;
+
+void   traj_defaults	(traj_config *, int);
+long   traj_generate	(const traj_config *, long, double *);
+const char *traj_kind_name	(int);
+
+#endif // __TRAJ_H__
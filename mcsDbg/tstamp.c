@@ -0,0 +1,188 @@
+#include <stdio.h>
+
+#include "tstamp.h"
+
+/*
+**  - - - - - - - - - - - - - - - -
+**   d a y s _ f r o m _ c i v i l
+**  - - - - - - - - - - - - - - - -
+**
+**  Number of days from 1970-01-01 to the given proleptic Gregorian
+**  date (negative before it).
+*/
+long long days_from_civil (long y, unsigned m, unsigned d)
+{
+    long     era;
+    unsigned yoe, doy, doe;
+
+    y  -= m <= 2;
+    era = (y >= 0 ? y : y - 399) / 400;
+    yoe = (unsigned)(y - era * 400);
+    doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+    return (long long)era * 146097 + (long long)doe - 719468;
+}
+
+/* civil_from_days - Inverse of days_from_civil
+ */
+static void civil_from_days (long long z, long *y, unsigned *m, unsigned *d)
+{
+    long long era;
+    unsigned  doe, yoe, doy, mp;
+
+    z  += 719468;
+    era = (z >= 0 ? z : z - 146096) / 146097;
+    doe = (unsigned)(z - era * 146097);
+    yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    mp  = (5 * doy + 2) / 153;
+    *d  = doy - (153 * mp + 2) / 5 + 1;
+    *m  = mp < 10 ? mp + 3 : mp - 9;
+    *y  = (long)(yoe + era * 400) + (*m <= 2);
+}
+
+/* read_digits - Read between min and max decimal digits. Returns the
+ * number of digits read, or 0 if there were less than min.
+ */
+static int read_digits (const char **p, const char *end, int min, int max,
+                        long *value)
+{
+    int n = 0;
+
+    *value = 0;
+    while ((*p < end) && (n < max) && (**p >= '0') && (**p <= '9'))
+    {
+        *value = *value * 10 + (**p - '0');
+        (*p)++;
+        n++;
+    }
+
+    return (n >= min) ? n : 0;
+}
+
+static int expect (const char **p, const char *end, char c)
+{
+    if ((*p < end) && (**p == c))
+    {
+        (*p)++;
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+**  - - - - - - - - - - - - - - -
+**   p a r s e _ t i m e s t a m p
+**  - - - - - - - - - - - - - - -
+**
+**  Decode a log timestamp in the "%m/%d/%Y %H:%M:%S.%f" format.
+**
+**  Given:
+**    text      char*        timestamp (not necessarily NUL terminated)
+**    len       size_t       length of text
+**
+**  Returned:
+**    usec      long long*   microseconds since 1970-01-01 00:00:00
+**
+**  Status:
+**            int       0 = OK
+**                     -1 = malformed timestamp or invalid date/time
+**
+**  Notes:
+**
+**  1)  The fraction can have 1 to 9 digits. Digits past the sixth
+**      (ie. nanoseconds) are truncated.
+**
+**  2)  No timezone conversion is done: the result is the naive
+**      timestamp, as used by numpy.datetime64. For fractions of up to
+**      6 digits, or of 9 (the logs use one or the other),
+**      datetime.utcfromtimestamp(usec / 1e6) == get_datetime(text).
+**
+**  3)  With 7 or 8 digits the results differ: util.get_datetime drops
+**      the last three characters and reads "12.1234567" as 12.1234,
+**      where this reads 12.123456.
+*/
+int parse_timestamp (const char *text, size_t len, long long *usec)
+{
+    static const unsigned mdays[] = { 31, 28, 31, 30, 31, 30,
+                                      31, 31, 30, 31, 30, 31 };
+    const char *p = text, *end = text + len;
+    long        mon, day, year, hour, min, sec, frac;
+    int         ndig;
+    unsigned    maxday;
+
+    if (!read_digits(&p, end, 1, 2, &mon)  || !expect(&p, end, '/') ||
+        !read_digits(&p, end, 1, 2, &day)  || !expect(&p, end, '/') ||
+        !read_digits(&p, end, 4, 4, &year) || !expect(&p, end, ' ') ||
+        !read_digits(&p, end, 1, 2, &hour) || !expect(&p, end, ':') ||
+        !read_digits(&p, end, 1, 2, &min)  || !expect(&p, end, ':') ||
+        !read_digits(&p, end, 1, 2, &sec)  || !expect(&p, end, '.') ||
+        !(ndig = read_digits(&p, end, 1, 9, &frac)) || (p != end))
+        return -1;
+
+    if ((mon < 1) || (mon > 12) || (hour > 23) || (min > 59) || (sec > 59))
+        return -1;
+
+    maxday = mdays[mon - 1];
+    if ((mon == 2) && ((year % 4 == 0) && ((year % 100 != 0) || (year % 400 == 0))))
+        maxday = 29;
+    if ((day < 1) || ((unsigned)day > maxday))
+        return -1;
+
+    /* Scale the fraction to microseconds */
+    for (; ndig < 6; ndig++)
+        frac *= 10;
+    for (; ndig > 6; ndig--)
+        frac /= 10;
+
+    *usec = ((days_from_civil(year, mon, day) * 86400LL
+              + hour * 3600 + min * 60 + sec) * 1000000LL) + frac;
+
+    return 0;
+}
+
+/*
+**  - - - - - - - - - - - - - - - - -
+**   f o r m a t _ t i m e s t a m p
+**  - - - - - - - - - - - - - - - - -
+**
+**  Encode a timestamp in the "%m/%d/%Y %H:%M:%S.%f" format of the logs,
+**  the inverse of parse_timestamp.
+**
+**  Given:
+**    usec      long long    microseconds since 1970-01-01 00:00:00
+**
+**  Returned:
+**    text      char[27]     the timestamp, NUL terminated
+**
+**  Status:
+**            int       length of the text (26)
+*/
+int format_timestamp (long long usec, char *text)
+{
+    long long days, secs;
+    long      year;
+    unsigned  mon, day;
+    long      frac;
+
+    secs = usec / 1000000;
+    frac = (long)(usec % 1000000);
+    if (frac < 0)
+    {
+        frac += 1000000;
+        secs--;
+    }
+    days = secs / 86400;
+    secs %= 86400;
+    if (secs < 0)
+    {
+        secs += 86400;
+        days--;
+    }
+    civil_from_days(days, &year, &mon, &day);
+
+    return sprintf(text, "%02u/%02u/%04ld %02d:%02d:%02d.%06ld", mon, day, year,
+                   (int)(secs / 3600), (int)(secs / 60 % 60), (int)(secs % 60), frac);
+}
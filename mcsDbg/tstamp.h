@@ -0,0 +1,10 @@
+#ifndef __TSTAMP_H__
+#define __TSTAMP_H__
+
+#include <stddef.h>
+
+int parse_timestamp	(const char *, size_t, long long *);
+long long days_from_civil	(long, unsigned, unsigned);
+int format_timestamp	(long long, char *);
+
+#endif // __TSTAMP_H__
@@ -1,7 +1,12 @@
 # vim: ai:sw=4:sts=4:expandtab
+import os
+import itertools
 from datetime import datetime, timedelta
 from time import mktime
 import numpy as np
+import _mcs
+import colcache
+import logindex
 
 def get_datetime(text):
     try:
@@ -9,6 +14,30 @@ def get_datetime(text):
     except ValueError:
         return datetime.strptime(text[:-3], "%m/%d/%Y %H:%M:%S.%f")
 
+def get_timestamp(text):
+    """
+    Same as get_datetime, but returns the (naive) timestamp as integer
+    microseconds since the epoch. Decoded natively by _mcs. Fractions of
+    7 or 8 digits are truncated to microseconds, where get_datetime
+    drops their last three digits
+    """
+    return _mcs.parseTimestamp(text)
+
+EPOCH = datetime(1970, 1, 1)
+
+def datetime_to_us(dt):
+    """
+    Inverse of datetime_from_us: naive datetime to integer microseconds
+    """
+    delta = dt - EPOCH
+    return (delta.days * 86400 + delta.seconds) * 1000000 + delta.microseconds
+
+def datetime_from_us(t):
+    """
+    Naive datetime for a timestamp in integer microseconds (see get_timestamp)
+    """
+    return EPOCH + timedelta(microseconds=t)
+
 def get_split_stamp(dt):
     return mktime(dt.timetuple()), dt.microsecond
 
@@ -40,11 +69,57 @@ def generate_time_series(dt1, dt2, n, cma=None, to_datetime=True, reverse=False,
 
     return series
 
+class AsOf(object):
+    """
+    Value of a signal "as of" a given time: the last sample taken at or
+    before it. Reads the rows (time, value, ...) lazily, so the times
+    passed to value() must not decrease
+    """
+    def __init__(self, rows, column=1):
+        self.rows = iter(rows)
+        self.column = column
+        self.current = None
+        self.ahead = next(self.rows, None)
+
+    def value(self, t):
+        """
+        Returns the value at time t, or None if the signal has no sample
+        yet at that time
+        """
+        while self.ahead is not None and self.ahead[0] <= t:
+            self.current = self.ahead
+            self.ahead = next(self.rows, None)
+        if self.current is None:
+            return None
+        return self.current[self.column]
+
+TIMESTAMP_FORMATS = ('datetime', 'us', 'datetime64')
+
 class CsvFile(object):
-    def __init__(self, fobj, cols):
+    def __init__(self, fobj, cols, timestamps='datetime', cache=True):
         # Make sure that we're at the beginning of the file, and discard the first 4 lines (header)
         # "Cols" is the number of valid data columns, excluding the timestamp AND possible "Repeat" instances
+        # "timestamps" selects how the timestamps are returned:
+        #    'datetime'   - datetime objects
+        #    'us'         - integer microseconds since the epoch (no timezone conversion)
+        #    'datetime64' - numpy.datetime64 with microsecond resolution
+        # If "cache" is True and fobj is a file on disk, the parsed rows are saved to a binary
+        # columnar cache (see colcache) the first time the file is read, and later reads
+        # are served from it
+        # A file on disk can also be read from a given time or row on (window, from_time,
+        # from_row), using a sparse index of it (see logindex) made the first time it's needed
+        if timestamps not in TIMESTAMP_FORMATS:
+            raise ValueError("timestamps must be one of {0}".format(', '.join(TIMESTAMP_FORMATS)))
         self.cols = cols + 1
+        self.timestamps = timestamps
+        self.source = None
+        self.path = None
+        self._index = None
+        name = getattr(fobj, 'name', None)
+        if isinstance(name, str) and os.path.isfile(name):
+            self.path = name
+            if cache:
+                self.source = name
         fobj.seek(0)
         fobj.readline()
         fobj.readline()
@@ -53,52 +128,205 @@ class CsvFile(object):
         self.fobj = fobj
 
     def __iter__(self):
-        def data_tuples(f):
-            for line in f:
-                fields = line.strip().split('\t')
-                yield (get_datetime(fields[0]),) + tuple((float(x) for x in fields[1:self.cols])) + tuple(fields[self.cols:])
+        return self._convert(self._all_rows())
 
-        cma_delta = CumulativeAverage()
+    def _all_rows(self):
+        cache = self._open_cache()
+        if cache is not None:
+            return iter(cache)
+        rows = self._rows()
+        if self.source is not None:
+            rows = self._caching(rows)
+        return rows
+
+    def _convert(self, rows):
+        # Rows with the timestamps as asked for
+        if self.timestamps == 'datetime':
+            return ((datetime_from_us(row[0]),) + row[1:] for row in rows)
+        if self.timestamps == 'datetime64':
+            return ((np.datetime64(row[0], 'us'),) + row[1:] for row in rows)
+        return rows
+
+    def _open_cache(self):
+        if self.source is None:
+            return None
+        return colcache.open_cache(self.source, self.cols - 1)
+
+    def _caching(self, rows):
+        # Pass the rows through while saving them to the cache. The cache is only
+        # kept if the whole file was read
         try:
-            source = data_tuples(self.fobj)
-            while True:
-                fields = source.next()
-                if len(fields) == self.cols:
-                    yield fields
-                elif "Repeat" in fields[-1]:
-                    stack = []
-                    dt = fields[0]
-                    total_elements = int(fields[-1].split()[-1])
-                    yield fields[:-1]
-                    cols = fields[1:-1]
-
-                    repeating = True
-                    while repeating:
-                        try:
-                            next_fields = source.next()
-                            next_dt = next_fields[0]
-                            if len(next_fields) == self.cols:
-                                repeating = False
-                            else:
-                                raise ValueError("Corrupt data at {0}".format(next_fields[0]))
-
-                            stack = [(x,) + cols for x in [next_dt] + generate_time_series(dt, next_dt, n=total_elements, cma=cma_delta, reverse=True)[:-1]] + stack
-
-                            if repeating:
-                                dt = next_dt
-                                total_elements = int(next_fields[-1].split()[-1])
-                        except StopIteration:
-                            delta = timedelta(seconds=cma_delta.avg * total_elements)
-                            stack = [(x,) + cols for x in generate_time_series(dt, dt + delta, total_elements)[:-1]] + stack
-                            break
-                    while stack:
-                        yield stack.pop()
-                else:
-                    raise ValueError("Corrupt data at {0}".format(fields[0]))
-
-        except StopIteration:
-            pass
+            st = os.stat(self.source)
+            writer = colcache.ColumnarWriter(colcache.cache_path(self.source), self.cols - 1,
+                                             st.st_size, st.st_mtime)
+        except (IOError, OSError):
+            for row in rows:
+                yield row
+            return
+
+        complete = False
+        try:
+            for row in rows:
+                writer.append(row[0], row[1:])
+                yield row
+            complete = True
+        finally:
+            if complete:
+                writer.close()
+            else:
+                writer.abort()
+
+    def read_columns(self, cols=None, start=None, end=None):
+        """
+        Returns (times, [column, ...]) as numpy arrays: int64 microseconds, and
+        float64 for the data columns, given by their 0-based index (all of them
+        by default). Only rows with start <= time < end are returned; the limits
+        can be given as datetime or integer microseconds.
+
+        Uses the columnar cache, building it first if needed, so only the
+        requested columns and time range are read from disk
+        """
+        if isinstance(start, datetime):
+            start = datetime_to_us(start)
+        if isinstance(end, datetime):
+            end = datetime_to_us(end)
+
+        cache = self._open_cache()
+        if cache is None:
+            rows = self._rows()
+            if self.source is not None:
+                rows = self._caching(rows)
+            rows = list(rows)
+            cache = self._open_cache()
+        if cache is not None:
+            return cache.read(cols, start, end)
+
+        # No cache available: filter the rows in memory
+        if cols is None:
+            cols = range(self.cols - 1)
+        times = np.array([row[0] for row in rows], dtype=np.int64)
+        sel = np.ones(len(times), dtype=bool)
+        if start is not None:
+            sel &= times >= start
+        if end is not None:
+            sel &= times < end
+        return times[sel], [np.array([row[col + 1] for row in rows], dtype=np.float64)[sel] for col in cols]
+
+    def window(self, start=None, end=None):
+        """
+        Iterates over the rows with start <= time < end (datetime or integer
+        microseconds, None meaning no limit), in the order of the log. A file
+        on disk is only read from about start to about end
+        """
+        if isinstance(start, datetime):
+            start = datetime_to_us(start)
+        if isinstance(end, datetime):
+            end = datetime_to_us(end)
+
+        index = self._open_index()
+        if index is None:
+            rows = self._all_rows()
+        else:
+            first, last = index.for_time(start), index.until(end)
+            rows = self._rows_at(index, first, last)
+        rows = (row for row in rows if (start is None or row[0] >= start) and (end is None or row[0] < end))
+        return self._convert(rows)
+
+    def from_time(self, t):
+        """
+        Iterates over the rows from the last one before time t (datetime or
+        integer microseconds) on, and maybe a few more before it: what an
+        AsOf needs to give the values from t on. Assumes that the times
+        don't go back
+        """
+        if isinstance(t, datetime):
+            t = datetime_to_us(t)
+
+        index = self._open_index()
+        if index is None:
+            return self._convert(self._all_rows())
+        return self._convert(self._rows_at(index, max(index.for_time(t) - 1, 0)))
+
+    def from_row(self, n):
+        """
+        Iterates over the rows from the n-th (from 0) on, the Repeat runs
+        counted expanded, as when iterating over the whole log
+        """
+        index = self._open_index()
+        if index is None:
+            return self._convert(itertools.islice(self._all_rows(), n, None))
+        first = index.for_row(n)
+        rows = self._rows_at(index, first)
+        return self._convert(itertools.islice(rows, n - int(index.entries['row'][first]), None))
+
+    def _open_index(self):
+        if self.path is None:
+            return None
+        if self._index is None:
+            self._index = logindex.open_index(self.path, self.cols - 1)
+        return self._index
+
+    def reader(self, start=None):
+        """
+        Native reader (_mcs.LogReader) of the rows, with the timestamps as
+        integer microseconds, for join. With start, it reads from about that
+        time on, as from_time does. A file on disk is read afresh each time
+        """
+        if self.path is None:
+            return self._rows()
+        if isinstance(start, datetime):
+            start = datetime_to_us(start)
+        if start is None:
+            f = open(self.path, 'rb')
+            for i in range(4):
+                f.readline()
+            return _mcs.LogReader(f, self.cols - 1)
+        index = self._open_index()
+        return self._rows_at(index, max(index.for_time(start) - 1, 0))
+
+    def _rows_at(self, index, first, last=None):
+        # Reader of the rows from the line of entry first of the index, up to
+        # (and with) the line of entry last, which ends the Repeat run before it
+        if not len(index):
+            return _mcs.LogReader([], self.cols - 1)
+        entry = index.entries[first]
+        f = open(self.path, 'rb')
+        f.seek(int(entry['offset']))
+        lines = f
+        if last is not None:
+            lines = itertools.islice(f, int(index.entries['line'][last] - entry['line']) + 1)
+        return _mcs.LogReader(lines, self.cols - 1, period=float(entry['cmaAvg']),
+                              periods=int(entry['cmaN']))
+
+    def _rows(self):
+        # Parsed rows, with the timestamp as integer microseconds. The "Repeat N"
+        # lines are expanded into N evenly spaced samples by _mcs.LogReader, keeping
+        # only the current run in memory
+        return _mcs.LogReader(self.fobj, self.cols - 1)
+
+def join(files, driver=None, start=None, complete=False, batch=4096):
+    """
+    Joins CsvFiles by time in one pass (see _mcs.LogJoin), each signal held
+    at its last sample. With driver (the index of a file), there is a row
+    per sample of that file, otherwise one per time in any of them; with
+    complete, only the rows where every signal has a sample (before that,
+    the values are NaN). With start (datetime or integer microseconds), the
+    files are read from about that time on (see CsvFile.from_time), and
+    the rows before it are left out.
 
+    Yields numpy arrays of up to batch rows: the time in microseconds (as
+    a float64, exact), then the data columns of the files in order
+    """
+    if isinstance(start, datetime):
+        start = datetime_to_us(start)
+    for rows in _mcs.LogJoin([f.reader(start) for f in files], driver=driver,
+                             complete=complete, batch=batch):
+        rows = np.asarray(rows)
+        if start is not None:
+            rows = rows[rows[:, 0] >= start]
+            if not len(rows):
+                continue
+        yield rows
 
 if __name__ == '__main__':
     fname = 'test_data/azCurrentMaxAcc'
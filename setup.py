@@ -1,7 +1,16 @@
-from distutils.core import setup, Extension
+try:
+    from setuptools import setup, Extension
+except ImportError:
+    from distutils.core import setup, Extension
 
 mcs_module = Extension('mcsDbg._mcs',
-		       sources=['mcsDbg/mcs.c', 'mcsDbg/follow.c'])
+		       sources=['mcsDbg/mcs.c', 'mcsDbg/follow.c', 'mcsDbg/extrap.c',
+				'mcsDbg/tstamp.c', 'mcsDbg/logrows.c', 'mcsDbg/limit.c',
+				'mcsDbg/coeffs.c', 'mcsDbg/pace.c', 'mcsDbg/hist.c',
+				'mcsDbg/ring.c', 'mcsDbg/traj.c', 'mcsDbg/simd.c',
+				'mcsDbg/sweep.c', 'mcsDbg/join.c'],
+		       libraries=['rt', 'pthread'],
+		       extra_compile_args=['-ffp-contract=off'])
 
 setup (name = 'mcsDbg',
        description = 'Debugging tools for MCS algorithms',